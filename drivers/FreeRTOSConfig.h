@@ -127,7 +127,8 @@ to exclude the API function. */
 #define INCLUDE_vTaskSuspend            0
 #define INCLUDE_vTaskDelayUntil         1
 #define INCLUDE_vTaskDelay              1
-#define INCLUDE_uxTaskGetStackHighWaterMark 0
+#define INCLUDE_uxTaskGetStackHighWaterMark 1
+#define INCLUDE_xTaskGetCurrentTaskHandle 1
 // #define INCLUDE_xEventGroupSetBitFromISR 1
 // #define INCLUDE_xTimerPendFunctionCall  1
 
@@ -0,0 +1,262 @@
+// Benchmark of the firmware hot paths on the host, see "Host build" in README.md
+//
+// Boots the unmodified firmware on the simulated board and loads it like a
+// busy pinball machine: 64 quick rules, all output pins pulsed periodically,
+// bursts of switch toggles on the matrix and the input PCFs and a stream of
+// LED frames for 1024 LEDs. Afterwards
+// the profiler statistics of the firmware are printed, followed by direct
+// timings of debounceAlgo() and fillPiongBuffer().
+//
+//   bench [-t seconds] [-o outPCFs] [-n toggles] [-b burst_ms] [-p pulse_ms] [-l led_ms] [-e swe] [-s]
+//
+// By default PRF_CYCLES() counts host CPU time (scaled to 80 cycles / us),
+// which is what the CPU bound rows (debounceAlgo() ... setPCFOutput()) are
+// about. With -s it counts simulated time instead, then the I2C scan and
+// rule latency rows show the bus timing and the CPU rows read 0.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "hal.h"
+#include "sim.h"
+#include "FreeRTOS.h"
+#include "io_manager.h"
+#include "quick_rules.h"
+#include "myTasks.h"
+#include "mySpi.h"
+#include "profiler.h"
+#include "utils/uartstdio.h"
+
+int firmware_main(void);
+void debounceAlgo(uint32_t *sample, uint32_t *state, uint32_t *toggle, uint32_t *noDebounce);
+uint8_t *fillPiongBuffer(uint8_t *srcPointer, uint16_t *destPointer, int32_t *nBytesLeft);
+
+#define N_MATRIX        64          // switch matrix inputs 0x00 - 0x3F
+#define N_PCF           32          // 4 channels x 8 PCFs
+#define HW_PCF(n, pin)  (0x40 + (n) * 8 + (pin))
+#define HW_PWM0         60          // first of the 4 FAST_PWM outputs
+#define T_SETUP         (200 * SIM_NS_PER_MS)
+
+static struct {
+    unsigned seconds;
+    unsigned nOutPcf;       // PCFs 0 .. nOutPcf-1 are outputs, the rest inputs
+    unsigned nToggles;      // switch toggles per burst
+    unsigned burstMs;
+    unsigned pulseMs;
+    unsigned ledMs;         // LED frame period, 0 = no LED frames
+    unsigned sweMode;       // g_reportSwitchEvents
+} g_cfg = {10, 16, 40, 20, 50, 40, SWE_BINARY};
+
+#define N_LEDS          1024
+
+static uint64_t g_txBytes, g_nBursts, g_nPulses, g_nFrames;
+
+static void txSink(const uint8_t *data, uint32_t len)
+{
+    (void)data;
+    g_txBytes += len;
+}
+
+static unsigned nOutPins()
+{
+    return g_cfg.nOutPcf * 8;
+}
+
+// Output of quick rule i: I2C pins round robin, the last 4 on the HW. PWM
+static uint16_t ruleOutput(unsigned i)
+{
+    if (i >= MAX_QUICK_RULES - 4 || !nOutPins()) {
+        return HW_PWM0 + i % 4;
+    }
+    return HW_PCF(0, 0) + i % nOutPins();
+}
+
+// A random switch, on the matrix or an input PCF
+static uint16_t randomInput()
+{
+    unsigned nIn = N_MATRIX + (N_PCF - g_cfg.nOutPcf) * 8;
+    unsigned i = rand() % nIn;
+    return i < N_MATRIX ? i : HW_PCF(g_cfg.nOutPcf, 0) + i - N_MATRIX;
+}
+
+static void burst(void *arg)
+{
+    (void)arg;
+    for (unsigned i = 0; i < g_cfg.nToggles; i++) {
+        uint16_t hw = randomInput();
+        hal_set_switch(hw, !hal_get_switch(hw));
+    }
+    g_nBursts++;
+    simAt(g_simNow + g_cfg.burstMs * SIM_NS_PER_MS, burst, NULL);
+}
+
+// Fire every output pin, like a host sending OUT commands
+static void pulse(void *arg)
+{
+    (void)arg;
+    for (unsigned i = 0; i < nOutPins(); i++) {
+        t_hw_index pin = decodeHwIndex(HW_PCF(0, i), false);
+        setPCFOutput(&pin, 10 + i % 20, 15, i % 3);
+    }
+    for (unsigned i = 0; i < 4; i++) {
+        t_hw_index pin = decodeHwIndex(HW_PWM0 + i, false);
+        setPCFOutput(&pin, 20, MAX_PWM, MAX_PWM / 4);
+    }
+    g_nPulses++;
+    simAt(g_simNow + g_cfg.pulseMs * SIM_NS_PER_MS, pulse, NULL);
+}
+
+// A new frame for the LEDs on channel 0, like a light show
+static void ledFrame(void *arg)
+{
+    static uint8_t frame[32 + N_LEDS * 3];
+    unsigned n = snprintf((char *)frame, 32, "LED 0 %u\n", N_LEDS * 3);
+    (void)arg;
+    for (unsigned i = 0; i < N_LEDS * 3; i++) {
+        frame[n + i] = g_nFrames + i;
+    }
+    usbHostWrite(frame, n + N_LEDS * 3);
+    g_nFrames++;
+    simAt(g_simNow + g_cfg.ledMs * SIM_NS_PER_MS, ledFrame, NULL);
+}
+
+// Runs between the ticks, once the firmware is up
+static void setup(void *arg)
+{
+    char cmd[32];
+    (void)arg;
+    // Boot writes 0 to all PCFs, the host makes the input PCFs readable
+    for (unsigned n = g_cfg.nOutPcf; n < N_PCF; n++) {
+        snprintf(cmd, sizeof(cmd), "HI 0x%x\n", HW_PCF(n, 0));
+        usbHostWrite((const uint8_t *)cmd, strlen(cmd));
+    }
+    for (unsigned i = 0; i < MAX_QUICK_RULES; i++) {
+        setupQuickRule(
+            i, decodeHwIndex(i % N_MATRIX, true), decodeHwIndex(ruleOutput(i), false),
+            5, 10, 15, 0, i & 1
+        );
+    }
+    g_reportSwitchEvents = g_cfg.sweMode;
+    prfReset();
+    simAt(g_simNow + SIM_NS_PER_MS / 2, burst, NULL);
+    simAt(g_simNow + SIM_NS_PER_MS / 3, pulse, NULL);
+    if (g_cfg.ledMs) {
+        simAt(g_simNow + SIM_NS_PER_MS / 4, ledFrame, NULL);
+    }
+}
+
+//*****************************************************************************
+// Direct timings
+//*****************************************************************************
+static void benchDebounce()
+{
+    enum { N_SAMPLES = 256, N_RUNS = 200000 };
+    static uint32_t samples[N_SAMPLES][N_LONGS];
+    uint32_t state[N_LONGS] = {0}, toggle[N_LONGS], noDebounce[N_LONGS] = {0};
+    for (unsigned i = 0; i < N_SAMPLES; i++) {
+        for (unsigned j = 0; j < N_LONGS; j++) {
+            // Mostly stable inputs with a few bouncing bits
+            samples[i][j] = 0x0F0F00FF ^ (rand() & rand() & rand());
+        }
+    }
+    uint64_t t0 = hal_host_ns();
+    for (unsigned i = 0; i < N_RUNS; i++) {
+        debounceAlgo(samples[i % N_SAMPLES], state, toggle, noDebounce);
+        __asm__ volatile("" ::: "memory");
+    }
+    uint64_t t = hal_host_ns() - t0;
+    printf("%24s: %8.1f ns / call (%u x %u bit)\n",
+           "debounceAlgo()", (double)t / N_RUNS, (unsigned)(N_LONGS), 32);
+}
+
+static void benchFillPiong()
+{
+    enum { N_RUNS = 2000 };
+    static uint8_t src[N_LEDS * 3];
+    static uint16_t dest[SPI_DMA_BUFFER_SIZE];
+    unsigned nBlocks = 0;
+    for (unsigned i = 0; i < sizeof(src); i++) {
+        src[i] = rand();
+    }
+    uint64_t t0 = hal_host_ns();
+    for (unsigned r = 0; r < N_RUNS; r++) {
+        uint8_t *p = src;
+        int32_t nLeft = sizeof(src);
+        while (nLeft > 0) {
+            p = fillPiongBuffer(p, dest, &nLeft);
+            __asm__ volatile("" ::: "memory");
+            nBlocks++;
+        }
+    }
+    uint64_t t = hal_host_ns() - t0;
+    printf("%24s: %8.1f ns / block of %u words, %.1f us / %u LEDs\n",
+           "fillPiongBuffer()", (double)t / nBlocks, SPI_DMA_BUFFER_SIZE,
+           (double)t / N_RUNS / 1000, N_LEDS);
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr,
+        "usage: %s [-t seconds] [-o outPCFs] [-n toggles] [-b burst_ms] [-p pulse_ms] [-l led_ms] [-e swe] [-s]\n"
+        "  -t  simulated run time [s] (%u)\n"
+        "  -o  number of output PCFs 0 - %u, the others are inputs (%u)\n"
+        "  -n  switch toggles per burst (%u)\n"
+        "  -b  burst period [ms] (%u)\n"
+        "  -p  period of pulsing all outputs [ms] (%u)\n"
+        "  -l  LED frame period [ms], 0 = off (%u)\n"
+        "  -e  switch event reports, 1 = text, 2 = binary, 3 = binary with time stamp (%u)\n"
+        "  -s  profile simulated time instead of host CPU time\n",
+        name, g_cfg.seconds, N_PCF, g_cfg.nOutPcf, g_cfg.nToggles, g_cfg.burstMs, g_cfg.pulseMs,
+        g_cfg.ledMs, g_cfg.sweMode);
+    exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+    int c;
+    g_halClock = HAL_CLOCK_HOST;
+    while ((c = getopt(argc, argv, "t:o:n:b:p:l:e:s")) != -1) {
+        switch (c) {
+        case 't': g_cfg.seconds = atoi(optarg); break;
+        case 'o': g_cfg.nOutPcf = atoi(optarg); break;
+        case 'n': g_cfg.nToggles = atoi(optarg); break;
+        case 'b': g_cfg.burstMs = atoi(optarg); break;
+        case 'p': g_cfg.pulseMs = atoi(optarg); break;
+        case 'l': g_cfg.ledMs = atoi(optarg); break;
+        case 'e': g_cfg.sweMode = atoi(optarg); break;
+        case 's': g_halClock = HAL_CLOCK_SIM; break;
+        default: usage(argv[0]);
+        }
+    }
+    if (g_cfg.nOutPcf > N_PCF || !g_cfg.burstMs || !g_cfg.pulseMs || !g_cfg.seconds ||
+        g_cfg.sweMode < SWE_TEXT || g_cfg.sweMode > SWE_BIN_TS) {
+        usage(argv[0]);
+    }
+    srand(1);
+    g_halUart = NULL;
+    g_usbTxSink = txSink;
+    simAt(T_SETUP, setup, NULL);
+    g_rtosEndTime = T_SETUP + g_cfg.seconds * SIM_NS_PER_S;
+
+    uint64_t t0 = hal_host_ns();
+    firmware_main();
+    double tHost = (hal_host_ns() - t0) / 1e9;
+
+    printf("%u s simulated in %.2f s, %u output PCFs, %u quick rules, "
+           "%llu bursts of %u toggles, %llu output pulses, %llu LED frames, %llu bytes to USB\n",
+           g_cfg.seconds, tHost, g_cfg.nOutPcf, MAX_QUICK_RULES,
+           (unsigned long long)g_nBursts, g_cfg.nToggles,
+           (unsigned long long)g_nPulses, (unsigned long long)g_nFrames,
+           (unsigned long long)g_txBytes);
+    printf("Profiler (%s time, cycles at 80 MHz):\n",
+           g_halClock == HAL_CLOCK_HOST ? "host CPU" : "simulated");
+    fflush(stdout);
+    globalDebugEnabled = 1;
+    g_halUart = stdout;
+    prfPrint();
+    rtos_print_state(stdout);
+    printf("Direct timings on the host:\n");
+    benchDebounce();
+    benchFillPiong();
+    return 0;
+}
@@ -0,0 +1,87 @@
+#!/usr/bin/env python3
+"""
+Rewrite the bit-band accesses of a preprocessed firmware source for the host.
+
+HWREGBITB() / HWREGBITW() expand to __HAL_BITB(x, b) (see host/hal/hal.h).
+An assignment `__HAL_BITB(x, b) = v` becomes `hal_bitb_set(x, b, v)`,
+every other use becomes `hal_bitb_get(x, b)`.
+
+usage: bitband.py < file.i > file.c
+"""
+import re
+import sys
+
+MARK = "__HAL_BITB"
+
+
+def match_paren(s, i):
+    """ index after the `)` which closes the `(` at s[i] """
+    depth = 0
+    while i < len(s):
+        c = s[i]
+        if c == '(':
+            depth += 1
+        elif c == ')':
+            depth -= 1
+            if depth == 0:
+                return i + 1
+        elif c in '"\'':
+            i = skip_literal(s, i)
+            continue
+        i += 1
+    raise ValueError("unbalanced parentheses after " + MARK)
+
+
+def skip_literal(s, i):
+    """ index after the string or char literal starting at s[i] """
+    q = s[i]
+    i += 1
+    while s[i] != q:
+        i += 2 if s[i] == '\\' else 1
+    return i + 1
+
+
+def rhs_end(s, i):
+    """ end of the right hand side of an assignment starting at s[i] """
+    depth = 0
+    while i < len(s):
+        c = s[i]
+        if c in '([{':
+            depth += 1
+        elif c in ')]}':
+            if depth == 0:
+                return i
+            depth -= 1
+        elif c in ';,' and depth == 0:
+            return i
+        elif c in '"\'':
+            i = skip_literal(s, i)
+            continue
+        i += 1
+    return i
+
+
+def rewrite(s):
+    out = []
+    pos = 0
+    while True:
+        i = s.find(MARK, pos)
+        if i < 0:
+            out.append(s[pos:])
+            return ''.join(out)
+        out.append(s[pos:i])
+        open_i = s.index('(', i)
+        close_i = match_paren(s, open_i)
+        args = rewrite(s[open_i + 1:close_i - 1])
+        m = re.compile(r'\s*=(?!=)').match(s, close_i)
+        if m:
+            end = rhs_end(s, m.end())
+            out.append("hal_bitb_set(%s, %s)" % (args, rewrite(s[m.end():end]).strip()))
+            pos = end
+        else:
+            out.append("hal_bitb_get(%s)" % args)
+            pos = close_i
+
+
+if __name__ == '__main__':
+    sys.stdout.write(rewrite(sys.stdin.read()))
@@ -0,0 +1,667 @@
+// Simulated register file, NVIC, GPIO, timers and watchdog behind hal.h
+// and the host versions of the ustdlib and uartstdio functions.
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "hal.h"
+#include "sim.h"
+
+t_halClock g_halClock = HAL_CLOCK_SIM;
+FILE *g_halUart = NULL;
+void (*g_halPwmHook)(unsigned channel, uint16_t value) = NULL;
+
+// Same flag as in drivers/my_uartstdio.c, which is not compiled on the host
+bool globalDebugEnabled = 1;
+
+static void halDefaultReset(void)
+{
+    hal_fatal("software reset requested (NVIC_APINT)");
+}
+void (*g_halResetHook)(void) = halDefaultReset;
+
+//*****************************************************************************
+// Register file
+//*****************************************************************************
+// Two 1 MB windows: peripherals at 0x400xxxxx, system control at 0xE00xxxxx
+#define HAL_WIN_WORDS (0x100000 / 4)
+static uint32_t g_regPeriph[HAL_WIN_WORDS];
+static uint32_t g_regScs[HAL_WIN_WORDS];
+
+static const uint32_t g_i2cBase[4] = {I2C0_BASE, I2C1_BASE, I2C2_BASE, I2C3_BASE};
+static const uint8_t g_i2cInt[4] = {INT_I2C0, INT_I2C1, INT_I2C2, INT_I2C3};
+// Compare registers of setPwm() channel 0 - 3
+static const uint32_t g_pwmReg[4] = {
+    PWM0_BASE + PWM_GEN_1 + PWM_O_X_CMPA, PWM0_BASE + PWM_GEN_1 + PWM_O_X_CMPB,
+    PWM0_BASE + PWM_GEN_3 + PWM_O_X_CMPA, PWM0_BASE + PWM_GEN_3 + PWM_O_X_CMPB
+};
+static uint32_t g_pwmShadow[4];
+
+uint32_t *hal_raw(uint32_t addr)
+{
+    switch (addr >> 20) {
+    case 0x400:
+        return &g_regPeriph[(addr & 0xFFFFF) >> 2];
+    case 0xE00:
+        return &g_regScs[(addr & 0xFFFFF) >> 2];
+    }
+    hal_fatal("hal_reg(): no register at 0x%08x", addr);
+}
+
+static uint32_t halCycles()
+{
+    if (g_halClock == HAL_CLOCK_HOST) {
+        return (uint32_t)SIM_NS_TO_CYCLES(hal_host_ns());
+    }
+    return (uint32_t)SIM_NS_TO_CYCLES(g_simNow);
+}
+
+void hal_sync()
+{
+    simLock();
+    // A value below IDLE with RUN set is a command written by the firmware
+    for (unsigned ch = 0; ch < 4; ch++) {
+        uint32_t mcs = *hal_raw(g_i2cBase[ch] + I2C_O_MCS);
+        if (mcs < I2C_MCS_IDLE && (mcs & I2C_MCS_RUN)) {
+            i2cModelCommand(ch, mcs);
+        }
+    }
+    uint32_t *apint = hal_raw(NVIC_APINT);
+    if ((*apint & 0xFFFF0000) == NVIC_APINT_VECTKEY && (*apint & NVIC_APINT_SYSRESETREQ)) {
+        *apint = 0;
+        g_halResetHook();
+    }
+    for (unsigned ch = 0; ch < 4; ch++) {
+        uint32_t v = *hal_raw(g_pwmReg[ch]);
+        if (v != g_pwmShadow[ch]) {
+            g_pwmShadow[ch] = v;
+            if (g_halPwmHook) g_halPwmHook(ch, v);
+        }
+    }
+    simUnlock();
+}
+
+volatile uint32_t *hal_reg(uint32_t addr)
+{
+    uint32_t *r;
+    simLock();
+    hal_sync();
+    r = hal_raw(addr);
+    switch (addr) {
+    case 0xE0001004:    // DWT_CYCCNT, writes are ignored
+        *r = halCycles();
+        break;
+    case NVIC_INT_CTRL:
+        *r = hal_irq_active();
+        break;
+    case WTIMER0_BASE + TIMER_O_TAV:    // counts down at 1 MHz
+        *r = ~(uint32_t)(g_simNow / SIM_NS_PER_US);
+        break;
+    case I2C0_BASE + I2C_O_MCS:
+    case I2C1_BASE + I2C_O_MCS:
+    case I2C2_BASE + I2C_O_MCS:
+    case I2C3_BASE + I2C_O_MCS:
+        // Busy polling in thread mode lets the simulated time pass
+        if (!hal_irq_active()) {
+            i2cModelWaitIdle((addr - I2C0_BASE) >> 12);
+        }
+        break;
+    }
+    simUnlock();
+    return r;
+}
+
+uint32_t hal_bitb_get(const volatile void *p, unsigned b)
+{
+    return (((const volatile uint8_t *)p)[b / 8] >> (b % 8)) & 1;
+}
+
+uint32_t hal_bitb_set(volatile void *p, unsigned b, uint32_t v)
+{
+    volatile uint8_t *byte = (volatile uint8_t *)p + b / 8;
+    if (v & 1) {
+        *byte |= 1 << (b % 8);
+    } else {
+        *byte &= ~(1 << (b % 8));
+    }
+    return v;
+}
+
+uint16_t hal_get_pwm(unsigned channel)
+{
+    return channel < 4 ? *hal_raw(g_pwmReg[channel]) : 0;
+}
+
+//*****************************************************************************
+// NVIC
+//*****************************************************************************
+extern void i2CIntHandler0(void);
+extern void i2CIntHandler1(void);
+extern void i2CIntHandler2(void);
+extern void i2CIntHandler3(void);
+extern void spiISR(uint8_t channel);
+extern void WatchdogIntHandler(void);
+
+static void ssi1IntHandler(void) {spiISR(0);}
+static void ssi2IntHandler(void) {spiISR(1);}
+static void ssi3IntHandler(void) {spiISR(2);}
+
+// Same handlers as in the vector table of startup_gcc.c
+static void (* const g_halVectors[NUM_INTERRUPTS])(void) = {
+    [INT_I2C0] = i2CIntHandler0,
+    [INT_I2C1] = i2CIntHandler1,
+    [INT_I2C2] = i2CIntHandler2,
+    [INT_I2C3] = i2CIntHandler3,
+    [INT_SSI1] = ssi1IntHandler,
+    [INT_SSI2] = ssi2IntHandler,
+    [INT_SSI3] = ssi3IntHandler,
+    [INT_WATCHDOG] = WatchdogIntHandler,
+    [INT_USB0] = usbIntHandler,
+};
+
+static bool g_irqEnabled[NUM_INTERRUPTS];
+static bool g_irqPending[NUM_INTERRUPTS];
+static uint8_t g_irqPrio[NUM_INTERRUPTS];
+static unsigned g_irqActive = 0;
+static bool g_irqMasked = false;
+
+static void irqCheck(uint32_t n)
+{
+    if (n >= NUM_INTERRUPTS) hal_fatal("no interrupt %u", n);
+}
+
+void hal_irq_dispatch()
+{
+    // No nesting, the lowest priority value (then the lowest number) goes first
+    simLock();
+    while (!g_irqActive && !g_irqMasked) {
+        unsigned best = 0;
+        for (unsigned n = 1; n < NUM_INTERRUPTS; n++) {
+            if (g_irqPending[n] && g_irqEnabled[n] &&
+                (!best || g_irqPrio[n] < g_irqPrio[best])) {
+                best = n;
+            }
+        }
+        if (!best) break;
+        if (!g_halVectors[best]) hal_fatal("no handler for interrupt %u", best);
+        g_irqPending[best] = false;
+        g_irqActive = best;
+        g_halVectors[best]();
+        hal_sync();
+        g_irqActive = 0;
+    }
+    simUnlock();
+}
+
+void hal_irq_pend(unsigned intNo)
+{
+    irqCheck(intNo);
+    simLock();
+    g_irqPending[intNo] = true;
+    hal_irq_dispatch();
+    simUnlock();
+}
+
+unsigned hal_irq_active()
+{
+    return g_irqActive;
+}
+
+void hal_irq_mask(bool masked)
+{
+    g_irqMasked = masked;
+    if (!masked) hal_irq_dispatch();
+}
+
+void ROM_IntEnable(uint32_t ui32Interrupt)
+{
+    irqCheck(ui32Interrupt);
+    simLock();
+    g_irqEnabled[ui32Interrupt] = true;
+    hal_irq_dispatch();
+    simUnlock();
+}
+
+void ROM_IntDisable(uint32_t ui32Interrupt)
+{
+    irqCheck(ui32Interrupt);
+    g_irqEnabled[ui32Interrupt] = false;
+}
+
+void ROM_IntPrioritySet(uint32_t ui32Interrupt, uint8_t ui8Priority)
+{
+    irqCheck(ui32Interrupt);
+    g_irqPrio[ui32Interrupt] = ui8Priority;
+}
+
+void IntPendClear(uint32_t ui32Interrupt)
+{
+    irqCheck(ui32Interrupt);
+    g_irqPending[ui32Interrupt] = false;
+}
+
+void IntTrigger(uint32_t ui32Interrupt)
+{
+    // A software triggered I2C interrupt starts a PCF scan
+    simLock();
+    for (unsigned ch = 0; ch < 4; ch++) {
+        if (ui32Interrupt == g_i2cInt[ch]) {
+            i2cModelScanStart(ch);
+        }
+    }
+    hal_irq_pend(ui32Interrupt);
+    simUnlock();
+}
+
+//*****************************************************************************
+// GPIO and the switch matrix
+//*****************************************************************************
+typedef struct {
+    uint8_t out;    // output latch
+    uint8_t dir;    // 1 = output
+    uint8_t in;     // level of the input pins
+} t_halGpio;
+
+// Port A - F
+static t_halGpio g_gpio[6];
+// Switch matrix: closed switches of each column (bit = row)
+static uint8_t g_matrix[8];
+// Column shift register on PB0 (data) and PB1 (clock)
+static uint8_t g_smShift, g_smLatch;
+
+static t_halGpio *gpioPort(uint32_t base)
+{
+    switch (base) {
+    case GPIO_PORTA_BASE: return &g_gpio[0];
+    case GPIO_PORTB_BASE: return &g_gpio[1];
+    case GPIO_PORTC_BASE: return &g_gpio[2];
+    case GPIO_PORTD_BASE: return &g_gpio[3];
+    case GPIO_PORTE_BASE: return &g_gpio[4];
+    case GPIO_PORTF_BASE: return &g_gpio[5];
+    }
+    hal_fatal("no GPIO port at 0x%08x", base);
+}
+
+// Drive the row sense lines (active low) from the selected column
+static void matrixUpdate()
+{
+    uint8_t closed = 0;
+    for (unsigned col = 0; col < 8; col++) {
+        if (g_smLatch & (1 << col)) closed |= g_matrix[col];
+    }
+    uint8_t rows = ~closed;
+    g_gpio[4].in = (g_gpio[4].in & ~0x0E) | ((rows << 3) & 0x08) |
+                   ((rows << 1) & 0x04) | ((rows >> 1) & 0x02);    // PE3, PE2, PE1
+    g_gpio[2].in = (g_gpio[2].in & ~0xC0) | ((rows << 3) & 0xC0);  // PC6, PC7
+    g_gpio[3].in = (g_gpio[3].in & ~0xC0) | ((rows << 1) & 0xC0);  // PD6, PD7
+    g_gpio[5].in = (g_gpio[5].in & ~0x10) | ((rows >> 3) & 0x10);  // PF4
+}
+
+__attribute__((constructor)) static void gpioInit()
+{
+    for (unsigned i = 0; i < 6; i++) g_gpio[i].in = 0xFF;
+}
+
+void ROM_GPIODirModeSet(uint32_t ui32Port, uint8_t ui8Pins, uint32_t ui32PinIO)
+{
+    t_halGpio *p = gpioPort(ui32Port);
+    if (ui32PinIO == GPIO_DIR_MODE_OUT) {
+        p->dir |= ui8Pins;
+    } else {
+        p->dir &= ~ui8Pins;
+    }
+}
+
+void ROM_GPIOPinTypeGPIOInput(uint32_t ui32Port, uint8_t ui8Pins)
+{
+    gpioPort(ui32Port)->dir &= ~ui8Pins;
+}
+
+void ROM_GPIOPinTypeGPIOOutput(uint32_t ui32Port, uint8_t ui8Pins)
+{
+    gpioPort(ui32Port)->dir |= ui8Pins;
+}
+
+void ROM_GPIOPinTypeGPIOOutputOD(uint32_t ui32Port, uint8_t ui8Pins)
+{
+    gpioPort(ui32Port)->dir |= ui8Pins;
+}
+
+int32_t ROM_GPIOPinRead(uint32_t ui32Port, uint8_t ui8Pins)
+{
+    t_halGpio *p = gpioPort(ui32Port);
+    simLock();
+    int32_t v = ((p->dir & p->out) | (~p->dir & p->in)) & ui8Pins;
+    simUnlock();
+    return v;
+}
+
+void ROM_GPIOPinWrite(uint32_t ui32Port, uint8_t ui8Pins, uint8_t ui8Val)
+{
+    t_halGpio *p = gpioPort(ui32Port);
+    simLock();
+    uint8_t old = p->out;
+    p->out = (p->out & ~ui8Pins) | (ui8Val & ui8Pins);
+    if (p == &g_gpio[1]) {
+        uint8_t rise = p->out & ~old;
+        if (rise & GPIO_PIN_1) {
+            g_smShift = (g_smShift << 1) | (p->out & GPIO_PIN_0);
+        } else if ((rise & GPIO_PIN_0) && !(p->out & GPIO_PIN_1)) {
+            g_smLatch = g_smShift;
+            matrixUpdate();
+        }
+    }
+    simUnlock();
+}
+
+bool hal_solenoids_enabled()
+{
+    return g_gpio[4].out & GPIO_PIN_0;
+}
+
+void hal_set_switch(unsigned hwIndex, bool closed)
+{
+    simLock();
+    if (hwIndex < 0x40) {
+        uint8_t m = 1 << (hwIndex & 7);
+        if (closed) {
+            g_matrix[hwIndex >> 3] |= m;
+        } else {
+            g_matrix[hwIndex >> 3] &= ~m;
+        }
+        matrixUpdate();
+    } else if (hwIndex < 0x140) {
+        unsigned ch = (hwIndex - 0x40) / 0x40;
+        unsigned pcf = ((hwIndex - 0x40) % 0x40) / 8;
+        i2cModelSetInput(ch, 0x20 + pcf, hwIndex % 8, closed);
+    } else {
+        hal_fatal("hal_set_switch(): no input 0x%x", hwIndex);
+    }
+    simUnlock();
+}
+
+bool hal_get_switch(unsigned hwIndex)
+{
+    if (hwIndex < 0x40) {
+        return g_matrix[hwIndex >> 3] & (1 << (hwIndex & 7));
+    } else if (hwIndex < 0x140) {
+        unsigned ch = (hwIndex - 0x40) / 0x40;
+        unsigned pcf = ((hwIndex - 0x40) % 0x40) / 8;
+        return i2cModelGetInput(ch, 0x20 + pcf, hwIndex % 8);
+    }
+    return false;
+}
+
+//*****************************************************************************
+// Delay, timers and the watchdog
+//*****************************************************************************
+void ROM_SysCtlDelay(uint32_t ui32Count)
+{
+    // 3 cycles per loop
+    simRunUntil(g_simNow + (uint64_t)ui32Count * 3 * 1000 / (SIM_CPU_HZ / 1000000));
+}
+
+// Timer 1 is only used by startTimer() / stopTimer()
+static bool g_t1Running;
+static uint32_t g_t1Start, g_t1Value;
+
+void ROM_TimerConfigure(uint32_t ui32Base, uint32_t ui32Config)
+{
+    (void)ui32Config;
+    if (ui32Base == TIMER1_BASE) g_t1Value = 0;
+}
+
+void ROM_TimerEnable(uint32_t ui32Base, uint32_t ui32Timer)
+{
+    (void)ui32Timer;
+    if (ui32Base == TIMER1_BASE && !g_t1Running) {
+        g_t1Running = true;
+        g_t1Start = halCycles();
+    }
+}
+
+void ROM_TimerDisable(uint32_t ui32Base, uint32_t ui32Timer)
+{
+    (void)ui32Timer;
+    if (ui32Base == TIMER1_BASE && g_t1Running) {
+        g_t1Running = false;
+        g_t1Value += halCycles() - g_t1Start;
+    }
+}
+
+uint32_t ROM_TimerValueGet(uint32_t ui32Base, uint32_t ui32Timer)
+{
+    (void)ui32Timer;
+    if (ui32Base == TIMER1_BASE) {
+        return g_t1Value + (g_t1Running ? halCycles() - g_t1Start : 0);
+    }
+    if (ui32Base == WTIMER0_BASE) {
+        return ~(uint32_t)(g_simNow / SIM_NS_PER_US);
+    }
+    return 0;
+}
+
+void ROM_TimerLoadSet(uint32_t ui32Base, uint32_t ui32Timer, uint32_t ui32Value)
+{
+    (void)ui32Timer;
+    (void)ui32Value;
+    // stopTimer() reloads and clears TAV
+    if (ui32Base == TIMER1_BASE) g_t1Value = 0;
+}
+
+// The watchdog interrupt fires every 1 s. If it has not been cleared by then,
+// the watchdog resets the MCU.
+static bool g_wdtEnabled, g_wdtIntSet;
+
+static void wdtTimeout(void *arg)
+{
+    (void)arg;
+    if (g_wdtIntSet) {
+        g_halResetHook();
+    }
+    g_wdtIntSet = true;
+    simAt(g_simNow + SIM_NS_PER_S, wdtTimeout, NULL);
+    hal_irq_pend(INT_WATCHDOG);
+}
+
+bool ROM_WatchdogLockState(uint32_t ui32Base)
+{
+    (void)ui32Base;
+    return false;
+}
+
+void ROM_WatchdogEnable(uint32_t ui32Base)
+{
+    (void)ui32Base;
+    if (!g_wdtEnabled) {
+        g_wdtEnabled = true;
+        simAt(g_simNow + SIM_NS_PER_S, wdtTimeout, NULL);
+    }
+}
+
+void ROM_WatchdogIntClear(uint32_t ui32Base)
+{
+    (void)ui32Base;
+    g_wdtIntSet = false;
+}
+
+//*****************************************************************************
+// Peripheral setup forwarded to the models
+//*****************************************************************************
+void ROM_I2CMasterInitExpClk(uint32_t ui32Base, uint32_t ui32I2CClk, bool bFast)
+{
+    *hal_raw(ui32Base + I2C_O_MTPR) = i2cModelTpr(ui32I2CClk, bFast ? 400000 : 100000);
+    i2cModelInit((ui32Base - I2C0_BASE) >> 12);
+}
+
+void ROM_I2CMasterIntEnableEx(uint32_t ui32Base, uint32_t ui32IntFlags)
+{
+    *hal_raw(ui32Base + I2C_O_MIMR) |= ui32IntFlags;
+}
+
+void ROM_I2CMasterIntClear(uint32_t ui32Base)
+{
+    *hal_raw(ui32Base + I2C_O_MRIS) = 0;
+}
+
+void ROM_SSIConfigSetExpClk(uint32_t ui32Base, uint32_t ui32SSIClk, uint32_t ui32Protocol,
+                            uint32_t ui32Mode, uint32_t ui32BitRate, uint32_t ui32DataWidth)
+{
+    (void)ui32Protocol;
+    (void)ui32Mode;
+    (void)ui32DataWidth;
+    simLock();
+    ssiModelConfig(ui32Base, ui32SSIClk, ui32BitRate);
+    simUnlock();
+}
+
+// The uDMA done interrupt is the only SSI interrupt source in use
+uint32_t ROM_SSIIntStatus(uint32_t ui32Base, bool bMasked)
+{
+    (void)ui32Base;
+    (void)bMasked;
+    return 0;
+}
+
+void ROM_SSIIntClear(uint32_t ui32Base, uint32_t ui32IntFlags)
+{
+    (void)ui32Base;
+    (void)ui32IntFlags;
+}
+
+void ROM_uDMAChannelControlSet(uint32_t ui32ChannelStructIndex, uint32_t ui32Control)
+{
+    simLock();
+    ssiModelControlSet(ui32ChannelStructIndex & 0x1F, ui32Control);
+    simUnlock();
+}
+
+void ROM_uDMAChannelTransferSet(uint32_t ui32ChannelStructIndex, uint32_t ui32Mode,
+                                void *pvSrcAddr, void *pvDstAddr, uint32_t ui32TransferSize)
+{
+    (void)ui32Mode;
+    (void)pvDstAddr;
+    simLock();
+    ssiModelTransferSet(ui32ChannelStructIndex & 0x1F, pvSrcAddr, ui32TransferSize);
+    simUnlock();
+}
+
+void ROM_uDMAChannelEnable(uint32_t ui32ChannelNum)
+{
+    simLock();
+    ssiModelEnable(ui32ChannelNum & 0x1F);
+    simUnlock();
+}
+
+bool ROM_uDMAChannelIsEnabled(uint32_t ui32ChannelNum)
+{
+    simLock();
+    bool enabled = ssiModelIsEnabled(ui32ChannelNum & 0x1F);
+    simUnlock();
+    return enabled;
+}
+
+//*****************************************************************************
+// utils/ustdlib.c
+//*****************************************************************************
+int usprintf(char *pcBuf, const char *pcString, ...)
+{
+    va_list ap;
+    va_start(ap, pcString);
+    int n = vsprintf(pcBuf, pcString, ap);
+    va_end(ap);
+    return n;
+}
+
+int usnprintf(char *pcBuf, uint32_t ui32Size, const char *pcString, ...)
+{
+    va_list ap;
+    va_start(ap, pcString);
+    int n = vsnprintf(pcBuf, ui32Size, pcString, ap);
+    va_end(ap);
+    return n;
+}
+
+char *ustrncpy(char *pcDst, const char *pcSrc, uint32_t ui32Num)
+{
+    return strncpy(pcDst, pcSrc, ui32Num);
+}
+
+unsigned long ustrtoul(const char *pcStr, const char **ppcStrRet, int iBase)
+{
+    return strtoul(pcStr, (char **)ppcStrRet, iBase);
+}
+
+int ustrcmp(const char *pcStr1, const char *pcStr2)
+{
+    return strcmp(pcStr1, pcStr2);
+}
+
+int ustrncmp(const char *pcStr1, const char *pcStr2, uint32_t ui32Count)
+{
+    return strncmp(pcStr1, pcStr2, ui32Count);
+}
+
+//*****************************************************************************
+// drivers/my_uartstdio.c, the debug UART goes to g_halUart
+//*****************************************************************************
+void UARTStdioConfig(uint32_t ui32Port, uint32_t ui32Baud, uint32_t ui32SrcClock)
+{
+    (void)ui32Port;
+    (void)ui32Baud;
+    (void)ui32SrcClock;
+}
+
+void UARTvprintf(const char *pcString, va_list vaArgP)
+{
+    // A task preempted while it holds the stdio lock would block the others
+    simLock();
+    if (globalDebugEnabled && g_halUart) {
+        vfprintf(g_halUart, pcString, vaArgP);
+    }
+    simUnlock();
+}
+
+void UARTprintf(const char *pcString, ...)
+{
+    va_list ap;
+    va_start(ap, pcString);
+    UARTvprintf(pcString, ap);
+    va_end(ap);
+}
+
+int UARTwrite(const char *pcBuf, uint32_t ui32Len)
+{
+    simLock();
+    if (globalDebugEnabled && g_halUart) {
+        fwrite(pcBuf, 1, ui32Len, g_halUart);
+    }
+    simUnlock();
+    return ui32Len;
+}
+
+int UARTTxBytesFree(void)
+{
+    return 1 << 16;
+}
+
+//*****************************************************************************
+// Host side
+//*****************************************************************************
+uint64_t hal_host_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * SIM_NS_PER_S + ts.tv_nsec;
+}
+
+void hal_fatal(const char *fmt, ...)
+{
+    va_list ap;
+    fflush(stdout);
+    fprintf(stderr, "[%10.6f s] fatal: ", g_simNow / 1e9);
+    va_start(ap, fmt);
+    vfprintf(stderr, fmt, ap);
+    va_end(ap);
+    fprintf(stderr, "\n");
+    exit(2);
+}
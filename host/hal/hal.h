@@ -0,0 +1,491 @@
+// Host shim for the parts of TivaWare, CMSIS and the usblib the firmware uses.
+// Every TivaWare header the firmware includes is generated by host/Makefile
+// as a one-liner which includes this file, so the firmware sources compile
+// unchanged on Linux. Register accesses go through hal_reg() into a simulated
+// register file, the peripherals behind it are modelled in host/sim/.
+#ifndef HAL_H_
+#define HAL_H_
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stdio.h>
+
+//*****************************************************************************
+// inc/hw_types.h
+//*****************************************************************************
+// Pointer into the simulated register file, see hal.c
+volatile uint32_t *hal_reg(uint32_t addr);
+#define HWREG(x)  (*hal_reg((uint32_t)(x)))
+#define HWREGH(x) (*(volatile uint16_t *)hal_reg((uint32_t)(x)))
+#define HWREGB(x) (*(volatile uint8_t *)hal_reg((uint32_t)(x)))
+// Bit-band accesses can not be expressed as C lvalues on the host.
+// host/bitband.py rewrites __HAL_BITB(x, b) in the preprocessed source into
+// hal_bitb_set() if it is assigned to, into hal_bitb_get() otherwise.
+#define HWREGBITW(x, b) __HAL_BITB((x), (b))
+#define HWREGBITB(x, b) __HAL_BITB((x), (b))
+#define HWREGBITH(x, b) __HAL_BITB((x), (b))
+uint32_t hal_bitb_get(const volatile void *p, unsigned b);
+uint32_t hal_bitb_set(volatile void *p, unsigned b, uint32_t v);
+
+//*****************************************************************************
+// inc/hw_memmap.h
+//*****************************************************************************
+#define WATCHDOG0_BASE  0x40000000
+#define GPIO_PORTA_BASE 0x40004000
+#define GPIO_PORTB_BASE 0x40005000
+#define GPIO_PORTC_BASE 0x40006000
+#define GPIO_PORTD_BASE 0x40007000
+#define SSI0_BASE       0x40008000
+#define SSI1_BASE       0x40009000
+#define SSI2_BASE       0x4000A000
+#define SSI3_BASE       0x4000B000
+#define UART0_BASE      0x4000C000
+#define I2C0_BASE       0x40020000
+#define I2C1_BASE       0x40021000
+#define I2C2_BASE       0x40022000
+#define I2C3_BASE       0x40023000
+#define GPIO_PORTE_BASE 0x40024000
+#define GPIO_PORTF_BASE 0x40025000
+#define PWM0_BASE       0x40028000
+#define TIMER1_BASE     0x40031000
+#define WTIMER0_BASE    0x40036000
+#define WTIMER1_BASE    0x40037000
+#define USB0_BASE       0x40050000
+#define UDMA_BASE       0x400FF000
+
+//*****************************************************************************
+// inc/hw_ints.h (vector numbers of the TM4C123)
+//*****************************************************************************
+#define INT_UART0       21
+#define INT_I2C0        24
+#define INT_WATCHDOG    34
+#define INT_TIMER1A     37
+#define INT_SSI1        50
+#define INT_I2C1        53
+#define INT_USB0        60
+#define INT_UDMAERR     63
+#define INT_SSI2        73
+#define INT_SSI3        74
+#define INT_I2C2        84
+#define INT_I2C3        85
+#define INT_WTIMER0A    110
+#define NUM_INTERRUPTS  155
+
+//*****************************************************************************
+// inc/hw_nvic.h
+//*****************************************************************************
+#define NVIC_INT_CTRL           0xE000ED04
+#define NVIC_INT_CTRL_VEC_ACT_M 0x000000FF
+#define NVIC_APINT              0xE000ED0C
+#define NVIC_APINT_VECTKEY      0x05FA0000
+#define NVIC_APINT_SYSRESETREQ  0x00000004
+#define NVIC_DBG_INT            0xE000EDFC
+
+//*****************************************************************************
+// inc/hw_i2c.h, driverlib/i2c.h
+//*****************************************************************************
+#define I2C_O_MSA       0x000
+#define I2C_O_MCS       0x004
+#define I2C_O_MDR       0x008
+#define I2C_O_MTPR      0x00C
+#define I2C_O_MIMR      0x010
+#define I2C_O_MRIS      0x014
+#define I2C_O_MMIS      0x018
+#define I2C_O_MICR      0x01C
+#define I2C_O_MCR       0x020
+#define I2C_O_MCLKOCNT  0x024
+// MCS read
+#define I2C_MCS_BUSY    0x00000001
+#define I2C_MCS_ERROR   0x00000002
+#define I2C_MCS_ADRACK  0x00000004
+#define I2C_MCS_DATACK  0x00000008
+#define I2C_MCS_ARBLST  0x00000010
+#define I2C_MCS_IDLE    0x00000020
+#define I2C_MCS_BUSBSY  0x00000040
+#define I2C_MCS_CLKTO   0x00000080
+// MCS write
+#define I2C_MCS_RUN     0x00000001
+#define I2C_MCS_START   0x00000002
+#define I2C_MCS_STOP    0x00000004
+#define I2C_MCS_ACK     0x00000008
+#define I2C_MCS_HS      0x00000010
+#define I2C_MASTER_INT_RX_FIFO_FULL 0x00000800
+#define I2C_MASTER_INT_NACK         0x00000040
+#define I2C_MASTER_INT_STOP         0x00000020
+#define I2C_MASTER_INT_START        0x00000010
+#define I2C_MASTER_INT_ARB_LOST     0x00000008
+#define I2C_MASTER_INT_TIMEOUT      0x00000002
+#define I2C_MASTER_INT_DATA         0x00000001
+
+//*****************************************************************************
+// inc/hw_gpio.h, driverlib/gpio.h, driverlib/pin_map.h
+//*****************************************************************************
+#define GPIO_O_DATA     0x000
+#define GPIO_O_DIR      0x400
+#define GPIO_O_AFSEL    0x420
+#define GPIO_O_DR8R     0x508
+#define GPIO_O_ODR      0x50C
+#define GPIO_O_PUR      0x510
+#define GPIO_O_DEN      0x51C
+#define GPIO_O_LOCK     0x520
+#define GPIO_O_CR       0x524
+#define GPIO_LOCK_KEY   0x4C4F434B
+#define GPIO_PIN_0      0x00000001
+#define GPIO_PIN_1      0x00000002
+#define GPIO_PIN_2      0x00000004
+#define GPIO_PIN_3      0x00000008
+#define GPIO_PIN_4      0x00000010
+#define GPIO_PIN_5      0x00000020
+#define GPIO_PIN_6      0x00000040
+#define GPIO_PIN_7      0x00000080
+#define GPIO_DIR_MODE_IN    0x00000000
+#define GPIO_DIR_MODE_OUT   0x00000001
+#define GPIO_DIR_MODE_HW    0x00000002
+#define GPIO_STRENGTH_2MA   0x00000001
+#define GPIO_STRENGTH_8MA   0x00000066
+#define GPIO_STRENGTH_12MA  0x00000067
+#define GPIO_PIN_TYPE_STD   0x00000008
+#define GPIO_PIN_TYPE_OD    0x00000009
+// Pin mux settings only matter to the hardware
+#define GPIO_PA0_U0RX       0x00000001
+#define GPIO_PA1_U0TX       0x00000401
+#define GPIO_PA6_I2C1SCL    0x00001803
+#define GPIO_PA7_I2C1SDA    0x00001C03
+#define GPIO_PB2_I2C0SCL    0x00010803
+#define GPIO_PB3_I2C0SDA    0x00010C03
+#define GPIO_PB4_M0PWM2     0x00011004
+#define GPIO_PB5_M0PWM3     0x00011404
+#define GPIO_PB7_SSI2TX     0x00011C02
+#define GPIO_PC4_M0PWM6     0x00021004
+#define GPIO_PC5_M0PWM7     0x00021404
+#define GPIO_PD0_I2C3SCL    0x00030003
+#define GPIO_PD1_I2C3SDA    0x00030403
+#define GPIO_PD3_SSI3TX     0x00030C01
+#define GPIO_PE4_I2C2SCL    0x00041003
+#define GPIO_PE5_I2C2SDA    0x00041403
+#define GPIO_PF1_SSI1TX     0x00050402
+
+//*****************************************************************************
+// inc/hw_ssi.h, driverlib/ssi.h
+//*****************************************************************************
+#define SSI_O_CR0       0x000
+#define SSI_O_CR1       0x004
+#define SSI_O_DR        0x008
+#define SSI_O_SR        0x00C
+#define SSI_SR_BSY      0x00000010
+#define SSI_FRF_MOTO_MODE_0 0x00000000
+#define SSI_FRF_MOTO_MODE_1 0x00000002
+#define SSI_MODE_MASTER     0x00000000
+#define SSI_CLOCK_SYSTEM    0x00000000
+#define SSI_DMA_TX          0x00000002
+#define SSI_TXFF            0x00000008
+
+//*****************************************************************************
+// driverlib/udma.h
+//*****************************************************************************
+#define UDMA_ATTR_USEBURST      0x00000001
+#define UDMA_ATTR_ALTSELECT     0x00000002
+#define UDMA_ATTR_HIGH_PRIORITY 0x00000004
+#define UDMA_ATTR_REQMASK       0x00000008
+#define UDMA_PRI_SELECT     0x00000000
+#define UDMA_ALT_SELECT     0x00000020
+#define UDMA_DST_INC_8      0x00000000
+#define UDMA_DST_INC_16     0x40000000
+#define UDMA_DST_INC_32     0x80000000
+#define UDMA_DST_INC_NONE   0xC0000000
+#define UDMA_SRC_INC_8      0x00000000
+#define UDMA_SRC_INC_16     0x04000000
+#define UDMA_SRC_INC_32     0x08000000
+#define UDMA_SRC_INC_NONE   0x0C000000
+#define UDMA_SIZE_8         0x00000000
+#define UDMA_SIZE_16        0x11000000
+#define UDMA_SIZE_32        0x22000000
+#define UDMA_ARB_4          0x00008000
+#define UDMA_ARB_8          0x0000C000
+#define UDMA_MODE_STOP      0x00000000
+#define UDMA_MODE_BASIC     0x00000001
+#define UDMA_MODE_AUTO      0x00000002
+#define UDMA_CH11_SSI1TX    0x0000000B
+#define UDMA_CH13_SSI2TX    0x0000000D
+#define UDMA_CH15_SSI3TX    0x0000000F
+
+//*****************************************************************************
+// driverlib/sysctl.h (the peripheral IDs only matter to the hardware)
+//*****************************************************************************
+#define SYSCTL_PERIPH_GPIOA     0xf0000800
+#define SYSCTL_PERIPH_GPIOB     0xf0000801
+#define SYSCTL_PERIPH_GPIOC     0xf0000802
+#define SYSCTL_PERIPH_GPIOD     0xf0000803
+#define SYSCTL_PERIPH_GPIOE     0xf0000804
+#define SYSCTL_PERIPH_GPIOF     0xf0000805
+#define SYSCTL_PERIPH_I2C0      0xf0002000
+#define SYSCTL_PERIPH_I2C1      0xf0002001
+#define SYSCTL_PERIPH_I2C2      0xf0002002
+#define SYSCTL_PERIPH_I2C3      0xf0002003
+#define SYSCTL_PERIPH_PWM0      0xf0004000
+#define SYSCTL_PERIPH_SSI1      0xf0001c01
+#define SYSCTL_PERIPH_SSI2      0xf0001c02
+#define SYSCTL_PERIPH_SSI3      0xf0001c03
+#define SYSCTL_PERIPH_TIMER1    0xf0000401
+#define SYSCTL_PERIPH_UDMA      0xf0000c00
+#define SYSCTL_PERIPH_USB0      0xf0002800
+#define SYSCTL_PERIPH_WDOG0     0xf0000000
+#define SYSCTL_PERIPH_WTIMER0   0xf0005c00
+#define SYSCTL_SYSDIV_2_5       0xC1000000
+#define SYSCTL_USE_PLL          0x00000000
+#define SYSCTL_XTAL_16MHZ       0x00000540
+#define SYSCTL_OSC_MAIN         0x00000000
+#define SYSCTL_PWMDIV_1         0x00000000
+
+//*****************************************************************************
+// inc/hw_timer.h, driverlib/timer.h
+//*****************************************************************************
+#define TIMER_O_TAR     0x048
+#define TIMER_O_TAV     0x050
+#define TIMER_A         0x000000ff
+#define TIMER_CFG_ONE_SHOT_UP   0x00000031
+#define TIMER_CFG_PERIODIC_UP   0x00000032
+#define TIMER_CFG_SPLIT_PAIR    0x04000000
+#define TIMER_CFG_A_PERIODIC    0x00000022
+
+//*****************************************************************************
+// inc/hw_pwm.h
+//*****************************************************************************
+#define PWM_O_ENABLE    0x008
+#define PWM_GEN_0       0x040
+#define PWM_GEN_1       0x080
+#define PWM_GEN_2       0x0C0
+#define PWM_GEN_3       0x100
+#define PWM_O_X_CTL     0x000
+#define PWM_O_X_LOAD    0x010
+#define PWM_O_X_CMPA    0x018
+#define PWM_O_X_CMPB    0x01C
+#define PWM_O_X_GENA    0x020
+#define PWM_O_X_GENB    0x024
+#define PWM_X_CTL_ENABLE        0x00000001
+#define PWM_X_GENA_ACTCMPAD_ONE 0x000000C0
+#define PWM_X_GENA_ACTLOAD_ZERO 0x00000004
+#define PWM_X_GENB_ACTCMPBD_ONE 0x00000C00
+#define PWM_X_GENB_ACTLOAD_ZERO 0x00000004
+#define PWM_ENABLE_PWM2EN       0x00000004
+#define PWM_ENABLE_PWM3EN       0x00000008
+#define PWM_ENABLE_PWM6EN       0x00000040
+#define PWM_ENABLE_PWM7EN       0x00000080
+
+//*****************************************************************************
+// driverlib/debug.h
+//*****************************************************************************
+// Always checked on the host, a failed ASSERT() ends the simulation
+void hal_fatal(const char *fmt, ...) __attribute__((noreturn, format(printf, 1, 2)));
+#define ASSERT(expr) do { if (!(expr)) hal_fatal("%s:%d: ASSERT(%s)", __FILE__, __LINE__, #expr); } while (0)
+
+//*****************************************************************************
+// ROM API, only what the firmware uses
+//*****************************************************************************
+#define ROM_SysCtlClockSet(cfg)         ((void)(cfg))
+#define ROM_SysCtlClockGet()            80000000U
+#define ROM_SysCtlPeripheralEnable(p)   ((void)(p))
+#define ROM_SysCtlPeripheralReset(p)    ((void)(p))
+#define ROM_SysCtlPWMClockSet(cfg)      ((void)(cfg))
+#define ROM_FPULazyStackingEnable()     ((void)0)
+void ROM_SysCtlDelay(uint32_t ui32Count);
+
+#define ROM_GPIOPinConfigure(cfg)               ((void)(cfg))
+#define ROM_GPIOPinTypeUART(b, p)               ((void)(b), (void)(p))
+#define ROM_GPIOPinTypeUSBAnalog(b, p)          ((void)(b), (void)(p))
+#define ROM_GPIOPinTypePWM(b, p)                ((void)(b), (void)(p))
+#define ROM_GPIOPinTypeSSI(b, p)                ((void)(b), (void)(p))
+#define ROM_GPIOPadConfigSet(b, p, s, t)        ((void)(b), (void)(p))
+void ROM_GPIODirModeSet(uint32_t ui32Port, uint8_t ui8Pins, uint32_t ui32PinIO);
+void ROM_GPIOPinTypeGPIOInput(uint32_t ui32Port, uint8_t ui8Pins);
+void ROM_GPIOPinTypeGPIOOutput(uint32_t ui32Port, uint8_t ui8Pins);
+void ROM_GPIOPinTypeGPIOOutputOD(uint32_t ui32Port, uint8_t ui8Pins);
+int32_t ROM_GPIOPinRead(uint32_t ui32Port, uint8_t ui8Pins);
+void ROM_GPIOPinWrite(uint32_t ui32Port, uint8_t ui8Pins, uint8_t ui8Val);
+#define GPIOPinRead             ROM_GPIOPinRead
+#define GPIOPinWrite            ROM_GPIOPinWrite
+#define GPIOPinTypeGPIOInput    ROM_GPIOPinTypeGPIOInput
+
+void ROM_IntEnable(uint32_t ui32Interrupt);
+void ROM_IntDisable(uint32_t ui32Interrupt);
+void ROM_IntPrioritySet(uint32_t ui32Interrupt, uint8_t ui8Priority);
+void IntPendClear(uint32_t ui32Interrupt);
+void IntTrigger(uint32_t ui32Interrupt);
+#define IntEnable   ROM_IntEnable
+#define IntDisable  ROM_IntDisable
+
+void ROM_I2CMasterInitExpClk(uint32_t ui32Base, uint32_t ui32I2CClk, bool bFast);
+void ROM_I2CMasterIntEnableEx(uint32_t ui32Base, uint32_t ui32IntFlags);
+void ROM_I2CMasterIntClear(uint32_t ui32Base);
+
+#define ROM_SSIClockSourceSet(b, s)     ((void)(b), (void)(s))
+#define ROM_SSIEnable(b)                ((void)(b))
+#define ROM_SSIDisable(b)               ((void)(b))
+#define ROM_SSIDMAEnable(b, f)          ((void)(b), (void)(f))
+void ROM_SSIConfigSetExpClk(uint32_t ui32Base, uint32_t ui32SSIClk, uint32_t ui32Protocol,
+                            uint32_t ui32Mode, uint32_t ui32BitRate, uint32_t ui32DataWidth);
+uint32_t ROM_SSIIntStatus(uint32_t ui32Base, bool bMasked);
+void ROM_SSIIntClear(uint32_t ui32Base, uint32_t ui32IntFlags);
+
+#define ROM_uDMAEnable()                        ((void)0)
+#define ROM_uDMAControlBaseSet(t)               ((void)(t))
+#define ROM_uDMAChannelAssign(c)                ((void)(c))
+#define ROM_uDMAChannelAttributeEnable(c, a)    ((void)(c), (void)(a))
+#define ROM_uDMAChannelAttributeDisable(c, a)   ((void)(c), (void)(a))
+void ROM_uDMAChannelControlSet(uint32_t ui32ChannelStructIndex, uint32_t ui32Control);
+void ROM_uDMAChannelTransferSet(uint32_t ui32ChannelStructIndex, uint32_t ui32Mode,
+                                void *pvSrcAddr, void *pvDstAddr, uint32_t ui32TransferSize);
+void ROM_uDMAChannelEnable(uint32_t ui32ChannelNum);
+bool ROM_uDMAChannelIsEnabled(uint32_t ui32ChannelNum);
+
+void ROM_TimerConfigure(uint32_t ui32Base, uint32_t ui32Config);
+void ROM_TimerEnable(uint32_t ui32Base, uint32_t ui32Timer);
+void ROM_TimerDisable(uint32_t ui32Base, uint32_t ui32Timer);
+uint32_t ROM_TimerValueGet(uint32_t ui32Base, uint32_t ui32Timer);
+void ROM_TimerLoadSet(uint32_t ui32Base, uint32_t ui32Timer, uint32_t ui32Value);
+#define ROM_TimerPrescaleSet(b, t, v)   ((void)(b), (void)(t), (void)(v))
+
+bool ROM_WatchdogLockState(uint32_t ui32Base);
+#define ROM_WatchdogUnlock(b)           ((void)(b))
+#define ROM_WatchdogReloadSet(b, v)     ((void)(b), (void)(v))
+#define ROM_WatchdogResetEnable(b)      ((void)(b))
+void ROM_WatchdogEnable(uint32_t ui32Base);
+void ROM_WatchdogIntClear(uint32_t ui32Base);
+
+//*****************************************************************************
+// utils/ustdlib.h
+//*****************************************************************************
+int usprintf(char *pcBuf, const char *pcString, ...);
+int usnprintf(char *pcBuf, uint32_t ui32Size, const char *pcString, ...);
+char *ustrncpy(char *pcDst, const char *pcSrc, uint32_t ui32Num);
+unsigned long ustrtoul(const char *pcStr, const char **ppcStrRet, int iBase);
+int ustrcmp(const char *pcStr1, const char *pcStr2);
+int ustrncmp(const char *pcStr1, const char *pcStr2, uint32_t ui32Count);
+#define ustrlen(s) ((int)strlen(s))
+
+//*****************************************************************************
+// usblib
+//*****************************************************************************
+#define USBShort(ui16Value)     ((ui16Value) & 0xff), ((ui16Value) >> 8)
+#define USB_DTYPE_STRING        3
+#define USB_LANG_EN_US          0x0409
+#define USB_VID_TI_1CBE         0x1cbe
+#define USB_PID_SERIAL          0x0002
+#define USB_CONF_ATTR_SELF_PWR  0xC0
+#define eUSBModeForceDevice     3
+
+#define USB_EVENT_CONNECTED             0x0001
+#define USB_EVENT_DISCONNECTED          0x0002
+#define USB_EVENT_RX_AVAILABLE          0x0003
+#define USB_EVENT_DATA_REMAINING        0x0004
+#define USB_EVENT_REQUEST_BUFFER        0x0005
+#define USB_EVENT_TX_COMPLETE           0x0006
+#define USB_EVENT_SUSPEND               0x000C
+#define USB_EVENT_RESUME                0x000D
+#define USBD_CDC_EVENT_SEND_BREAK               0x8000
+#define USBD_CDC_EVENT_CLEAR_BREAK              0x8001
+#define USBD_CDC_EVENT_SET_CONTROL_LINE_STATE   0x8002
+#define USBD_CDC_EVENT_SET_LINE_CODING          0x8003
+#define USBD_CDC_EVENT_GET_LINE_CODING          0x8004
+
+typedef uint32_t (*tUSBCallback)(void *pvCBData, uint32_t ui32Event,
+                                 uint32_t ui32MsgParam, void *pvMsgData);
+typedef uint32_t (*tUSBPacketTransfer)(void *pvHandle, uint8_t *pi8Data,
+                                       uint32_t ui32Length, bool bLast);
+typedef uint32_t (*tUSBPacketAvailable)(void *pvHandle);
+
+typedef struct {
+    volatile uint32_t ui32Size;
+    volatile uint32_t ui32WriteIndex;
+    volatile uint32_t ui32ReadIndex;
+    uint8_t *pui8Buf;
+} tUSBRingBufObject;
+
+// Same field order as in usblib, so usb_serial_structs.c initializes it unchanged
+typedef struct {
+    bool bTransmitBuffer;
+    tUSBCallback pfnCallback;
+    void *pvCBData;
+    tUSBPacketTransfer pfnTransfer;
+    tUSBPacketAvailable pfnAvailable;
+    void *pvHandle;
+    uint8_t *pui8Buffer;
+    uint32_t ui32BufferSize;
+    tUSBRingBufObject sPrivateData;
+} tUSBBuffer;
+
+typedef struct {
+    uint16_t ui16VID;
+    uint16_t ui16PID;
+    uint16_t ui16MaxPowermA;
+    uint8_t ui8PwrAttributes;
+    tUSBCallback pfnControlCallback;
+    void *pvControlCBData;
+    tUSBCallback pfnRxCallback;
+    void *pvRxCBData;
+    tUSBCallback pfnTxCallback;
+    void *pvTxCBData;
+    const uint8_t * const *ppui8StringDescriptors;
+    uint32_t ui32NumStringDescriptors;
+} tUSBDCDCDevice;
+
+const tUSBBuffer *USBBufferInit(tUSBBuffer *psBuffer);
+void USBBufferFlush(const tUSBBuffer *psBuffer);
+uint32_t USBBufferRead(const tUSBBuffer *psBuffer, uint8_t *pui8Data, uint32_t ui32Length);
+uint32_t USBBufferWrite(const tUSBBuffer *psBuffer, const uint8_t *pui8Data, uint32_t ui32Length);
+uint32_t USBBufferDataAvailable(const tUSBBuffer *psBuffer);
+uint32_t USBBufferSpaceAvailable(const tUSBBuffer *psBuffer);
+void USBBufferInfoGet(const tUSBBuffer *psBuffer, tUSBRingBufObject *psRingBuf);
+void USBBufferDataRemoved(const tUSBBuffer *psBuffer, uint32_t ui32Length);
+uint32_t USBBufferEventCallback(void *pvCBData, uint32_t ui32Event,
+                                uint32_t ui32MsgValue, void *pvMsgData);
+uint32_t USBRingBufContigUsed(tUSBRingBufObject *psRingBuf);
+uint32_t USBDCDCPacketRead(void *pvHandle, uint8_t *pi8Data, uint32_t ui32Length, bool bLast);
+uint32_t USBDCDCPacketWrite(void *pvHandle, uint8_t *pi8Data, uint32_t ui32Length, bool bLast);
+uint32_t USBDCDCRxPacketAvailable(void *pvHandle);
+uint32_t USBDCDCTxPacketAvailable(void *pvHandle);
+void *USBDCDCInit(uint32_t ui32Index, tUSBDCDCDevice *psCDCDevice);
+void USBStackModeSet(uint32_t ui32Index, uint32_t iUSBMode, void *pfnCallback);
+
+//*****************************************************************************
+// Host side of the simulation
+//*****************************************************************************
+// What PRF_CYCLES() counts
+typedef enum {
+    HAL_CLOCK_SIM,      // simulated time, 80 cycles per us (default)
+    HAL_CLOCK_HOST      // time spent on the host CPU, scaled the same way
+} t_halClock;
+
+extern t_halClock g_halClock;
+// UARTprintf() output goes here, NULL = discard
+extern FILE *g_halUart;
+// Called on a software reset request (NVIC_APINT), default is hal_fatal()
+extern void (*g_halResetHook)(void);
+
+// Host nanoseconds of CLOCK_MONOTONIC
+uint64_t hal_host_ns();
+// Catch up with register writes which have side effects (I2C commands, ...)
+void hal_sync();
+// Register slot without any side effects, for the peripheral models
+uint32_t *hal_raw(uint32_t addr);
+// Dispatch pending and enabled interrupts (unless masked or already in one)
+void hal_irq_dispatch();
+// Mark an interrupt as pending and dispatch it if possible
+void hal_irq_pend(unsigned intNo);
+// Active vector number or 0 in thread mode
+unsigned hal_irq_active();
+// Block / unblock interrupts for taskENTER_CRITICAL()
+void hal_irq_mask(bool masked);
+// Open (false) or close (true) a switch, hwIndex as in the serial API
+void hal_set_switch(unsigned hwIndex, bool closed);
+bool hal_get_switch(unsigned hwIndex);
+// Solenoid 24 V enable (PE0)
+bool hal_solenoids_enabled();
+// Last value written to a PWM compare register, channel 0 - 3 as in setPwm()
+uint16_t hal_get_pwm(unsigned channel);
+// Set by setPwm(), for stimulus / response measurements
+extern void (*g_halPwmHook)(unsigned channel, uint16_t value);
+
+#endif /* HAL_H_ */
@@ -0,0 +1,287 @@
+// I2C bus timing of the PCF scan, see "Host build" in README.md
+//
+// Runs the unmodified i2c_isr(), setup_pcf_rw(), trigger_i2c_cycle() and
+// _isr_notify() against the register level I2C + PCF8574 model in sim/i2c.c.
+// Every configuration is booted in a child process of its own.
+//
+//   i2csim          bus time per 1 ms cycle for 1 - 8 PCFs per channel at
+//                   100 / 400 / 1000 kHz SCL
+//   i2csim -T       check the PCF_ERR_CHECK_CYCLE error window with injected
+//                   NACK, arbitration lost and clock timeout faults
+//
+// The scan times are bus time only, the ISRs run in zero simulated time.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "hal.h"
+#include "sim.h"
+#include "FreeRTOS.h"
+#include "io_manager.h"
+
+int firmware_main(void);
+
+#define T_SETUP     (100 * SIM_NS_PER_MS)
+#define PCF_ADDR(i) (PCF_LOWEST_ADDR + (i))
+#define HW_PCF(ch, i)   (0x40 + (ch) * 0x40 + (i) * 8)
+
+//*****************************************************************************
+// Firmware output
+//*****************************************************************************
+// Error reports the firmware sent to the host
+static t_simMatch g_erBusy = {"ER:0023"};   // PCF scan still running on the next trigger
+static t_simMatch g_erPanic = {"ER:0100"};  // too many write errors
+
+static void txSink(const uint8_t *data, uint32_t len)
+{
+    simMatchFeed(&g_erBusy, data, len);
+    simMatchFeed(&g_erPanic, data, len);
+}
+
+static void hostSend(const char *cmd)
+{
+    usbHostWrite((const uint8_t *)cmd, strlen(cmd));
+}
+
+// Make the first pin of a PCF an output, like the host sending `OUT`
+static void makeWriter(unsigned ch, unsigned i)
+{
+    t_hw_index pin = decodeHwIndex(HW_PCF(ch, i), false);
+    setPCFOutput(&pin, 0, 0, 7);
+}
+
+static void setScl(unsigned ch, uint32_t sclHz)
+{
+    *hal_raw(I2C0_BASE + ch * 0x1000 + I2C_O_MTPR) = i2cModelTpr(SYSTEM_CLOCK, sclHz);
+}
+
+static uint64_t g_resetAt;
+
+static void onReset()
+{
+    g_resetAt = g_simNow;
+    g_rtosEndTime = g_simNow;
+}
+
+// Run the firmware in a child process, returns the exit code of f()
+static int runChild(int (*f)(void *), void *arg)
+{
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        exit(1);
+    }
+    if (!pid) {
+        g_halUart = NULL;
+        g_usbTxSink = txSink;
+        g_halResetHook = onReset;
+        exit(f(arg));
+    }
+    int status;
+    waitpid(pid, &status, 0);
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+//*****************************************************************************
+// Bus time sweep
+//*****************************************************************************
+typedef struct {
+    uint32_t sclHz;
+    unsigned nPcf;      // present PCFs per channel, the first half are outputs
+} t_sweepPoint;
+
+// Measurement windows: all 8 addresses scanned, absent ones NACK. Then after
+// PCF_ERR_CHECK_CYCLE has disabled the absent ones (5000 scans, which take
+// up to 8 s at 100 kHz).
+static const uint64_t g_phase[2][2] = {
+    {1000 * SIM_NS_PER_MS, 2000 * SIM_NS_PER_MS},
+    {9500 * SIM_NS_PER_MS, 10500 * SIM_NS_PER_MS}
+};
+
+static t_i2cBusStats g_phaseStats[2];
+
+static void phaseStart(void *arg)
+{
+    (void)arg;
+    i2cModelResetStats();
+}
+
+// Channel with the longest scans
+static void phaseEnd(void *arg)
+{
+    t_i2cBusStats *r = &g_phaseStats[(uintptr_t)arg];
+    for (unsigned ch = 0; ch < 4; ch++) {
+        t_i2cBusStats s;
+        i2cModelBusStats(ch, &s);
+        if (s.scanMaxNs >= r->scanMaxNs) *r = s;
+    }
+}
+
+static void sweepSetup(void *arg)
+{
+    const t_sweepPoint *p = arg;
+    for (unsigned ch = 0; ch < 4; ch++) {
+        setScl(ch, p->sclHz);
+        for (unsigned i = 0; i < p->nPcf / 2; i++) {
+            makeWriter(ch, i);
+        }
+    }
+}
+
+static int sweepRun(void *arg)
+{
+    const t_sweepPoint *p = arg;
+    for (unsigned ch = 0; ch < 4; ch++) {
+        for (unsigned i = p->nPcf; i < PCF_MAX_PER_CHANNEL; i++) {
+            i2cModelSetPresent(ch, PCF_ADDR(i), false);
+        }
+    }
+    simAt(T_SETUP, sweepSetup, (void *)p);
+    for (uintptr_t i = 0; i < 2; i++) {
+        simAt(g_phase[i][0], phaseStart, NULL);
+        simAt(g_phase[i][1], phaseEnd, (void *)i);
+    }
+    g_rtosEndTime = g_phase[1][1];
+    firmware_main();
+
+    printf("%5u %4u %2u/%u", p->sclHz / 1000, p->nPcf, p->nPcf / 2, p->nPcf - p->nPcf / 2);
+    for (unsigned i = 0; i < 2; i++) {
+        const t_i2cBusStats *s = &g_phaseStats[i];
+        uint64_t tPhase = g_phase[i][1] - g_phase[i][0];
+        printf(" | %7.1f %7.1f %5.1f %7u",
+               s->nScans ? (double)s->scanSumNs / s->nScans / 1000 : 0.0,
+               (double)s->scanMaxNs / 1000,
+               100.0 * s->busyNs / tPhase,
+               (unsigned)(s->nScans * SIM_NS_PER_S / tPhase));
+    }
+    printf(" | %6u\n", g_erBusy.n);
+    return 0;
+}
+
+static void sweep()
+{
+    static const uint32_t sclHz[] = {100000, 400000, 1000000};
+    printf("Bus time of one PCF scan per channel, %u PCFs max. per channel\n", PCF_MAX_PER_CHANNEL);
+    printf("                  |  0x20 - 0x27 scanned, absent NACK   |  absent ones disabled after %u scans |\n",
+           PCF_ERR_CHECK_CYCLE);
+    printf("  SCL PCFs W/R    | scan_us  max_us load%% scans/s | scan_us  max_us load%% scans/s | ER:0023\n");
+    printf("  kHz\n");
+    for (unsigned f = 0; f < sizeof(sclHz) / sizeof(sclHz[0]); f++) {
+        for (unsigned n = 1; n <= PCF_MAX_PER_CHANNEL; n++) {
+            t_sweepPoint p = {sclHz[f], n};
+            if (runChild(sweepRun, &p)) {
+                printf("%5u %4u  failed\n", sclHz[f] / 1000, n);
+            }
+        }
+    }
+}
+
+//*****************************************************************************
+// Error window checks
+//*****************************************************************************
+typedef struct {
+    const char *name;
+    unsigned ch;
+    unsigned pcf;           // PCF under test
+    bool writer;            // made an output at T_SETUP
+    bool absent;
+    t_i2cFault fault;       // from boot (readers) or T_SETUP (writers)
+    unsigned perMille;
+    uint64_t tEnd;
+    bool expectOff;         // reader: no more accesses, writer: 24 V off + reset
+} t_windowCheck;
+
+static const t_windowCheck g_checks[] = {
+    {"absent read PCF dropped after window 1", 0, 4, false, true, I2C_FAULT_NONE, 0,
+     6 * SIM_NS_PER_S, true},
+    {"read PCF with 100 % NACK dropped", 1, 1, false, false, I2C_FAULT_NACK, 1000,
+     6 * SIM_NS_PER_S, true},
+    {"read PCF with 99 % ARBLST kept", 2, 2, false, false, I2C_FAULT_ARBLST, 990,
+     6 * SIM_NS_PER_S, false},
+    {"write PCF with 100 % NACK shuts down", 0, 0, true, false, I2C_FAULT_NACK, 1000,
+     12 * SIM_NS_PER_S, true},
+    {"write PCF with 100 % CLKTO shuts down", 3, 5, true, false, I2C_FAULT_CLKTO, 1000,
+     12 * SIM_NS_PER_S, true},
+    {"write PCF with 99 % ARBLST kept", 1, 3, true, false, I2C_FAULT_ARBLST, 990,
+     16 * SIM_NS_PER_S, false},
+};
+
+static void checkSetup(void *arg)
+{
+    const t_windowCheck *c = arg;
+    hostSend("SOE 1\n");
+    if (c->writer) {
+        makeWriter(c->ch, c->pcf);
+        i2cModelSetFault(c->ch, PCF_ADDR(c->pcf), c->fault, c->perMille);
+    }
+}
+
+static int checkRun(void *arg)
+{
+    const t_windowCheck *c = arg;
+    bool pass;
+    // Clock low timeout after 2 * 16 SCL periods
+    *hal_raw(I2C0_BASE + c->ch * 0x1000 + I2C_O_MCLKOCNT) = 2;
+    i2cModelSetPresent(c->ch, PCF_ADDR(c->pcf), !c->absent);
+    if (!c->writer) {
+        i2cModelSetFault(c->ch, PCF_ADDR(c->pcf), c->fault, c->perMille);
+    }
+    simAt(T_SETUP, checkSetup, (void *)c);
+    g_rtosEndTime = c->tEnd;
+    firmware_main();
+
+    t_i2cPcfStats s, other;
+    i2cModelPcfStats(c->ch, PCF_ADDR(c->pcf), &s);
+    i2cModelPcfStats(c->ch, PCF_ADDR(c->pcf ^ 1), &other);
+    printf("  %-40s %6u transfers %6u errors, last %6.3f s, ",
+           c->name, s.nTransfers, s.nErrors, (double)s.lastAccess / SIM_NS_PER_S);
+    if (c->writer) {
+        printf("24 V %s, ER:0100 x %u, reset %s",
+               hal_solenoids_enabled() ? "on" : "off", g_erPanic.n, g_resetAt ? "yes" : "no");
+        if (g_resetAt) printf(" at %.3f s", (double)g_resetAt / SIM_NS_PER_S);
+        // Errors from T_SETUP on stay below the limit in the first window,
+        // so the shutdown has to come at the end of the second one
+        pass = c->expectOff ?
+            !hal_solenoids_enabled() && g_erPanic.n && g_resetAt > 2 * PCF_ERR_CHECK_CYCLE * SIM_NS_PER_MS :
+            hal_solenoids_enabled() && !g_erPanic.n && !g_resetAt;
+    } else {
+        // The read flag is only checked at the end of the first window
+        bool dropped = s.lastAccess < (PCF_ERR_CHECK_CYCLE + 500) * SIM_NS_PER_MS;
+        printf("%s", dropped ? "dropped" : "polled");
+        pass = dropped == c->expectOff && s.nTransfers > PCF_ERR_CHECK_CYCLE * 9 / 10 &&
+               other.lastAccess > c->tEnd - 10 * SIM_NS_PER_MS;
+    }
+    printf("  %s\n", pass ? "PASS" : "FAIL");
+    return !pass;
+}
+
+static int windowChecks()
+{
+    unsigned nFail = 0;
+    printf("PCF_ERR_CHECK_CYCLE = %u ms, PCF_ERR_CNT_DISABLE = %u\n",
+           PCF_ERR_CHECK_CYCLE, PCF_ERR_CNT_DISABLE);
+    for (unsigned i = 0; i < sizeof(g_checks) / sizeof(g_checks[0]); i++) {
+        if (runChild(checkRun, (void *)&g_checks[i])) nFail++;
+    }
+    printf("%u of %u checks failed\n", nFail, (unsigned)(sizeof(g_checks) / sizeof(g_checks[0])));
+    return nFail ? 1 : 0;
+}
+
+int main(int argc, char *argv[])
+{
+    int c;
+    bool check = false;
+    while ((c = getopt(argc, argv, "T")) != -1) {
+        switch (c) {
+        case 'T': check = true; break;
+        default:
+            fprintf(stderr, "usage: %s [-T]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (check) return windowChecks();
+    sweep();
+    return 0;
+}
@@ -0,0 +1,242 @@
+// Switch to coil latency of the quick rules, see "Host build" in README.md
+//
+// Closes an input switch at phases spread over the 1 ms tick and measures
+// the simulated time until the output of its quick rule is on the wire:
+//   - PCF output: the PCF drives the pin after the ACK of the byte the scan
+//     after the rule wrote to it (bcm_buffer of the current BCM slot)
+//   - HW. PWM output: setPwm() writes the compare register
+// On the way are the matrix read or the PCF scan of the input, the 4 tick
+// debounce, process_IO() once the scan is done and the 1 ms
+// vTaskDelayUntil() loop of task_pcf_io(). Each configuration is booted in
+// a child process of its own.
+//
+//   latency [-f sclHz] [-p nPcf] [-w pwmHigh] [-n edges]
+//
+// The firmware runs in zero simulated time, so the numbers are the timing
+// of the loop and the buses. Add the CPU time of process_IO() (PRF) for the
+// target.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "hal.h"
+#include "sim.h"
+#include "FreeRTOS.h"
+#include "io_manager.h"
+
+int firmware_main(void);
+
+#define T_SETUP         (100 * SIM_NS_PER_MS)
+// After the absent PCFs have been dropped (PCF_ERR_CHECK_CYCLE)
+#define T_START         ((PCF_ERR_CHECK_CYCLE + 500) * SIM_NS_PER_MS)
+#define EDGE_PERIOD     (50 * SIM_NS_PER_MS)
+#define RELEASE_AFTER   (25 * SIM_NS_PER_MS)
+#define N_PHASES        20
+#define N_HIST          16      // 1 ms bins
+#define PCF_ADDR(i)     (PCF_LOWEST_ADDR + (i))
+#define HW_PCF(ch, i, pin)  (0x40 + (ch) * 0x40 + (i) * 8 + (pin))
+#define HW_PWM0         60
+
+static struct {
+    uint32_t sclHz;
+    unsigned nPcf;          // present PCFs per channel
+    unsigned pwmHigh;       // of the PCF output, 1 - 7
+    unsigned nEdges;
+} g_cfg = {400000, 8, 7, 200};
+
+typedef struct {
+    const char *name;
+    bool inPcf;             // else the switch matrix
+    bool outPcf;            // else HW. PWM
+    bool noDebounce;        // DEB
+} t_path;
+
+static const t_path g_paths[] = {
+    {"matrix -> HW. PWM",      false, false, false},
+    {"matrix -> PCF",          false, true,  false},
+    {"PCF -> HW. PWM",         true,  false, false},
+    {"PCF -> PCF",             true,  true,  false},
+    {"matrix -> HW. PWM, DEB", false, false, true},
+    {"PCF -> PCF, DEB",        true,  true,  true},
+};
+
+//*****************************************************************************
+// Measurement (in the child)
+//*****************************************************************************
+static const t_path *g_path;
+// The input PCF is the last one on channel 0, the output PCF the first one
+// on channel 1, so both are at the end / start of their scan
+static uint16_t g_in, g_out;        // hwIndex
+static uint64_t g_edgeAt;           // 0 = no edge pending
+static unsigned g_nEdges;
+static uint64_t g_min = UINT64_MAX, g_max, g_sum;
+static uint64_t g_maxPhase[N_PHASES];
+static unsigned g_hist[N_HIST];
+static unsigned g_phase;
+
+static void hostSend(const char *cmd)
+{
+    usbHostWrite((const uint8_t *)cmd, strlen(cmd));
+}
+
+static void outputOn()
+{
+    if (!g_edgeAt) return;
+    uint64_t dt = g_simNow - g_edgeAt;
+    g_edgeAt = 0;
+    if (dt < g_min) g_min = dt;
+    if (dt > g_max) g_max = dt;
+    if (dt > g_maxPhase[g_phase]) g_maxPhase[g_phase] = dt;
+    g_sum += dt;
+    g_hist[dt / SIM_NS_PER_MS < N_HIST ? dt / SIM_NS_PER_MS : N_HIST - 1]++;
+    g_nEdges++;
+}
+
+static void pwmHook(unsigned ch, uint16_t value)
+{
+    if (g_out == HW_PWM0 + ch && value) outputOn();
+}
+
+static void pcfHook(unsigned ch, unsigned addr, uint8_t value)
+{
+    unsigned i = g_out - 0x40;
+    if (ch == i / 0x40 && addr == PCF_ADDR(i % 0x40 / 8) && (value & (1 << (i % 8)))) outputOn();
+}
+
+static void release(void *arg)
+{
+    (void)arg;
+    hal_set_switch(g_in, false);
+}
+
+static void edge(void *arg)
+{
+    uintptr_t k = (uintptr_t)arg;
+    // Phase within the tick, a fraction of a tick later for each edge
+    g_phase = k % N_PHASES;
+    hal_set_switch(g_in, true);
+    g_edgeAt = g_simNow;
+    simAt(g_simNow + RELEASE_AFTER, release, NULL);
+    if (k + 1 < g_cfg.nEdges) {
+        simAt(T_START + (k + 1) * EDGE_PERIOD + (k + 1) % N_PHASES * SIM_NS_PER_MS / N_PHASES,
+              edge, (void *)(k + 1));
+    } else {
+        g_rtosEndTime = g_simNow + EDGE_PERIOD;
+    }
+}
+
+static void setup(void *arg)
+{
+    char cmd[64];
+    (void)arg;
+    for (unsigned ch = 0; ch < 4; ch++) {
+        *hal_raw(I2C0_BASE + ch * 0x1000 + I2C_O_MTPR) = i2cModelTpr(SYSTEM_CLOCK, g_cfg.sclHz);
+    }
+    if (g_path->inPcf) {
+        snprintf(cmd, sizeof(cmd), "HI 0x%x\n", g_in);
+        hostSend(cmd);
+    }
+    // Makes the PCF an output, off
+    snprintf(cmd, sizeof(cmd), "OUT 0x%x 0 0 0\n", g_out);
+    hostSend(cmd);
+    // A closed switch reads 0: trigger on the falling edge
+    snprintf(cmd, sizeof(cmd), "RUL 0 0x%x 0x%x 5 10 %u 0 0\n", g_in, g_out,
+             g_out == HW_PWM0 ? MAX_PWM : g_cfg.pwmHigh);
+    hostSend(cmd);
+    if (g_path->noDebounce) {
+        snprintf(cmd, sizeof(cmd), "DEB 0x%x 0\n", g_in);
+        hostSend(cmd);
+    }
+    simAt(T_START, edge, (void *)0);
+}
+
+static int runPath(const t_path *p)
+{
+    g_path = p;
+    g_in = p->inPcf ? HW_PCF(0, g_cfg.nPcf - 1, 3) : 0x05;
+    g_out = p->outPcf ? HW_PCF(1, 0, 0) : HW_PWM0;
+    for (unsigned ch = 0; ch < 4; ch++) {
+        for (unsigned i = g_cfg.nPcf; i < PCF_MAX_PER_CHANNEL; i++) {
+            i2cModelSetPresent(ch, PCF_ADDR(i), false);
+        }
+    }
+    g_halUart = NULL;
+    g_halPwmHook = pwmHook;
+    g_i2cPcfWriteHook = pcfHook;
+    simAt(T_SETUP, setup, NULL);
+    g_rtosEndTime = T_START + (g_cfg.nEdges + 1) * EDGE_PERIOD;
+    firmware_main();
+
+    if (!g_nEdges) {
+        printf("%-24s no output\n", p->name);
+        return 1;
+    }
+    printf("%-24s %6.3f %6.3f %6.3f |", p->name, (double)g_min / SIM_NS_PER_MS,
+           (double)g_sum / g_nEdges / SIM_NS_PER_MS, (double)g_max / SIM_NS_PER_MS);
+    unsigned last = 0;
+    for (unsigned i = 0; i < N_HIST; i++) {
+        if (g_hist[i]) last = i;
+    }
+    for (unsigned i = 0; i <= last; i++) {
+        printf(" %3u", g_hist[i]);
+    }
+    printf("\n");
+    unsigned worst = 0;
+    for (unsigned i = 0; i < N_PHASES; i++) {
+        if (g_maxPhase[i] > g_maxPhase[worst]) worst = i;
+    }
+    printf("%24s worst at %.2f ms into the tick, %u / %u edges without output\n", "",
+           (double)worst / N_PHASES, g_cfg.nEdges - g_nEdges, g_cfg.nEdges);
+    return g_nEdges != g_cfg.nEdges;
+}
+
+//*****************************************************************************
+// Configurations
+//*****************************************************************************
+static int runChild(const t_path *p)
+{
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        exit(1);
+    }
+    if (!pid) {
+        exit(runPath(p));
+    }
+    int status;
+    waitpid(pid, &status, 0);
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+int main(int argc, char *argv[])
+{
+    int c;
+    unsigned nFail = 0;
+    while ((c = getopt(argc, argv, "f:p:w:n:")) != -1) {
+        switch (c) {
+        case 'f': g_cfg.sclHz = atoi(optarg); break;
+        case 'p': g_cfg.nPcf = atoi(optarg); break;
+        case 'w': g_cfg.pwmHigh = atoi(optarg); break;
+        case 'n': g_cfg.nEdges = atoi(optarg); break;
+        default:
+            fprintf(stderr, "usage: %s [-f sclHz] [-p nPcf] [-w pwmHigh] [-n edges]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (g_cfg.nPcf < 1 || g_cfg.nPcf > PCF_MAX_PER_CHANNEL || !g_cfg.nEdges || !g_cfg.sclHz ||
+        g_cfg.pwmHigh < 1 || g_cfg.pwmHigh >= (1 << N_BIT_PWM)) {
+        fprintf(stderr, "nPcf: 1 - %u, pwmHigh: 1 - %u\n", PCF_MAX_PER_CHANNEL, (1 << N_BIT_PWM) - 1);
+        return 1;
+    }
+    printf("Switch edge until the quick rule output is on the wire, %u edges at %u phases of the tick\n",
+           g_cfg.nEdges, N_PHASES);
+    printf("SCL %u kHz, %u PCFs per channel, PCF output pwmHigh %u of %u\n",
+           g_cfg.sclHz / 1000, g_cfg.nPcf, g_cfg.pwmHigh, (1 << N_BIT_PWM) - 1);
+    printf("%-24s %6s %6s %6s | edges per 1 ms bin from 0 ms\n", "", "min_ms", "avg_ms", "max_ms");
+    for (unsigned i = 0; i < sizeof(g_paths) / sizeof(g_paths[0]); i++) {
+        if (runChild(&g_paths[i])) nFail++;
+    }
+    return nFail ? 1 : 0;
+}
@@ -0,0 +1,252 @@
+// The simulated board as a virtual serial port, see "Host build" in README.md
+//
+//   ptyport [-l link] [-q]
+//       Runs the firmware in real time and connects its USB CDC port to a
+//       pseudo terminal. Open the printed device (or the symlink given with
+//       -l) instead of /dev/ttyACM0 in testLed.py, the notebook or MPF.
+//       The DEBUG port (UARTprintf()) goes to stderr unless -q is given.
+//
+//   ptyport -t nCommands [-s maxPacket]
+//       Throughput test without a pty: a mix of OUT / RUL / SW? / LED
+//       commands is sent as fast as the simulated USB link takes it, split
+//       into packets of random length (1 - maxPacket bytes) so commands
+//       straddle packets and wrap around the receive ring buffer.
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <termios.h>
+#include "hal.h"
+#include "sim.h"
+#include "FreeRTOS.h"
+#include "task.h"
+#include "myTasks.h"
+#include "usb_serial_structs.h"
+
+int firmware_main(void);
+
+//*****************************************************************************
+// Pseudo terminal
+//*****************************************************************************
+static int g_ptyFd = -1;
+static uint64_t g_hostStart;    // host time at simulated time 0
+static uint64_t g_txDropped;    // bytes nobody was reading
+
+static void ptyTxSink(const uint8_t *data, uint32_t len)
+{
+    ssize_t n = write(g_ptyFd, data, len);
+    if (n < (ssize_t)len) {
+        g_txDropped += len - (n > 0 ? n : 0);
+    }
+}
+
+// Sleep until the real time of the next event, take what the host sends
+static void ptyIdle(uint64_t tNext)
+{
+    (void)tNext;
+    for (;;) {
+        uint64_t now = hal_host_ns() - g_hostStart;
+        tNext = simNext();
+        if (tNext <= now) return;
+        uint64_t waitMs = (tNext - now + SIM_NS_PER_MS - 1) / SIM_NS_PER_MS;
+        struct pollfd p = {g_ptyFd, POLLIN, 0};
+        if (poll(&p, 1, waitMs > 1000 ? 1000 : waitMs) > 0 && (p.revents & POLLIN)) {
+            uint8_t buf[4096];
+            ssize_t n = read(g_ptyFd, buf, sizeof(buf));
+            if (n > 0) {
+                // Sent from now on, not from the end of the sleep
+                g_simNow = now > g_simNow ? now : g_simNow;
+                usbHostWrite(buf, n);
+            }
+        }
+    }
+}
+
+static int ptyRun(const char *link, bool quiet)
+{
+    g_ptyFd = posix_openpt(O_RDWR | O_NOCTTY);
+    if (g_ptyFd < 0 || grantpt(g_ptyFd) || unlockpt(g_ptyFd)) {
+        perror("posix_openpt");
+        return 1;
+    }
+    const char *name = ptsname(g_ptyFd);
+    // Keep the slave open, so the master does not see EIO between clients,
+    // and make it a raw line like a CDC ACM device
+    int slave = open(name, O_RDWR | O_NOCTTY);
+    struct termios t;
+    if (slave < 0 || tcgetattr(slave, &t)) {
+        perror(name);
+        return 1;
+    }
+    cfmakeraw(&t);
+    tcsetattr(slave, TCSANOW, &t);
+    fcntl(g_ptyFd, F_SETFL, fcntl(g_ptyFd, F_GETFL) | O_NONBLOCK);
+    if (link) {
+        unlink(link);
+        if (symlink(name, link)) {
+            perror(link);
+            return 1;
+        }
+    }
+    printf("DEVICE port: %s\n", link ? link : name);
+    fflush(stdout);
+
+    g_halUart = quiet ? NULL : stderr;
+    g_halClock = HAL_CLOCK_SIM;
+    g_usbTxSink = ptyTxSink;
+    g_rtosIdleHook = ptyIdle;
+    g_hostStart = hal_host_ns();
+    firmware_main();
+    return 0;
+}
+
+//*****************************************************************************
+// Throughput
+//*****************************************************************************
+#define TP_PENDING_MAX  2048    // bytes queued on the host side
+#define TP_REFILL_NS    (50 * SIM_NS_PER_US)
+#define TP_N_LEDS       64
+
+static struct {
+    unsigned nCmds;         // to send
+    unsigned maxPacket;
+    unsigned nSent;
+    unsigned nSwQueries;    // SW? sent
+    unsigned nOut, nRul, nLed;
+    uint64_t nBytes;        // sent
+    uint64_t tStart, tDone;
+    uint64_t hostStart;
+} g_tp = {0, 64};
+
+static t_simMatch g_swReplies = {"SW:"};
+static t_simMatch g_errors = {"ER:"};
+static uint64_t g_rxBytes;
+
+static void tpTxSink(const uint8_t *data, uint32_t len)
+{
+    simMatchFeed(&g_swReplies, data, len);
+    simMatchFeed(&g_errors, data, len);
+    g_rxBytes += len;
+}
+
+// One random command of the mix
+static unsigned tpCommand(uint8_t *buf)
+{
+    unsigned r = rand() % 10;
+    unsigned out = 0x40 + rand() % 0x80;
+    if (r < 4) {
+        g_tp.nOut++;
+        return sprintf((char *)buf, "OUT 0x%x %u %u %u\n", out, rand() % 8, rand() % 50, 7);
+    } else if (r < 5) {
+        g_tp.nRul++;
+        return sprintf((char *)buf, "RUL %u 0x%x 0x%x 5 10 7 0 %u\n",
+                       rand() % 64, rand() % 0x40, out, rand() % 2);
+    } else if (r < 7) {
+        g_tp.nSwQueries++;
+        return sprintf((char *)buf, "SW?\n");
+    }
+    g_tp.nLed++;
+    unsigned n = sprintf((char *)buf, "LED 0 %u\n", TP_N_LEDS * 3);
+    for (unsigned i = 0; i < TP_N_LEDS * 3; i++) {
+        buf[n++] = rand();
+    }
+    return n;
+}
+
+// Send as random sized packets
+static void tpSend(const uint8_t *data, unsigned len)
+{
+    while (len) {
+        unsigned n = 1 + rand() % g_tp.maxPacket;
+        if (n > len) n = len;
+        usbHostWrite(data, n);
+        data += n;
+        len -= n;
+    }
+}
+
+static void tpDone(void *arg)
+{
+    (void)arg;
+    g_rtosEndTime = g_simNow;
+}
+
+static void tpRefill(void *arg)
+{
+    uint8_t buf[32 + TP_N_LEDS * 3];
+    (void)arg;
+    if (!g_tp.nSent) {
+        g_tp.tStart = g_simNow;
+        g_tp.hostStart = rtos_task_host_ns(hUSBCommandParser);
+    }
+    while (g_tp.nSent < g_tp.nCmds && usbHostPending() < TP_PENDING_MAX) {
+        unsigned n = tpCommand(buf);
+        tpSend(buf, n);
+        g_tp.nBytes += n;
+        g_tp.nSent++;
+    }
+    if (g_tp.nSent >= g_tp.nCmds && !usbHostPending() && g_swReplies.n >= g_tp.nSwQueries) {
+        g_tp.tDone = g_simNow;
+        simAt(g_simNow + SIM_NS_PER_MS, tpDone, NULL);
+        return;
+    }
+    simAt(g_simNow + TP_REFILL_NS, tpRefill, NULL);
+}
+
+static int tpRun()
+{
+    srand(1);
+    g_halUart = getenv("TP_DEBUG") ? stderr : NULL;
+    g_usbTxSink = tpTxSink;
+    g_usbRxPacketMax = g_tp.maxPacket;
+    simAt(200 * SIM_NS_PER_MS, tpRefill, NULL);
+    // Give up if the firmware stops taking commands
+    g_rtosEndTime = SIM_NS_PER_S + g_tp.nCmds * 10 * SIM_NS_PER_MS;
+    firmware_main();
+    if (!g_tp.tDone) {
+        printf("stuck after %u of %u commands, %u bytes not taken, %u / %u SW? replied, %u ER: reports\n",
+               g_tp.nSent, g_tp.nCmds, usbHostPending(), g_swReplies.n, g_tp.nSwQueries, g_errors.n);
+        return 1;
+    }
+    double tSim = (double)(g_tp.tDone - g_tp.tStart) / SIM_NS_PER_S;
+    double tCpu = (rtos_task_host_ns(hUSBCommandParser) - g_tp.hostStart) / 1e9;
+    printf("%u commands, %llu bytes in packets of 1 - %u bytes, USB_BUFFER_SIZE %u\n",
+           g_tp.nCmds, (unsigned long long)g_tp.nBytes, g_tp.maxPacket, USB_BUFFER_SIZE);
+    printf("%u OUT, %u RUL, %u SW?, %u LED with %u LEDs each\n",
+           g_tp.nOut, g_tp.nRul, g_tp.nSwQueries, g_tp.nLed, TP_N_LEDS);
+    printf("%u / %u SW? replied, %u ER: reports, %llu bytes received\n",
+           g_swReplies.n, g_tp.nSwQueries, g_errors.n, (unsigned long long)g_rxBytes);
+    printf("%24s: %10.0f commands/s %10.0f bytes/s (%.3f s)\n",
+           "simulated USB link", g_tp.nCmds / tSim, g_tp.nBytes / tSim, tSim);
+    printf("%24s: %10.0f commands/s %10.0f bytes/s (%.3f s)\n",
+           "Parser task, host CPU", g_tp.nCmds / tCpu, g_tp.nBytes / tCpu, tCpu);
+    return g_errors.n || g_swReplies.n != g_tp.nSwQueries;
+}
+
+int main(int argc, char *argv[])
+{
+    int c;
+    const char *link = NULL;
+    bool quiet = false;
+    while ((c = getopt(argc, argv, "l:qt:s:")) != -1) {
+        switch (c) {
+        case 'l': link = optarg; break;
+        case 'q': quiet = true; break;
+        case 't': g_tp.nCmds = atoi(optarg); break;
+        case 's': g_tp.maxPacket = atoi(optarg); break;
+        default:
+            fprintf(stderr, "usage: %s [-l link] [-q]\n"
+                            "       %s -t nCommands [-s maxPacket]\n", argv[0], argv[0]);
+            return 1;
+        }
+    }
+    if (g_tp.maxPacket < 1 || g_tp.maxPacket > 64) {
+        fprintf(stderr, "maxPacket: 1 - 64\n");
+        return 1;
+    }
+    return g_tp.nCmds ? tpRun() : ptyRun(link, quiet);
+}
@@ -0,0 +1,645 @@
+// Cooperative stand-in for the FreeRTOS V8.2.1 API, see rtos.h.
+// Each task runs on its own ucontext stack. A task runs until it blocks,
+// yields or is deleted, then the next ready task in creation order runs.
+// With all tasks at priority 1 and time slicing only at a tick, the target
+// schedules the same way as long as no task runs for longer than a tick.
+// When no task is ready, the simulated time jumps to the next event
+// (tick, peripheral, interrupt).
+#include <stdio.h>
+#include <stdlib.h>
+#include <ucontext.h>
+#include "FreeRTOS.h"
+#include "task.h"
+#include "queue.h"
+#include "semphr.h"
+#include "sim.h"
+
+#define RTOS_HOST_STACK     (256 * 1024)
+// Size of the kernel objects on the target (Cortex-M4F port, this config)
+#define RTOS_TCB_SIZE       92
+#define RTOS_QUEUE_SIZE     84
+#define RTOS_FOREVER        UINT64_MAX
+
+typedef enum {
+    T_READY,
+    T_BLOCKED,
+    T_DELETED
+} t_rtosState;
+
+typedef enum {
+    N_NOT_WAITING,
+    N_WAITING,
+    N_NOTIFIED
+} t_rtosNotify;
+
+struct t_rtosTask {
+    char name[configMAX_TASK_NAME_LEN];
+    TaskFunction_t func;
+    void *arg;
+    uint16_t depth;
+    ucontext_t ctx;
+    void *hostStack;
+    t_rtosState state;
+    uint64_t wakeTick;      // RTOS_FOREVER = no timeout
+    bool timedOut;
+    struct t_rtosQueue *waitQueue;  // queue to poll again when it changes
+    uint32_t notifyValue;
+    t_rtosNotify notifyState;
+    void *heapTcb, *heapStack;
+    uint64_t hostNs;        // host CPU time spent running the task
+    struct t_rtosTask *next;
+};
+
+struct t_rtosQueue {
+    uint8_t *buf;
+    UBaseType_t len, itemSize, count, head;
+    void *heapQueue;
+};
+
+uint64_t g_rtosEndTime = 0;
+void (*g_rtosIdleHook)(uint64_t tNext) = NULL;
+
+static struct t_rtosTask *g_tasks = NULL;
+static struct t_rtosTask *g_current = NULL;
+// Stands in for the caller before the scheduler runs (tools, tests)
+static struct t_rtosTask g_mainTask = {.name = "main"};
+static ucontext_t g_schedCtx;
+static bool g_running = false;
+static bool g_tickStarted = false;
+static uint64_t g_tick = 0;
+static unsigned g_critNesting = 0;
+
+static struct t_rtosTask *rtosSelf()
+{
+    return g_running ? g_current : &g_mainTask;
+}
+
+//*****************************************************************************
+// Tick and blocking
+//*****************************************************************************
+static void rtosTick(void *arg)
+{
+    (void)arg;
+    g_tick++;
+    for (struct t_rtosTask *t = g_tasks; t; t = t->next) {
+        if (t->state == T_BLOCKED && t->wakeTick <= g_tick) {
+            t->timedOut = true;
+            t->state = T_READY;
+        }
+    }
+    if (g_mainTask.state == T_BLOCKED && g_mainTask.wakeTick <= g_tick) {
+        g_mainTask.timedOut = true;
+        g_mainTask.state = T_READY;
+    }
+    simAt(g_simNow + SIM_NS_PER_S / configTICK_RATE_HZ, rtosTick, NULL);
+}
+
+static void rtosStartTick()
+{
+    if (!g_tickStarted) {
+        g_tickStarted = true;
+        simAt(g_simNow + SIM_NS_PER_S / configTICK_RATE_HZ, rtosTick, NULL);
+    }
+}
+
+static void rtosWake(struct t_rtosTask *t)
+{
+    if (t->state == T_BLOCKED) {
+        t->timedOut = false;
+        t->state = T_READY;
+    }
+}
+
+// Give up the CPU until rtosWake(), a change of queue q (if not NULL) or the
+// tick wakeTick. Returns false on timeout.
+static bool rtosBlockUntil(uint64_t wakeTick, struct t_rtosQueue *q)
+{
+    struct t_rtosTask *self = rtosSelf();
+    if (!self) {
+        hal_fatal("blocking RTOS call outside of a task");
+    }
+    if (hal_irq_active()) {
+        hal_fatal("blocking RTOS call in interrupt %u", hal_irq_active());
+    }
+    if (g_critNesting) {
+        hal_fatal("blocking RTOS call in a critical section");
+    }
+    hal_sync();
+    self->timedOut = false;
+    self->wakeTick = wakeTick;
+    self->waitQueue = q;
+    self->state = T_BLOCKED;
+    if (g_running) {
+        swapcontext(&self->ctx, &g_schedCtx);
+    } else {
+        rtosStartTick();
+        while (self->state == T_BLOCKED) {
+            if (!simStep()) hal_fatal("blocked forever outside of the scheduler");
+        }
+    }
+    self->waitQueue = NULL;
+    return !self->timedOut;
+}
+
+static uint64_t rtosDeadline(TickType_t xTicksToWait)
+{
+    return xTicksToWait == portMAX_DELAY ? RTOS_FOREVER : g_tick + xTicksToWait;
+}
+
+//*****************************************************************************
+// Tasks
+//*****************************************************************************
+static void rtosTrampoline()
+{
+    struct t_rtosTask *self = g_current;
+    self->func(self->arg);
+    hal_fatal("task %s returned", self->name);
+}
+
+BaseType_t xTaskCreate(TaskFunction_t pxTaskCode, const char * const pcName,
+                       uint16_t usStackDepth, void *pvParameters,
+                       UBaseType_t uxPriority, TaskHandle_t *pxCreatedTask)
+{
+    (void)uxPriority;
+    void *tcb = pvPortMalloc(RTOS_TCB_SIZE);
+    void *stack = tcb ? pvPortMalloc(usStackDepth * sizeof(portSTACK_TYPE)) : NULL;
+    if (!stack) {
+        vPortFree(tcb);
+        return -1;  // errCOULD_NOT_ALLOCATE_REQUIRED_MEMORY
+    }
+    struct t_rtosTask *t = calloc(1, sizeof(*t));
+    if (!t) hal_fatal("xTaskCreate(): out of host memory");
+    strncpy(t->name, pcName, sizeof(t->name) - 1);
+    t->func = pxTaskCode;
+    t->arg = pvParameters;
+    t->depth = usStackDepth;
+    t->heapTcb = tcb;
+    t->heapStack = stack;
+    t->hostStack = malloc(RTOS_HOST_STACK);
+    if (!t->hostStack) hal_fatal("xTaskCreate(): out of host memory");
+    getcontext(&t->ctx);
+    t->ctx.uc_stack.ss_sp = t->hostStack;
+    t->ctx.uc_stack.ss_size = RTOS_HOST_STACK;
+    t->ctx.uc_link = NULL;
+    makecontext(&t->ctx, rtosTrampoline, 0);
+    t->state = T_READY;
+    struct t_rtosTask **p = &g_tasks;
+    while (*p) p = &(*p)->next;
+    *p = t;
+    if (pxCreatedTask) *pxCreatedTask = t;
+    return pdPASS;
+}
+
+void vTaskDelete(TaskHandle_t xTaskToDelete)
+{
+    struct t_rtosTask *t = xTaskToDelete ? xTaskToDelete : rtosSelf();
+    if (t == &g_mainTask) hal_fatal("vTaskDelete(): not in a task");
+    t->state = T_DELETED;
+    vPortFree(t->heapStack);
+    vPortFree(t->heapTcb);
+    t->heapStack = t->heapTcb = NULL;
+    if (t == g_current && g_running) {
+        swapcontext(&t->ctx, &g_schedCtx);
+        hal_fatal("deleted task %s resumed", t->name);
+    }
+}
+
+void vTaskStartScheduler(void)
+{
+    // Idle task, timer task and its command queue (configUSE_TIMERS)
+    if (!pvPortMalloc(RTOS_TCB_SIZE) ||
+        !pvPortMalloc(configMINIMAL_STACK_SIZE * sizeof(portSTACK_TYPE)) ||
+        !pvPortMalloc(RTOS_QUEUE_SIZE + configTIMER_QUEUE_LENGTH * 16) ||
+        !pvPortMalloc(RTOS_TCB_SIZE) ||
+        !pvPortMalloc(configTIMER_TASK_STACK_DEPTH * sizeof(portSTACK_TYPE))) {
+        hal_fatal("vTaskStartScheduler(): no heap for the idle and timer task");
+    }
+    struct t_rtosTask *last = NULL;
+    g_running = true;
+    rtosStartTick();
+    while (!g_rtosEndTime || g_simNow < g_rtosEndTime) {
+        // Round robin, starting after the task which ran last
+        struct t_rtosTask *found = NULL;
+        for (struct t_rtosTask *t = last ? last->next : g_tasks; t && !found; t = t->next) {
+            if (t->state == T_READY) found = t;
+        }
+        for (struct t_rtosTask *t = g_tasks; t && !found; t = t->next) {
+            if (t->state == T_READY) found = t;
+        }
+        if (found) {
+            last = g_current = found;
+            uint64_t t0 = hal_host_ns();
+            swapcontext(&g_schedCtx, &found->ctx);
+            found->hostNs += hal_host_ns() - t0;
+            g_current = NULL;
+            hal_sync();
+            continue;
+        }
+        uint64_t tNext = simNext();
+        if (g_rtosEndTime && tNext > g_rtosEndTime) {
+            simRunUntil(g_rtosEndTime);
+            break;
+        }
+        if (g_rtosIdleHook) g_rtosIdleHook(tNext);
+        if (!simStep()) hal_fatal("vTaskStartScheduler(): all tasks blocked forever");
+    }
+    g_running = false;
+}
+
+void vTaskDelay(TickType_t xTicksToDelay)
+{
+    if (xTicksToDelay == 0) {
+        // Yield to the other ready tasks
+        struct t_rtosTask *self = rtosSelf();
+        if (g_running && !hal_irq_active()) {
+            hal_sync();
+            swapcontext(&self->ctx, &g_schedCtx);
+        }
+        return;
+    }
+    rtosBlockUntil(g_tick + xTicksToDelay, NULL);
+}
+
+void vTaskDelayUntil(TickType_t *pxPreviousWakeTime, TickType_t xTimeIncrement)
+{
+    TickType_t now = (TickType_t)g_tick;
+    TickType_t wake = *pxPreviousWakeTime + xTimeIncrement;
+    bool shouldDelay;
+    // Same overflow handling as in tasks.c
+    if (now < *pxPreviousWakeTime) {
+        shouldDelay = wake < *pxPreviousWakeTime && wake > now;
+    } else {
+        shouldDelay = wake < *pxPreviousWakeTime || wake > now;
+    }
+    *pxPreviousWakeTime = wake;
+    if (shouldDelay) {
+        rtosBlockUntil(g_tick + (TickType_t)(wake - now), NULL);
+    } else {
+        vTaskDelay(0);
+    }
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+    return (TickType_t)g_tick;
+}
+
+TickType_t xTaskGetTickCountFromISR(void)
+{
+    return (TickType_t)g_tick;
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void)
+{
+    return g_current;
+}
+
+// The host stack tells nothing about the target stack usage, so this is
+// the full depth. Measure stack usage on the target (MEM command).
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t xTask)
+{
+    struct t_rtosTask *t = xTask ? xTask : rtosSelf();
+    return t->depth;
+}
+
+void vTaskEnterCritical(void)
+{
+    if (g_critNesting++ == 0) hal_irq_mask(true);
+}
+
+void vTaskExitCritical(void)
+{
+    if (g_critNesting == 0) hal_fatal("taskEXIT_CRITICAL() without taskENTER_CRITICAL()");
+    if (--g_critNesting == 0) hal_irq_mask(false);
+}
+
+//*****************************************************************************
+// Task notifications
+//*****************************************************************************
+BaseType_t xTaskNotify(TaskHandle_t xTaskToNotify, uint32_t ulValue, eNotifyAction eAction)
+{
+    struct t_rtosTask *t = xTaskToNotify;
+    if (!t) return pdFAIL;
+    t_rtosNotify prev = t->notifyState;
+    t->notifyState = N_NOTIFIED;
+    switch (eAction) {
+    case eSetBits:
+        t->notifyValue |= ulValue;
+        break;
+    case eIncrement:
+        t->notifyValue++;
+        break;
+    case eSetValueWithOverwrite:
+        t->notifyValue = ulValue;
+        break;
+    case eSetValueWithoutOverwrite:
+        if (prev == N_NOTIFIED) return pdFAIL;
+        t->notifyValue = ulValue;
+        break;
+    case eNoAction:
+        break;
+    }
+    if (prev == N_WAITING) rtosWake(t);
+    return pdPASS;
+}
+
+BaseType_t xTaskNotifyFromISR(TaskHandle_t xTaskToNotify, uint32_t ulValue,
+                              eNotifyAction eAction, BaseType_t *pxHigherPriorityTaskWoken)
+{
+    (void)pxHigherPriorityTaskWoken;
+    return xTaskNotify(xTaskToNotify, ulValue, eAction);
+}
+
+void vTaskNotifyGiveFromISR(TaskHandle_t xTaskToNotify, BaseType_t *pxHigherPriorityTaskWoken)
+{
+    (void)pxHigherPriorityTaskWoken;
+    xTaskNotify(xTaskToNotify, 0, eIncrement);
+}
+
+BaseType_t xTaskNotifyWait(uint32_t ulBitsToClearOnEntry, uint32_t ulBitsToClearOnExit,
+                           uint32_t *pulNotificationValue, TickType_t xTicksToWait)
+{
+    struct t_rtosTask *self = rtosSelf();
+    BaseType_t ret;
+    if (self->notifyState != N_NOTIFIED) {
+        self->notifyValue &= ~ulBitsToClearOnEntry;
+        self->notifyState = N_WAITING;
+        if (xTicksToWait > 0) rtosBlockUntil(rtosDeadline(xTicksToWait), NULL);
+    }
+    if (pulNotificationValue) *pulNotificationValue = self->notifyValue;
+    if (self->notifyState == N_WAITING) {
+        ret = pdFALSE;
+    } else {
+        self->notifyValue &= ~ulBitsToClearOnExit;
+        ret = pdTRUE;
+    }
+    self->notifyState = N_NOT_WAITING;
+    return ret;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t xClearCountOnExit, TickType_t xTicksToWait)
+{
+    struct t_rtosTask *self = rtosSelf();
+    if (self->notifyValue == 0) {
+        self->notifyState = N_WAITING;
+        if (xTicksToWait > 0) rtosBlockUntil(rtosDeadline(xTicksToWait), NULL);
+    }
+    uint32_t ret = self->notifyValue;
+    if (ret != 0) {
+        self->notifyValue = xClearCountOnExit ? 0 : ret - 1;
+    }
+    self->notifyState = N_NOT_WAITING;
+    return ret;
+}
+
+//*****************************************************************************
+// Queues and semaphores
+//*****************************************************************************
+// Tasks waiting on a queue poll it again whenever something changed
+static void rtosQueueChanged(QueueHandle_t q)
+{
+    for (struct t_rtosTask *t = g_tasks; t; t = t->next) {
+        if (t->waitQueue == q) rtosWake(t);
+    }
+    if (g_mainTask.waitQueue == q) rtosWake(&g_mainTask);
+}
+
+// The queue storage is accounted with the host item size, which is larger
+// than on the target for items with pointers (t_i2cCustom: 40 B vs. 24 B)
+QueueHandle_t xQueueCreate(UBaseType_t uxQueueLength, UBaseType_t uxItemSize)
+{
+    void *h = pvPortMalloc(RTOS_QUEUE_SIZE + uxQueueLength * uxItemSize + 1);
+    if (!h) return NULL;
+    QueueHandle_t q = calloc(1, sizeof(*q));
+    if (!q) hal_fatal("xQueueCreate(): out of host memory");
+    q->len = uxQueueLength;
+    q->itemSize = uxItemSize;
+    q->buf = malloc(uxQueueLength * uxItemSize + 1);
+    q->heapQueue = h;
+    return q;
+}
+
+static bool rtosQueuePut(QueueHandle_t q, const void *item)
+{
+    if (q->count >= q->len) return false;
+    if (item && q->itemSize) {
+        memcpy(&q->buf[((q->head + q->count) % q->len) * q->itemSize], item, q->itemSize);
+    }
+    q->count++;
+    rtosQueueChanged(q);
+    return true;
+}
+
+static bool rtosQueueGet(QueueHandle_t q, void *item)
+{
+    if (q->count == 0) return false;
+    if (q->itemSize) {
+        memcpy(item, &q->buf[q->head * q->itemSize], q->itemSize);
+    }
+    q->head = (q->head + 1) % q->len;
+    q->count--;
+    rtosQueueChanged(q);
+    return true;
+}
+
+BaseType_t xQueueSendToBack(QueueHandle_t xQueue, const void *pvItemToQueue, TickType_t xTicksToWait)
+{
+    uint64_t deadline = rtosDeadline(xTicksToWait);
+    while (!rtosQueuePut(xQueue, pvItemToQueue)) {
+        if (xTicksToWait == 0 || g_tick >= deadline) return errQUEUE_FULL;
+        rtosBlockUntil(deadline, xQueue);
+    }
+    return pdPASS;
+}
+
+BaseType_t xQueueSendToBackFromISR(QueueHandle_t xQueue, const void *pvItemToQueue,
+                                   BaseType_t *pxHigherPriorityTaskWoken)
+{
+    (void)pxHigherPriorityTaskWoken;
+    return rtosQueuePut(xQueue, pvItemToQueue) ? pdPASS : errQUEUE_FULL;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t xQueue, void *pvBuffer, TickType_t xTicksToWait)
+{
+    uint64_t deadline = rtosDeadline(xTicksToWait);
+    while (!rtosQueueGet(xQueue, pvBuffer)) {
+        if (xTicksToWait == 0 || g_tick >= deadline) return pdFALSE;
+        rtosBlockUntil(deadline, xQueue);
+    }
+    return pdPASS;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t xQueue)
+{
+    return xQueue->count;
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary(void)
+{
+    return xQueueCreate(1, 0);
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t xSemaphore, TickType_t xBlockTime)
+{
+    return xQueueReceive(xSemaphore, NULL, xBlockTime);
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t xSemaphore)
+{
+    return xQueueSendToBack(xSemaphore, NULL, 0);
+}
+
+BaseType_t xSemaphoreGiveFromISR(SemaphoreHandle_t xSemaphore, BaseType_t *pxHigherPriorityTaskWoken)
+{
+    return xQueueSendToBackFromISR(xSemaphore, NULL, pxHigherPriorityTaskWoken);
+}
+
+//*****************************************************************************
+// Heap, first fit with coalescing like heap_4.c
+//*****************************************************************************
+// Block header on the target: next free block + size (top bit = allocated)
+#define HEAP_HDR        8
+#define HEAP_ALIGN      8
+#define HEAP_MIN_BLOCK  (HEAP_HDR * 2)
+#define HEAP_USED       0x80000000U
+#define HEAP_NONE       0xFFFFFFFFU
+
+typedef struct {
+    uint32_t next;  // offset of the next free block, HEAP_NONE = end
+    uint32_t size;  // incl. header
+} t_heapBlock;
+
+static uint8_t g_heap[configTOTAL_HEAP_SIZE] __attribute__((aligned(HEAP_ALIGN)));
+static uint32_t g_heapFree = HEAP_NONE;   // first free block
+static bool g_heapInit = false;
+static size_t g_heapFreeBytes, g_heapMinFreeBytes;
+
+static t_heapBlock *heapAt(uint32_t off)
+{
+    return (t_heapBlock *)&g_heap[off];
+}
+
+static void heapInit()
+{
+    // heap_4 keeps an end marker block at the top of the heap
+    uint32_t size = (configTOTAL_HEAP_SIZE - HEAP_HDR) & ~(HEAP_ALIGN - 1);
+    heapAt(0)->next = HEAP_NONE;
+    heapAt(0)->size = size;
+    g_heapFree = 0;
+    g_heapFreeBytes = g_heapMinFreeBytes = size;
+    g_heapInit = true;
+}
+
+// Insert into the address ordered free list, merge with its neighbours
+static void heapInsert(uint32_t off)
+{
+    uint32_t prev = HEAP_NONE, cur = g_heapFree;
+    while (cur != HEAP_NONE && cur < off) {
+        prev = cur;
+        cur = heapAt(cur)->next;
+    }
+    t_heapBlock *b = heapAt(off);
+    b->next = cur;
+    if (cur != HEAP_NONE && off + b->size == cur) {
+        b->size += heapAt(cur)->size;
+        b->next = heapAt(cur)->next;
+    }
+    if (prev == HEAP_NONE) {
+        g_heapFree = off;
+    } else if (prev + heapAt(prev)->size == off) {
+        heapAt(prev)->size += b->size;
+        heapAt(prev)->next = b->next;
+    } else {
+        heapAt(prev)->next = off;
+    }
+}
+
+void *pvPortMalloc(size_t xWantedSize)
+{
+    if (!g_heapInit) heapInit();
+    if (xWantedSize == 0 || xWantedSize > configTOTAL_HEAP_SIZE) {
+        vApplicationMallocFailedHook();
+        return NULL;
+    }
+    uint32_t want = (xWantedSize + HEAP_HDR + HEAP_ALIGN - 1) & ~(HEAP_ALIGN - 1);
+    uint32_t prev = HEAP_NONE, cur = g_heapFree;
+    while (cur != HEAP_NONE && heapAt(cur)->size < want) {
+        prev = cur;
+        cur = heapAt(cur)->next;
+    }
+    if (cur == HEAP_NONE) {
+        vApplicationMallocFailedHook();
+        return NULL;
+    }
+    t_heapBlock *b = heapAt(cur);
+    uint32_t next = b->next;
+    if (b->size - want > HEAP_MIN_BLOCK) {
+        uint32_t rest = cur + want;
+        heapAt(rest)->size = b->size - want;
+        heapAt(rest)->next = next;
+        next = rest;
+        b->size = want;
+    }
+    if (prev == HEAP_NONE) {
+        g_heapFree = next;
+    } else {
+        heapAt(prev)->next = next;
+    }
+    g_heapFreeBytes -= b->size;
+    if (g_heapFreeBytes < g_heapMinFreeBytes) g_heapMinFreeBytes = g_heapFreeBytes;
+    b->size |= HEAP_USED;
+    b->next = HEAP_NONE;
+    return &g_heap[cur + HEAP_HDR];
+}
+
+void vPortFree(void *pv)
+{
+    if (!pv) return;
+    uint32_t off = (uint8_t *)pv - g_heap - HEAP_HDR;
+    if ((uint8_t *)pv < g_heap + HEAP_HDR || off >= configTOTAL_HEAP_SIZE ||
+        !(heapAt(off)->size & HEAP_USED)) {
+        hal_fatal("vPortFree(): %p is not an allocated block", pv);
+    }
+    heapAt(off)->size &= ~HEAP_USED;
+    g_heapFreeBytes += heapAt(off)->size;
+    heapInsert(off);
+}
+
+size_t xPortGetFreeHeapSize(void)
+{
+    if (!g_heapInit) heapInit();
+    return g_heapFreeBytes;
+}
+
+size_t xPortGetMinimumEverFreeHeapSize(void)
+{
+    if (!g_heapInit) heapInit();
+    return g_heapMinFreeBytes;
+}
+
+//*****************************************************************************
+// Host side
+//*****************************************************************************
+const char *rtos_task_name(TaskHandle_t xTask)
+{
+    if (hal_irq_active()) return "ISR";
+    if (!xTask) xTask = rtosSelf();
+    return xTask ? xTask->name : "idle";
+}
+
+uint64_t rtos_task_host_ns(TaskHandle_t xTask)
+{
+    return xTask->hostNs;
+}
+
+void rtos_print_state(FILE *f)
+{
+    static const char * const states[] = {"ready", "blocked", "deleted"};
+    fprintf(f, "tick %llu\n", (unsigned long long)g_tick);
+    for (struct t_rtosTask *t = g_tasks; t; t = t->next) {
+        fprintf(f, "  %-10s %-8s stack %u words, %.3f s host CPU\n", t->name, states[t->state],
+                t->depth, t->hostNs / 1e9);
+    }
+    fprintf(f, "heap free %u B, min. ever %u B of %u B\n", (unsigned)xPortGetFreeHeapSize(),
+            (unsigned)xPortGetMinimumEverFreeHeapSize(), (unsigned)configTOTAL_HEAP_SIZE);
+}
@@ -0,0 +1,119 @@
+// Cooperative stand-in for the parts of the FreeRTOS API the firmware uses.
+// All tasks run on one host thread (ucontext) in simulated time and only
+// switch when they block, see rtos.c. FreeRTOS.h, task.h, queue.h, semphr.h
+// and timers.h are generated by host/Makefile and include this file.
+#ifndef RTOS_H_
+#define RTOS_H_
+#include <stdint.h>
+#include <stddef.h>
+#include "hal.h"
+
+typedef long BaseType_t;
+typedef unsigned long UBaseType_t;
+typedef uint32_t TickType_t;
+typedef void (*TaskFunction_t)(void *);
+
+typedef struct t_rtosTask *TaskHandle_t;
+typedef struct t_rtosQueue *QueueHandle_t;
+typedef QueueHandle_t SemaphoreHandle_t;
+
+#define portCHAR            char
+#define portSTACK_TYPE      uint32_t
+#define portMAX_DELAY       ((TickType_t)0xffffffffUL)
+#define portTICK_PERIOD_MS  ((TickType_t)1000 / configTICK_RATE_HZ)
+#define pdMS_TO_TICKS(ms)   ((TickType_t)(((TickType_t)(ms) * configTICK_RATE_HZ) / 1000))
+#define pdFALSE             ((BaseType_t)0)
+#define pdTRUE              ((BaseType_t)1)
+#define pdPASS              pdTRUE
+#define pdFAIL              pdFALSE
+#define errQUEUE_FULL       pdFALSE
+
+// A woken task never preempts in the cooperative model
+#define portYIELD_FROM_ISR(x)       ((void)(x))
+#define portEND_SWITCHING_ISR(x)    ((void)(x))
+#define taskYIELD()                 vTaskDelay(0)
+#define taskENTER_CRITICAL()        vTaskEnterCritical()
+#define taskEXIT_CRITICAL()         vTaskExitCritical()
+// Only used by configASSERT(), which ends the simulation
+#define taskDISABLE_INTERRUPTS()    hal_fatal("configASSERT() failed")
+#define taskENABLE_INTERRUPTS()     ((void)0)
+
+typedef enum {
+    eNoAction = 0,
+    eSetBits,
+    eIncrement,
+    eSetValueWithOverwrite,
+    eSetValueWithoutOverwrite
+} eNotifyAction;
+
+//--------------
+// Tasks
+//--------------
+BaseType_t xTaskCreate(TaskFunction_t pxTaskCode, const char * const pcName,
+                       uint16_t usStackDepth, void *pvParameters,
+                       UBaseType_t uxPriority, TaskHandle_t *pxCreatedTask);
+void vTaskDelete(TaskHandle_t xTaskToDelete);
+void vTaskStartScheduler(void);
+void vTaskDelay(TickType_t xTicksToDelay);
+void vTaskDelayUntil(TickType_t *pxPreviousWakeTime, TickType_t xTimeIncrement);
+TickType_t xTaskGetTickCount(void);
+TickType_t xTaskGetTickCountFromISR(void);
+TaskHandle_t xTaskGetCurrentTaskHandle(void);
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t xTask);
+void vTaskEnterCritical(void);
+void vTaskExitCritical(void);
+
+BaseType_t xTaskNotify(TaskHandle_t xTaskToNotify, uint32_t ulValue, eNotifyAction eAction);
+BaseType_t xTaskNotifyFromISR(TaskHandle_t xTaskToNotify, uint32_t ulValue,
+                              eNotifyAction eAction, BaseType_t *pxHigherPriorityTaskWoken);
+BaseType_t xTaskNotifyWait(uint32_t ulBitsToClearOnEntry, uint32_t ulBitsToClearOnExit,
+                           uint32_t *pulNotificationValue, TickType_t xTicksToWait);
+#define xTaskNotifyGive(xTaskToNotify) xTaskNotify((xTaskToNotify), 0, eIncrement)
+void vTaskNotifyGiveFromISR(TaskHandle_t xTaskToNotify, BaseType_t *pxHigherPriorityTaskWoken);
+uint32_t ulTaskNotifyTake(BaseType_t xClearCountOnExit, TickType_t xTicksToWait);
+
+//--------------
+// Queues and semaphores
+//--------------
+QueueHandle_t xQueueCreate(UBaseType_t uxQueueLength, UBaseType_t uxItemSize);
+BaseType_t xQueueSendToBack(QueueHandle_t xQueue, const void *pvItemToQueue, TickType_t xTicksToWait);
+BaseType_t xQueueSendToBackFromISR(QueueHandle_t xQueue, const void *pvItemToQueue,
+                                   BaseType_t *pxHigherPriorityTaskWoken);
+BaseType_t xQueueReceive(QueueHandle_t xQueue, void *pvBuffer, TickType_t xTicksToWait);
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t xQueue);
+#define xQueueSend xQueueSendToBack
+
+SemaphoreHandle_t xSemaphoreCreateBinary(void);
+BaseType_t xSemaphoreTake(SemaphoreHandle_t xSemaphore, TickType_t xBlockTime);
+BaseType_t xSemaphoreGive(SemaphoreHandle_t xSemaphore);
+BaseType_t xSemaphoreGiveFromISR(SemaphoreHandle_t xSemaphore, BaseType_t *pxHigherPriorityTaskWoken);
+
+//--------------
+// Heap
+//--------------
+// Provided by the application (main.c)
+void vApplicationMallocFailedHook(void);
+void vApplicationStackOverflowHook(TaskHandle_t xTask, char *pcTaskName);
+// First fit with coalescing on a configTOTAL_HEAP_SIZE arena, like heap_4.
+// Kernel objects are accounted with their size on the target.
+void *pvPortMalloc(size_t xWantedSize);
+void vPortFree(void *pv);
+size_t xPortGetFreeHeapSize(void);
+size_t xPortGetMinimumEverFreeHeapSize(void);
+
+//--------------
+// Host side
+//--------------
+// vTaskStartScheduler() returns once the simulated time reaches this [ns], 0 = never
+extern uint64_t g_rtosEndTime;
+// Called by the scheduler when no task is ready, before the simulated time
+// jumps to the next event. Used to pace the simulation in real time.
+extern void (*g_rtosIdleHook)(uint64_t tNext);
+// Name of a task, "ISR" in interrupt context
+const char *rtos_task_name(TaskHandle_t xTask);
+// Host CPU time a task has been running, including the interrupts it let in [ns]
+uint64_t rtos_task_host_ns(TaskHandle_t xTask);
+// Print tasks and heap usage to f
+void rtos_print_state(FILE *f);
+
+#endif /* RTOS_H_ */
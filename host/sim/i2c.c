@@ -0,0 +1,274 @@
+// I2C master (MSA / MCS / MDR / MTPR) and PCF8574 model behind the HAL shim.
+// A command written to MCS is taken up by hal_sync() and completes after
+// the bits it puts on the bus, then the channel raises its interrupt.
+// The SCL period follows MTPR like on the TM4C123:
+//   T_SCL = 2 * (1 + TPR) * (SCL_LP + SCL_HP) / f_sys,  SCL_LP = 6, SCL_HP = 4
+#include <stdio.h>
+#include <string.h>
+#include "hal.h"
+#include "sim.h"
+
+#define PCF_ADDR_LO 0x20
+#define PCF_ADDR_HI 0x27
+#define SCL_CLKS    (2 * (6 + 4))
+
+typedef struct {
+    uint8_t input;      // pin levels driven from outside (closed switch = 0)
+    uint8_t latch;      // output latch, a 0 pulls the pin low
+    bool absent;        // nothing answers on this address
+    t_i2cFault fault;   // injected on faultRate / 1000 of the transactions
+    unsigned faultRate;
+    t_i2cPcfStats stats;
+} t_pcfModel;
+
+typedef struct {
+    uint64_t doneAt;    // completion of the running command, 0 = idle
+    bool open;          // START sent without STOP (bus busy)
+    bool nack;          // address NACK of the open transaction
+    uint32_t result;    // MCS and MDR once the running command has finished
+    uint32_t resultData;
+    uint64_t scanStart;     // 0 = no scan yet
+    uint64_t scanNs;        // length of the running scan so far
+    t_i2cBusStats stats;
+    t_pcfModel pcf[8];
+} t_i2cModel;
+
+static t_i2cModel g_i2c[4];
+static const uint32_t g_base[4] = {I2C0_BASE, I2C1_BASE, I2C2_BASE, I2C3_BASE};
+static const uint8_t g_intNo[4] = {INT_I2C0, INT_I2C1, INT_I2C2, INT_I2C3};
+// Fault injection is reproducible from run to run
+static uint32_t g_faultSeed = 1;
+
+static t_pcfModel *pcfAt(unsigned ch, unsigned addr)
+{
+    if (ch > 3 || addr < PCF_ADDR_LO || addr > PCF_ADDR_HI) return NULL;
+    return &g_i2c[ch].pcf[addr - PCF_ADDR_LO];
+}
+
+static t_pcfModel *pcfCheck(unsigned ch, unsigned addr, const char *func)
+{
+    t_pcfModel *p = pcfAt(ch, addr);
+    if (!p) hal_fatal("%s: no PCF %u.%02x", func, ch, addr);
+    return p;
+}
+
+// Power up state of the PCFs: all pins high, no switch closed
+__attribute__((constructor)) static void pcfInit()
+{
+    for (unsigned ch = 0; ch < 4; ch++) {
+        for (unsigned i = 0; i < 8; i++) {
+            g_i2c[ch].pcf[i].input = 0xFF;
+            g_i2c[ch].pcf[i].latch = 0xFF;
+        }
+    }
+}
+
+void i2cModelInit(unsigned ch)
+{
+    t_i2cModel *m = &g_i2c[ch];
+    m->doneAt = 0;
+    m->open = false;
+    *hal_raw(g_base[ch] + I2C_O_MCS) = I2C_MCS_IDLE;
+}
+
+uint32_t i2cModelTpr(uint32_t sysClk, uint32_t sclHz)
+{
+    // Same rounding as I2CMasterInitExpClk()
+    return (sysClk + SCL_CLKS * sclHz - 1) / (SCL_CLKS * sclHz) - 1;
+}
+
+uint64_t i2cModelBitNs(unsigned ch)
+{
+    uint32_t tpr = *hal_raw(g_base[ch] + I2C_O_MTPR) & 0x7F;
+    return (1 + tpr) * SCL_CLKS * SIM_NS_PER_S / SIM_CPU_HZ;
+}
+
+static bool faultNow(t_pcfModel *p)
+{
+    if (!p->fault || !p->faultRate) return false;
+    g_faultSeed = g_faultSeed * 1103515245 + 12345;
+    return (g_faultSeed >> 16) % 1000 < p->faultRate;
+}
+
+void (*g_i2cPcfWriteHook)(unsigned ch, unsigned addr, uint8_t value);
+
+// arg = ch << 16 | addr << 8 | value
+static void pcfWritten(void *arg)
+{
+    uintptr_t a = (uintptr_t)arg;
+    g_i2cPcfWriteHook(a >> 16, (a >> 8) & 0xFF, a & 0xFF);
+}
+
+static void i2cDone(void *arg)
+{
+    unsigned ch = (uintptr_t)arg;
+    t_i2cModel *m = &g_i2c[ch];
+    m->doneAt = 0;
+    *hal_raw(g_base[ch] + I2C_O_MCS) = m->result;
+    *hal_raw(g_base[ch] + I2C_O_MDR) = m->resultData;
+    *hal_raw(g_base[ch] + I2C_O_MRIS) = 1;
+    if (*hal_raw(g_base[ch] + I2C_O_MIMR)) {
+        hal_irq_pend(g_intNo[ch]);
+    }
+}
+
+void i2cModelCommand(unsigned ch, uint32_t cmd)
+{
+    t_i2cModel *m = &g_i2c[ch];
+    uint32_t msa = *hal_raw(g_base[ch] + I2C_O_MSA);
+    unsigned addr = msa >> 1;
+    bool read = msa & 1;
+    unsigned bits = 9;      // data byte + ACK
+    uint64_t extraNs = 0;
+    bool written = false;
+    t_pcfModel *p = pcfAt(ch, addr);
+    if (m->doneAt) {
+        hal_fatal("I2C%u: MCS written while busy", ch);
+    }
+    m->result = 0;
+    m->resultData = *hal_raw(g_base[ch] + I2C_O_MDR);
+    if (cmd & I2C_MCS_START) {
+        bits += 1 + 9;      // (repeated) START, address byte + ACK
+        m->nack = !p || p->absent;
+        m->open = true;
+    } else if (!m->open) {
+        hal_fatal("I2C%u: RUN without START on an idle bus", ch);
+    }
+    t_i2cFault fault = p && !m->nack && faultNow(p) ? p->fault : I2C_FAULT_NONE;
+    if (fault == I2C_FAULT_NACK) {
+        m->nack = true;
+    }
+    if (fault == I2C_FAULT_ARBLST) {
+        // Another master wins somewhere in the address byte, the bus is
+        // released without a STOP from this master
+        bits = 1 + 1 + g_faultSeed % 8;
+        m->result |= I2C_MCS_ERROR | I2C_MCS_ARBLST;
+        m->open = false;
+    } else if (m->nack) {
+        // The master stops after the address byte
+        bits -= 9;
+        m->result |= I2C_MCS_ERROR | I2C_MCS_ADRACK;
+    } else if (fault == I2C_FAULT_CLKTO) {
+        // The slave holds SCL low until the clock low timeout of MCLKOCNT
+        // expires (CNTL is the upper 8 bits of a 12 bit SCL period count)
+        uint32_t cntl = *hal_raw(g_base[ch] + I2C_O_MCLKOCNT) & 0xFF;
+        if (!cntl) hal_fatal("I2C%u: SCL held low with the clock timeout disabled", ch);
+        extraNs = (uint64_t)cntl * 16 * i2cModelBitNs(ch);
+        m->result |= I2C_MCS_ERROR | I2C_MCS_CLKTO;
+    } else if (read) {
+        // Quasi-bidirectional port: a pin reads low if pulled low from
+        // outside or by its own output latch
+        m->resultData = p->input & p->latch;
+    } else {
+        p->latch = m->resultData;
+        written = true;
+    }
+    if ((cmd & I2C_MCS_STOP) && m->open) {
+        bits += 1;
+        m->open = false;
+    }
+    m->result |= m->open ? I2C_MCS_BUSBSY : I2C_MCS_IDLE;
+    uint64_t t = bits * i2cModelBitNs(ch) + extraNs;
+    m->doneAt = g_simNow + t;
+    if (written && g_i2cPcfWriteHook) {
+        // The PCF drives its pins after the ACK of the data byte, before the STOP
+        uint64_t tPins = m->doneAt - (m->open ? 0 : i2cModelBitNs(ch));
+        simAt(tPins, pcfWritten, (void *)(uintptr_t)(ch << 16 | addr << 8 | m->resultData));
+    }
+
+    t_i2cBusStats *s = &m->stats;
+    if (m->scanStart) {
+        m->scanNs = m->doneAt - m->scanStart;
+    }
+    s->busyNs += t;
+    s->nTransfers++;
+    if (m->result & I2C_MCS_ERROR) s->nErrors++;
+    if (p) {
+        p->stats.nTransfers++;
+        p->stats.lastAccess = g_simNow;
+        if (m->result & I2C_MCS_ERROR) p->stats.nErrors++;
+    }
+
+    *hal_raw(g_base[ch] + I2C_O_MCS) = I2C_MCS_BUSY | I2C_MCS_BUSBSY;
+    simAt(m->doneAt, i2cDone, (void *)(uintptr_t)ch);
+}
+
+void i2cModelScanStart(unsigned ch)
+{
+    t_i2cModel *m = &g_i2c[ch];
+    t_i2cBusStats *s = &m->stats;
+    if (m->scanStart) {
+        s->scanSumNs += m->scanNs;
+        if (m->scanNs > s->scanMaxNs) s->scanMaxNs = m->scanNs;
+        s->nScans++;
+    }
+    m->scanStart = g_simNow;
+    m->scanNs = 0;
+}
+
+void i2cModelWaitIdle(unsigned ch)
+{
+    while (g_i2c[ch].doneAt) {
+        simStep();
+    }
+}
+
+bool i2cModelBusy(unsigned ch)
+{
+    return g_i2c[ch].doneAt != 0;
+}
+
+void i2cModelSetInput(unsigned ch, unsigned addr, unsigned pin, bool closed)
+{
+    t_pcfModel *p = pcfAt(ch, addr);
+    if (!p || pin > 7) hal_fatal("i2cModelSetInput(): no pin %u.%02x.%u", ch, addr, pin);
+    if (closed) {
+        p->input &= ~(1 << pin);
+    } else {
+        p->input |= 1 << pin;
+    }
+}
+
+bool i2cModelGetInput(unsigned ch, unsigned addr, unsigned pin)
+{
+    t_pcfModel *p = pcfAt(ch, addr);
+    return p && pin < 8 && !(p->input & (1 << pin));
+}
+
+uint8_t i2cModelGetOutput(unsigned ch, unsigned addr)
+{
+    t_pcfModel *p = pcfAt(ch, addr);
+    return p ? p->latch : 0xFF;
+}
+
+void i2cModelSetPresent(unsigned ch, unsigned addr, bool present)
+{
+    pcfCheck(ch, addr, "i2cModelSetPresent()")->absent = !present;
+}
+
+void i2cModelSetFault(unsigned ch, unsigned addr, t_i2cFault fault, unsigned perMille)
+{
+    t_pcfModel *p = pcfCheck(ch, addr, "i2cModelSetFault()");
+    p->fault = fault;
+    p->faultRate = perMille;
+}
+
+void i2cModelBusStats(unsigned ch, t_i2cBusStats *s)
+{
+    *s = g_i2c[ch].stats;
+}
+
+void i2cModelPcfStats(unsigned ch, unsigned addr, t_i2cPcfStats *s)
+{
+    *s = pcfCheck(ch, addr, "i2cModelPcfStats()")->stats;
+}
+
+void i2cModelResetStats()
+{
+    for (unsigned ch = 0; ch < 4; ch++) {
+        memset(&g_i2c[ch].stats, 0, sizeof(g_i2c[ch].stats));
+        for (unsigned i = 0; i < 8; i++) {
+            memset(&g_i2c[ch].pcf[i].stats, 0, sizeof(t_i2cPcfStats));
+        }
+    }
+}
@@ -0,0 +1,108 @@
+// Event queue of the simulated time base, see sim.h
+#include <stdio.h>
+#include <stdlib.h>
+#include "hal.h"
+#include "sim.h"
+
+// Binary min heap, ordered by time, then by sequence number
+typedef struct {
+    uint64_t t;
+    uint64_t seq;
+    t_simFunc f;
+    void *arg;
+} t_simEvent;
+
+#define SIM_MAX_EVENTS 1024
+
+uint64_t g_simNow = 0;
+void (*g_simLockHook)(bool locked) = NULL;
+static t_simEvent g_simHeap[SIM_MAX_EVENTS];
+static unsigned g_simLen = 0;
+static uint64_t g_simSeq = 0;
+
+static bool simBefore(const t_simEvent *a, const t_simEvent *b)
+{
+    return a->t < b->t || (a->t == b->t && a->seq < b->seq);
+}
+
+void simAt(uint64_t t, t_simFunc f, void *arg)
+{
+    simLock();
+    unsigned i = g_simLen;
+    if (g_simLen >= SIM_MAX_EVENTS) {
+        hal_fatal("simAt(): more than %d pending events", SIM_MAX_EVENTS);
+    }
+    if (t < g_simNow) t = g_simNow;
+    t_simEvent e = {t, g_simSeq++, f, arg};
+    g_simLen++;
+    while (i > 0 && simBefore(&e, &g_simHeap[(i - 1) / 2])) {
+        g_simHeap[i] = g_simHeap[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    g_simHeap[i] = e;
+    simUnlock();
+}
+
+uint64_t simNext()
+{
+    simLock();
+    uint64_t t = g_simLen ? g_simHeap[0].t : SIM_NEVER;
+    simUnlock();
+    return t;
+}
+
+static t_simEvent simPop()
+{
+    t_simEvent top = g_simHeap[0];
+    t_simEvent last = g_simHeap[--g_simLen];
+    unsigned i = 0, c;
+    while ((c = 2 * i + 1) < g_simLen) {
+        if (c + 1 < g_simLen && simBefore(&g_simHeap[c + 1], &g_simHeap[c])) c++;
+        if (!simBefore(&g_simHeap[c], &last)) break;
+        g_simHeap[i] = g_simHeap[c];
+        i = c;
+    }
+    g_simHeap[i] = last;
+    return top;
+}
+
+bool simStep()
+{
+    simLock();
+    if (!g_simLen) {
+        simUnlock();
+        return false;
+    }
+    hal_sync();
+    t_simEvent e = simPop();
+    g_simNow = e.t;
+    e.f(e.arg);
+    hal_sync();
+    simUnlock();
+    return true;
+}
+
+void simRunUntil(uint64_t t)
+{
+    simLock();
+    while (g_simLen && g_simHeap[0].t <= t) {
+        simStep();
+    }
+    if (t > g_simNow) g_simNow = t;
+    simUnlock();
+}
+
+void simMatchFeed(t_simMatch *m, const uint8_t *data, uint32_t len)
+{
+    for (uint32_t i = 0; i < len; i++) {
+        if (data[i] == (uint8_t)m->pattern[m->pos]) {
+            m->pos++;
+        } else {
+            m->pos = data[i] == (uint8_t)m->pattern[0];
+        }
+        if (!m->pattern[m->pos]) {
+            m->n++;
+            m->pos = 0;
+        }
+    }
+}
@@ -0,0 +1,142 @@
+// Simulated time base and the peripheral models behind the HAL shim.
+// Firmware code runs in zero simulated time. Time only advances in
+// ROM_SysCtlDelay(), in busy-waits on a peripheral and when all tasks are
+// blocked, by running the pending events in order.
+#ifndef SIM_H_
+#define SIM_H_
+#include <stdint.h>
+#include <stdbool.h>
+
+// Simulated time
+#define SIM_NS_PER_US   1000ULL
+#define SIM_NS_PER_MS   1000000ULL
+#define SIM_NS_PER_S    1000000000ULL
+#define SIM_NEVER       UINT64_MAX
+// Simulated CPU clock, for the cycle counters
+#define SIM_CPU_HZ      80000000ULL
+#define SIM_NS_TO_CYCLES(t) ((t) * (SIM_CPU_HZ / 1000000) / 1000)
+
+typedef void (*t_simFunc)(void *arg);
+
+// Current simulated time [ns]
+extern uint64_t g_simNow;
+
+// Run f(arg) at the simulated time t [ns] (events at the same time run in
+// the order they have been added)
+void simAt(uint64_t t, t_simFunc f, void *arg);
+// Time of the next event, SIM_NEVER if there is none
+uint64_t simNext();
+// Run the next event, returns false if there is none
+bool simStep();
+// Run all events up to and including time t, then set the time to t
+void simRunUntil(uint64_t t);
+
+// Counts a pattern in a byte stream, which may be split anywhere.
+// The first character of the pattern must not occur in the rest of it.
+typedef struct {
+    const char *pattern;
+    unsigned pos;       // characters matched so far
+    unsigned n;         // matches
+} t_simMatch;
+
+void simMatchFeed(t_simMatch *m, const uint8_t *data, uint32_t len);
+
+// Serializes the models and the simulated interrupts when the tasks run on
+// a preemptive scheduler (host/soak). Calls nest. host/rtos needs none.
+extern void (*g_simLockHook)(bool locked);
+
+static inline void simLock(void)
+{
+    if (g_simLockHook) g_simLockHook(true);
+}
+
+static inline void simUnlock(void)
+{
+    if (g_simLockHook) g_simLockHook(false);
+}
+
+//--------------
+// Peripheral models
+//--------------
+// I2C master + PCF8574 devices (sim/i2c.c)
+typedef enum {
+    I2C_FAULT_NONE,
+    I2C_FAULT_NACK,     // the PCF does not acknowledge its address
+    I2C_FAULT_ARBLST,   // another master wins the arbitration
+    I2C_FAULT_CLKTO     // the PCF holds SCL low until the clock timeout
+} t_i2cFault;
+
+typedef struct {
+    uint64_t busyNs;        // time the bus has been driven by the master
+    uint64_t scanSumNs;     // trigger until the last transaction of the scan is done
+    uint64_t scanMaxNs;
+    uint32_t nScans;        // finished scans
+    uint32_t nTransfers;
+    uint32_t nErrors;       // transactions which ended with MCS ERROR
+} t_i2cBusStats;
+
+typedef struct {
+    uint32_t nTransfers;
+    uint32_t nErrors;
+    uint64_t lastAccess;    // start of the last transaction
+} t_i2cPcfStats;
+
+void i2cModelCommand(unsigned ch, uint32_t cmd);
+// The interrupt of a channel has been triggered by software to start a scan
+void i2cModelScanStart(unsigned ch);
+void i2cModelWaitIdle(unsigned ch);
+bool i2cModelBusy(unsigned ch);
+void i2cModelSetInput(unsigned ch, unsigned addr, unsigned pin, bool closed);
+bool i2cModelGetInput(unsigned ch, unsigned addr, unsigned pin);
+// Last byte written to a PCF, its output latch
+uint8_t i2cModelGetOutput(unsigned ch, unsigned addr);
+void i2cModelInit(unsigned ch);
+// MTPR value for an SCL frequency, rounded like I2CMasterInitExpClk()
+uint32_t i2cModelTpr(uint32_t sysClk, uint32_t sclHz);
+// SCL period set by MTPR [ns]
+uint64_t i2cModelBitNs(unsigned ch);
+// An absent PCF does not acknowledge its address (all are present by default)
+void i2cModelSetPresent(unsigned ch, unsigned addr, bool present);
+// Inject a fault into perMille / 1000 of the transactions with a PCF
+void i2cModelSetFault(unsigned ch, unsigned addr, t_i2cFault fault, unsigned perMille);
+void i2cModelBusStats(unsigned ch, t_i2cBusStats *s);
+void i2cModelPcfStats(unsigned ch, unsigned addr, t_i2cPcfStats *s);
+void i2cModelResetStats();
+// Called when a byte written to a PCF appears on its pins
+extern void (*g_i2cPcfWriteHook)(unsigned ch, unsigned addr, uint8_t value);
+
+// SSI + uDMA (sim/ssi.c)
+// One uDMA transfer to an SSI as it went out on the wire, MSB first. The
+// line is low between transfers.
+typedef struct {
+    unsigned ssi;       // 1 - 3
+    uint64_t tStart;    // first bit [ns]
+    uint32_t bitNs;
+    uint16_t *words;    // as read by the uDMA when it was enabled
+    uint32_t nWords;
+    bool modified;      // the source buffer changed before the transfer was done
+} t_ssiTransfer;
+
+// Called for every finished transfer (the last words may still be in the FIFO)
+extern void (*g_ssiWireHook)(const t_ssiTransfer *t);
+
+// Bit rate from the clock divider SSIConfigSetExpClk() would pick
+void ssiModelConfig(uint32_t base, uint32_t sysClk, uint32_t bitRate);
+uint32_t ssiModelBitNs(uint32_t base);
+void ssiModelControlSet(unsigned dmaCh, uint32_t control);
+void ssiModelTransferSet(unsigned dmaCh, void *src, uint32_t nItems);
+void ssiModelEnable(unsigned dmaCh);
+bool ssiModelIsEnabled(unsigned dmaCh);
+
+// USB device (sim/usb.c)
+// Data from the simulated host to the firmware, sent as one or more packets
+void usbHostWrite(const uint8_t *data, uint32_t len);
+// Bytes written by usbHostWrite() which have not been received yet
+uint32_t usbHostPending();
+// Called for every packet sent by the firmware to the host
+extern void (*g_usbTxSink)(const uint8_t *data, uint32_t len);
+// Largest packet from the host [bytes]
+extern uint32_t g_usbRxPacketMax;
+void usbIntHandler(void);
+
+#endif /* SIM_H_ */
@@ -0,0 +1,135 @@
+// SSI1-3 + uDMA model behind the HAL shim. A uDMA transfer streams 16 bit
+// words out of the SSI at its bit rate. The uDMA done interrupt fires once
+// the last word has moved into the 8 word deep TX FIFO, so the next transfer
+// started from spiISR() continues the bit stream without a gap.
+// The bit rate follows the clock divider picked by SSIConfigSetExpClk(), so
+// it can be above the requested one (3.2 MHz --> 80 MHz / 24 = 3.33 MHz).
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include "hal.h"
+#include "sim.h"
+
+#define SSI_FIFO_WORDS  8
+#define SSI_WORD_BITS   16
+
+typedef struct {
+    uint32_t bitNs;     // 0 = not configured
+    uint32_t control;   // UDMA_SRC_INC_*
+    const uint16_t *src;
+    uint32_t nItems;
+    bool enabled;
+    uint64_t wireEnd;   // last bit of the queued words leaves the SSI
+    t_ssiTransfer xfer; // running transfer, words as read at uDMA enable
+    uint32_t wordsLen;  // allocated
+} t_ssiModel;
+
+// Indexed by SSI 1 - 3
+static t_ssiModel g_ssi[3];
+
+static const uint8_t g_ssiInt[3] = {INT_SSI1, INT_SSI2, INT_SSI3};
+
+static unsigned ssiFromBase(uint32_t base)
+{
+    switch (base) {
+    case SSI1_BASE: return 0;
+    case SSI2_BASE: return 1;
+    case SSI3_BASE: return 2;
+    }
+    hal_fatal("no SSI model at 0x%08x", base);
+}
+
+// uDMA channel 11 / 13 / 15 serves SSI1 / 2 / 3 TX
+static t_ssiModel *ssiFromDma(unsigned dmaCh)
+{
+    switch (dmaCh) {
+    case UDMA_CH11_SSI1TX: return &g_ssi[0];
+    case UDMA_CH13_SSI2TX: return &g_ssi[1];
+    case UDMA_CH15_SSI3TX: return &g_ssi[2];
+    }
+    hal_fatal("no SSI on uDMA channel %u", dmaCh);
+}
+
+void (*g_ssiWireHook)(const t_ssiTransfer *t);
+
+void ssiModelConfig(uint32_t base, uint32_t sysClk, uint32_t bitRate)
+{
+    // Same divider as SSIConfigSetExpClk(): even prescaler, serial clock rate
+    uint32_t maxDiv = sysClk / bitRate, preDiv = 0, scr;
+    do {
+        preDiv += 2;
+        scr = maxDiv / preDiv - 1;
+    } while (scr > 255);
+    g_ssi[ssiFromBase(base)].bitNs = (uint64_t)preDiv * (1 + scr) * SIM_NS_PER_S / sysClk;
+}
+
+uint32_t ssiModelBitNs(uint32_t base)
+{
+    return g_ssi[ssiFromBase(base)].bitNs;
+}
+
+void ssiModelControlSet(unsigned dmaCh, uint32_t control)
+{
+    ssiFromDma(dmaCh)->control = control;
+}
+
+void ssiModelTransferSet(unsigned dmaCh, void *src, uint32_t nItems)
+{
+    t_ssiModel *s = ssiFromDma(dmaCh);
+    s->src = src;
+    s->nItems = nItems;
+}
+
+static bool srcIncNone(const t_ssiModel *s)
+{
+    return (s->control & UDMA_SRC_INC_NONE) == UDMA_SRC_INC_NONE;
+}
+
+static void ssiDmaDone(void *arg)
+{
+    t_ssiModel *s = arg;
+    t_ssiTransfer *x = &s->xfer;
+    s->enabled = false;
+    if (g_ssiWireHook) {
+        // The firmware must not touch a buffer while the uDMA reads it
+        for (uint32_t i = 0; i < x->nWords; i++) {
+            x->modified |= x->words[i] != s->src[srcIncNone(s) ? 0 : i];
+        }
+        g_ssiWireHook(x);
+    }
+    hal_irq_pend(g_ssiInt[s - g_ssi]);
+}
+
+void ssiModelEnable(unsigned dmaCh)
+{
+    t_ssiModel *s = ssiFromDma(dmaCh);
+    if (s->enabled) hal_fatal("uDMA channel %u enabled twice", dmaCh);
+    if (!s->bitNs) hal_fatal("SSI of uDMA channel %u not configured", dmaCh);
+    uint64_t wordNs = (uint64_t)SSI_WORD_BITS * s->bitNs;
+    uint64_t start = s->wireEnd > g_simNow ? s->wireEnd : g_simNow;
+    if (g_ssiWireHook) {
+        t_ssiTransfer *x = &s->xfer;
+        if (s->nItems > s->wordsLen) {
+            s->wordsLen = s->nItems;
+            x->words = realloc(x->words, s->wordsLen * sizeof(uint16_t));
+        }
+        for (uint32_t i = 0; i < s->nItems; i++) {
+            x->words[i] = s->src[srcIncNone(s) ? 0 : i];
+        }
+        x->ssi = 1 + (s - g_ssi);
+        x->tStart = start;
+        x->bitNs = s->bitNs;
+        x->nWords = s->nItems;
+        x->modified = false;
+    }
+    s->wireEnd = start + s->nItems * wordNs;
+    s->enabled = true;
+    // The FIFO takes the last words before they are on the wire
+    uint64_t done = s->wireEnd - (s->nItems < SSI_FIFO_WORDS ? s->nItems : SSI_FIFO_WORDS) * wordNs;
+    simAt(done, ssiDmaDone, s);
+}
+
+bool ssiModelIsEnabled(unsigned dmaCh)
+{
+    return ssiFromDma(dmaCh)->enabled;
+}
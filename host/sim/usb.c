@@ -0,0 +1,270 @@
+// USB CDC device model: the usblib buffer API on top of the TivaWare ring
+// buffer layout and a full speed bulk pipe, which moves one packet of up to
+// 64 bytes per USB_PACKET_NS from the USB interrupt.
+#include <stdio.h>
+#include <stdlib.h>
+#include "hal.h"
+#include "sim.h"
+#include "usb_serial_structs.h"
+
+#define USB_PACKET_LEN  64
+#define USB_PACKET_NS   (64 * SIM_NS_PER_US)
+
+void (*g_usbTxSink)(const uint8_t *data, uint32_t len) = NULL;
+uint32_t g_usbRxPacketMax = USB_PACKET_LEN;
+
+// Host writes, a packet never spans two of them
+typedef struct t_usbChunk {
+    uint8_t *data;
+    uint32_t len, pos;
+    struct t_usbChunk *next;
+} t_usbChunk;
+
+static t_usbChunk *g_rxHead = NULL, *g_rxTail = NULL;
+static uint32_t g_rxPending = 0;
+static bool g_connectPending = false;
+static bool g_pumpScheduled = false;
+static uint64_t g_nextPacket = 0;
+
+//*****************************************************************************
+// usblib ring buffers
+//*****************************************************************************
+static uint32_t ringUsed(const tUSBRingBufObject *r)
+{
+    return (r->ui32WriteIndex + r->ui32Size - r->ui32ReadIndex) % r->ui32Size;
+}
+
+uint32_t USBRingBufContigUsed(tUSBRingBufObject *psRingBuf)
+{
+    uint32_t w = psRingBuf->ui32WriteIndex, r = psRingBuf->ui32ReadIndex;
+    return w >= r ? w - r : psRingBuf->ui32Size - r;
+}
+
+const tUSBBuffer *USBBufferInit(tUSBBuffer *psBuffer)
+{
+    tUSBRingBufObject *r = &psBuffer->sPrivateData;
+    r->pui8Buf = psBuffer->pui8Buffer;
+    r->ui32Size = psBuffer->ui32BufferSize;
+    r->ui32ReadIndex = r->ui32WriteIndex = 0;
+    return psBuffer;
+}
+
+void USBBufferFlush(const tUSBBuffer *psBuffer)
+{
+    tUSBRingBufObject *r = (tUSBRingBufObject *)&psBuffer->sPrivateData;
+    r->ui32ReadIndex = r->ui32WriteIndex;
+}
+
+uint32_t USBBufferDataAvailable(const tUSBBuffer *psBuffer)
+{
+    return ringUsed(&psBuffer->sPrivateData);
+}
+
+uint32_t USBBufferSpaceAvailable(const tUSBBuffer *psBuffer)
+{
+    return psBuffer->sPrivateData.ui32Size - 1 - ringUsed(&psBuffer->sPrivateData);
+}
+
+void USBBufferInfoGet(const tUSBBuffer *psBuffer, tUSBRingBufObject *psRingBuf)
+{
+    *psRingBuf = psBuffer->sPrivateData;
+}
+
+static void usbSchedule();
+
+uint32_t USBBufferRead(const tUSBBuffer *psBuffer, uint8_t *pui8Data, uint32_t ui32Length)
+{
+    tUSBRingBufObject *r = (tUSBRingBufObject *)&psBuffer->sPrivateData;
+    uint32_t n = ringUsed(r);
+    if (n > ui32Length) n = ui32Length;
+    for (uint32_t i = 0; i < n; i++) {
+        pui8Data[i] = r->pui8Buf[r->ui32ReadIndex];
+        r->ui32ReadIndex = (r->ui32ReadIndex + 1) % r->ui32Size;
+    }
+    usbSchedule();
+    return n;
+}
+
+uint32_t USBBufferWrite(const tUSBBuffer *psBuffer, const uint8_t *pui8Data, uint32_t ui32Length)
+{
+    tUSBRingBufObject *r = (tUSBRingBufObject *)&psBuffer->sPrivateData;
+    uint32_t n = USBBufferSpaceAvailable(psBuffer);
+    if (n > ui32Length) n = ui32Length;
+    for (uint32_t i = 0; i < n; i++) {
+        r->pui8Buf[r->ui32WriteIndex] = pui8Data[i];
+        r->ui32WriteIndex = (r->ui32WriteIndex + 1) % r->ui32Size;
+    }
+    usbSchedule();
+    return n;
+}
+
+void USBBufferDataRemoved(const tUSBBuffer *psBuffer, uint32_t ui32Length)
+{
+    tUSBRingBufObject *r = (tUSBRingBufObject *)&psBuffer->sPrivateData;
+    if (ui32Length > ringUsed(r)) hal_fatal("USBBufferDataRemoved(): more than available");
+    r->ui32ReadIndex = (r->ui32ReadIndex + ui32Length) % r->ui32Size;
+    usbSchedule();
+}
+
+uint32_t USBBufferEventCallback(void *pvCBData, uint32_t ui32Event,
+                                uint32_t ui32MsgValue, void *pvMsgData)
+{
+    (void)pvCBData;
+    (void)ui32Event;
+    (void)ui32MsgValue;
+    (void)pvMsgData;
+    return 0;
+}
+
+// Only referenced from the tUSBBuffer structs, the model moves the packets
+uint32_t USBDCDCPacketRead(void *pvHandle, uint8_t *pi8Data, uint32_t ui32Length, bool bLast)
+{
+    (void)pvHandle;
+    (void)pi8Data;
+    (void)ui32Length;
+    (void)bLast;
+    return 0;
+}
+
+uint32_t USBDCDCPacketWrite(void *pvHandle, uint8_t *pi8Data, uint32_t ui32Length, bool bLast)
+{
+    (void)pvHandle;
+    (void)pi8Data;
+    (void)ui32Length;
+    (void)bLast;
+    return 0;
+}
+
+uint32_t USBDCDCRxPacketAvailable(void *pvHandle)
+{
+    (void)pvHandle;
+    return 0;
+}
+
+uint32_t USBDCDCTxPacketAvailable(void *pvHandle)
+{
+    (void)pvHandle;
+    return USB_PACKET_LEN;
+}
+
+void USBStackModeSet(uint32_t ui32Index, uint32_t iUSBMode, void *pfnCallback)
+{
+    (void)ui32Index;
+    (void)iUSBMode;
+    (void)pfnCallback;
+}
+
+// The host enumerates the device right away
+void *USBDCDCInit(uint32_t ui32Index, tUSBDCDCDevice *psCDCDevice)
+{
+    (void)ui32Index;
+    g_connectPending = true;
+    ROM_IntEnable(INT_USB0);
+    usbSchedule();
+    return psCDCDevice;
+}
+
+//*****************************************************************************
+// Bulk pipe
+//*****************************************************************************
+// Length of the next packet from the host, 0 = none
+static uint32_t rxPacketLen()
+{
+    if (!g_rxHead) return 0;
+    uint32_t n = g_rxHead->len - g_rxHead->pos;
+    uint32_t max = g_usbRxPacketMax < USB_PACKET_LEN ? g_usbRxPacketMax : USB_PACKET_LEN;
+    return n < max ? n : max;
+}
+
+static bool usbWork()
+{
+    uint32_t n = rxPacketLen();
+    return g_connectPending || (n && USBBufferSpaceAvailable(&g_sRxBuffer) >= n) ||
+           USBBufferDataAvailable(&g_sTxBuffer);
+}
+
+static void usbPump(void *arg)
+{
+    (void)arg;
+    g_pumpScheduled = false;
+    g_nextPacket = g_simNow + USB_PACKET_NS;
+    hal_irq_pend(INT_USB0);
+}
+
+static void usbSchedule()
+{
+    simLock();
+    if (!g_pumpScheduled && usbWork()) {
+        g_pumpScheduled = true;
+        simAt(g_nextPacket, usbPump, NULL);
+    }
+    simUnlock();
+}
+
+// One packet per interrupt. The host polls both endpoints, so when both
+// directions have data the packets alternate.
+void usbIntHandler(void)
+{
+    static bool lastWasRx = false;
+    uint32_t n = rxPacketLen();
+    bool rx = n && USBBufferSpaceAvailable(&g_sRxBuffer) >= n;
+    bool tx = USBBufferDataAvailable(&g_sTxBuffer);
+    if (g_connectPending) {
+        g_connectPending = false;
+        g_sCDCDevice.pfnControlCallback(g_sCDCDevice.pvControlCBData, USB_EVENT_CONNECTED, 0, NULL);
+    } else if (rx && !(tx && lastWasRx)) {
+        lastWasRx = true;
+        tUSBRingBufObject *r = &g_sRxBuffer.sPrivateData;
+        for (uint32_t i = 0; i < n; i++) {
+            r->pui8Buf[r->ui32WriteIndex] = g_rxHead->data[g_rxHead->pos++];
+            r->ui32WriteIndex = (r->ui32WriteIndex + 1) % r->ui32Size;
+        }
+        g_rxPending -= n;
+        if (g_rxHead->pos >= g_rxHead->len) {
+            t_usbChunk *c = g_rxHead;
+            g_rxHead = c->next;
+            if (!g_rxHead) g_rxTail = NULL;
+            free(c->data);
+            free(c);
+        }
+        g_sRxBuffer.pfnCallback(g_sRxBuffer.pvCBData, USB_EVENT_RX_AVAILABLE, n, NULL);
+    } else if (tx) {
+        uint8_t packet[USB_PACKET_LEN];
+        lastWasRx = false;
+        tUSBRingBufObject *r = &g_sTxBuffer.sPrivateData;
+        n = 0;
+        while (n < USB_PACKET_LEN && ringUsed(r)) {
+            packet[n++] = r->pui8Buf[r->ui32ReadIndex];
+            r->ui32ReadIndex = (r->ui32ReadIndex + 1) % r->ui32Size;
+        }
+        if (g_usbTxSink) g_usbTxSink(packet, n);
+        g_sTxBuffer.pfnCallback(g_sTxBuffer.pvCBData, USB_EVENT_TX_COMPLETE, n, NULL);
+    }
+    usbSchedule();
+}
+
+void usbHostWrite(const uint8_t *data, uint32_t len)
+{
+    if (!len) return;
+    t_usbChunk *c = malloc(sizeof(*c));
+    if (!c || !(c->data = malloc(len))) hal_fatal("usbHostWrite(): out of host memory");
+    memcpy(c->data, data, len);
+    c->len = len;
+    c->pos = 0;
+    c->next = NULL;
+    simLock();
+    if (g_rxTail) {
+        g_rxTail->next = c;
+    } else {
+        g_rxHead = c;
+    }
+    g_rxTail = c;
+    g_rxPending += len;
+    usbSchedule();
+    simUnlock();
+}
+
+uint32_t usbHostPending()
+{
+    return g_rxPending;
+}
@@ -0,0 +1,35 @@
+// FreeRTOSConfig.h of the target (drivers/) with what the FreeRTOS POSIX
+// port and the soak test need on top, see soak.c
+#ifndef SOAK_FREERTOS_CONFIG_H
+#define SOAK_FREERTOS_CONFIG_H
+
+#include "../../drivers/FreeRTOSConfig.h"
+
+// The firmware gets the heap of the target. soak.c defines a larger one and
+// keeps the rest for the simulation task.
+enum { SOAK_FIRMWARE_HEAP_SIZE = configTOTAL_HEAP_SIZE };
+#undef configTOTAL_HEAP_SIZE
+#define configTOTAL_HEAP_SIZE           ( ( size_t ) ( SOAK_FIRMWARE_HEAP_SIZE + 2048 ) )
+#define configAPPLICATION_ALLOCATED_HEAP 1
+
+// The simulated peripherals run from the idle task when all tasks are blocked
+#undef configUSE_IDLE_HOOK
+#define configUSE_IDLE_HOOK             1
+// A task of the POSIX port runs on a pthread stack, the FreeRTOS stack
+// pointer never moves
+#undef configCHECK_FOR_STACK_OVERFLOW
+#define configCHECK_FOR_STACK_OVERFLOW  0
+#define INCLUDE_xTaskGetSchedulerState  1
+
+// Report and end the test instead of hanging in taskDISABLE_INTERRUPTS()
+void soakAssert(const char *file, int line);
+#undef configASSERT
+#define configASSERT(x)     if( ( x ) == 0 ) { soakAssert( __FILE__, __LINE__ ); }
+
+// Time a task waits in the ready state before it runs
+void soakTaskReady(void *tcb);
+void soakTaskSwitchedIn(void *tcb);
+#define traceMOVED_TASK_TO_READY_STATE( pxTCB )     soakTaskReady( pxTCB )
+#define traceTASK_SWITCHED_IN()                     soakTaskSwitchedIn( pxCurrentTCB )
+
+#endif /* SOAK_FREERTOS_CONFIG_H */
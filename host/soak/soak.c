@@ -0,0 +1,371 @@
+// Soak and load test of the firmware on the FreeRTOS POSIX port, see
+// "Host build" in README.md
+//
+// main.c's tasks run on the real kernel: preemptive, time sliced at the
+// 1 ms tick, with heap_4 on the 7000 byte heap of the target. The models of
+// host/sim run in real time, from the idle task and from a "Sim" task which
+// preempts the firmware at every tick. Their interrupts (i2c_isr(),
+// spiISR(), the USB RxHandler()) run on the thread of the task they
+// interrupted, while the models are locked (g_simLockHook).
+//
+//   soak [-t s] [-r s] [-f fps] [-l nLeds] [-s toggles/s] [-q]
+//
+// The load generator sends LED frames to all 3 channels, toggles random
+// switch matrix and PCF inputs with a burst every 10 s, keeps 16 quick
+// rules firing and polls SW?. Every report interval one line goes to stdout
+// and PRF 1 is sent (its table goes to the DEBUG port on stderr).
+//
+// Reported are the 1 ms loop overruns of task_pcf_io(), the lowest free
+// heap and the longest time each task was ready but not running, i.e. waited
+// for a task of the same or a higher priority. A failed configASSERT() (the
+// malloc failed hook of main.c) ends the test with the heap state.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include "hal.h"
+#include "sim.h"
+#include "FreeRTOS.h"
+#include "task.h"
+#include "i2c_inout.h"
+#include "mySpi.h"
+#include "profiler.h"
+#include "utils/uartstdio.h"
+
+int firmware_main(void);
+
+#define SOAK_SIM_STACK      (configMINIMAL_STACK_SIZE * 4)
+#define SOAK_SIM_PRIORITY   (configMAX_PRIORITIES - 2)
+#define SOAK_IDLE_SLEEP_NS  (50 * SIM_NS_PER_US)
+#define T_SETUP             (1500 * SIM_NS_PER_MS)
+#define T_LOAD              (2 * SIM_NS_PER_S)
+#define USB_BACKLOG_MAX     (16 * 1024)     // LED frames are skipped above
+#define N_RULES             16
+#define N_TASKS             8
+#define BURST_PERIOD        (10 * SIM_NS_PER_S)
+#define BURST_LEN           (500 * SIM_NS_PER_MS)
+#define BURST_FACTOR        10
+
+// The firmware's heap, see FreeRTOSConfig.h
+uint8_t ucHeap[configTOTAL_HEAP_SIZE] __attribute__((aligned(portBYTE_ALIGNMENT)));
+
+static struct {
+    unsigned duration;      // [s]
+    unsigned report;        // [s]
+    unsigned fps;
+    unsigned nLeds;         // per channel
+    unsigned toggles;       // per s
+    bool quiet;
+} g_cfg = {3600, 10, 50, 512, 2000, false};
+
+static uint64_t g_t0;       // host time at simulated time 0
+static TaskHandle_t g_hSim;
+
+static uint64_t soakNow()
+{
+    return hal_host_ns() - g_t0;
+}
+
+//*****************************************************************************
+// Locking and the simulated interrupts
+//*****************************************************************************
+static unsigned g_lockNesting;
+static bool g_yieldPending;
+
+// A critical section masks the tick signal of the POSIX port, so no task
+// switch happens in the middle of a model or of a firmware ISR
+static void soakLock(bool locked)
+{
+    if (xTaskGetSchedulerState() != taskSCHEDULER_RUNNING) return;
+    if (locked) {
+        taskENTER_CRITICAL();
+        g_lockNesting++;
+        return;
+    }
+    bool yield = --g_lockNesting == 0 && g_yieldPending;
+    if (yield) g_yieldPending = false;
+    taskEXIT_CRITICAL();
+    if (yield) taskYIELD();
+}
+
+void soakYieldFromIsr(BaseType_t xSwitchRequired)
+{
+    if (!xSwitchRequired) return;
+    if (g_lockNesting) {
+        g_yieldPending = true;
+    } else if (xTaskGetSchedulerState() == taskSCHEDULER_RUNNING) {
+        taskYIELD();
+    }
+}
+
+// Run the models up to the current host time
+static void soakPace()
+{
+    simRunUntil(soakNow());
+}
+
+void vApplicationIdleHook(void)
+{
+    soakPace();
+    if (simNext() > soakNow() + SOAK_IDLE_SLEEP_NS) {
+        // The tick signal ends the sleep early
+        struct timespec ts = {0, SOAK_IDLE_SLEEP_NS};
+        nanosleep(&ts, NULL);
+    }
+}
+
+// Delivers the interrupts which became due while a task was running
+static void taskSim(void *arg)
+{
+    (void)arg;
+    for (;;) {
+        vTaskDelay(1);
+        soakPace();
+    }
+}
+
+//*****************************************************************************
+// Monitors
+//*****************************************************************************
+typedef struct {
+    void *tcb;
+    uint64_t readyAt;       // 0 = not waiting
+    uint64_t maxWait, maxWaitAll;
+    uint32_t nLate;         // waits of more than a tick
+} t_soakTask;
+
+static t_soakTask g_tasks[N_TASKS];
+static uint32_t g_overruns, g_overrunsAll;
+static bool g_monitor;
+
+static t_soakTask *soakTask(void *tcb)
+{
+    for (unsigned i = 0; i < N_TASKS; i++) {
+        if (g_tasks[i].tcb == tcb) return &g_tasks[i];
+        if (!g_tasks[i].tcb) {
+            g_tasks[i].tcb = tcb;
+            return &g_tasks[i];
+        }
+    }
+    return NULL;
+}
+
+// Called by the kernel, also from the tick signal handler
+void soakTaskReady(void *tcb)
+{
+    t_soakTask *t = soakTask(tcb);
+    if (t && !t->readyAt) t->readyAt = hal_host_ns();
+}
+
+void soakTaskSwitchedIn(void *tcb)
+{
+    t_soakTask *t = soakTask(tcb);
+    if (!t || !t->readyAt) return;
+    uint64_t dt = hal_host_ns() - t->readyAt;
+    t->readyAt = 0;
+    if (!g_monitor) return;
+    if (dt > t->maxWait) t->maxWait = dt;
+    if (dt > SIM_NS_PER_S / configTICK_RATE_HZ) t->nLate++;
+}
+
+// Counts the overruns of task_pcf_io()
+void __real_prfCount(t_prfCntId id, uint32_t n);
+void __wrap_prfCount(t_prfCntId id, uint32_t n)
+{
+    if (id == PRF_CNT_OVERRUN && g_monitor) g_overruns += n;
+    __real_prfCount(id, n);
+}
+
+static void printHeap(FILE *f)
+{
+    fprintf(f, "heap: %u B free, min. ever %u B of %u B\n", (unsigned)xPortGetFreeHeapSize(),
+            (unsigned)xPortGetMinimumEverFreeHeapSize(), (unsigned)SOAK_FIRMWARE_HEAP_SIZE);
+}
+
+void soakAssert(const char *file, int line)
+{
+    fflush(stdout);
+    fprintf(stderr, "[%10.6f s] configASSERT() failed in %s:%d\n", soakNow() / 1e9, file, line);
+    printHeap(stderr);
+    exit(2);
+}
+
+//*****************************************************************************
+// Load generator
+//*****************************************************************************
+static struct {
+    uint32_t frames, framesSkipped;
+    uint32_t toggles;
+    uint32_t swQueries;
+    uint64_t txBytes;
+} g_load;
+
+static t_simMatch g_errors = {"ER:"};
+static t_simMatch g_swReplies = {"SW:"};
+
+static void soakTxSink(const uint8_t *data, uint32_t len)
+{
+    simMatchFeed(&g_errors, data, len);
+    simMatchFeed(&g_swReplies, data, len);
+    g_load.txBytes += len;
+}
+
+static void hostSend(const char *cmd)
+{
+    usbHostWrite((const uint8_t *)cmd, strlen(cmd));
+}
+
+static void loadLeds(void *arg)
+{
+    static uint8_t buf[32 + N_LEDS_MAX * 3];
+    static uint8_t phase;
+    (void)arg;
+    for (unsigned ch = 0; ch < 3; ch++) {
+        if (usbHostPending() > USB_BACKLOG_MAX) {
+            g_load.framesSkipped++;
+            continue;
+        }
+        unsigned n = sprintf((char *)buf, "LED %u %u\n", ch, g_cfg.nLeds * 3);
+        for (unsigned i = 0; i < g_cfg.nLeds * 3; i++) {
+            buf[n++] = i + phase;
+        }
+        usbHostWrite(buf, n);
+        g_load.frames++;
+    }
+    phase++;
+    simAt(g_simNow + SIM_NS_PER_S / g_cfg.fps, loadLeds, NULL);
+}
+
+static void loadSwitches(void *arg)
+{
+    static uint32_t frac;   // [toggles / 1000]
+    (void)arg;
+    bool burst = (g_simNow - T_LOAD) % BURST_PERIOD < BURST_LEN;
+    frac += g_cfg.toggles * (burst ? BURST_FACTOR : 1);
+    for (; frac >= 1000; frac -= 1000) {
+        // Matrix inputs and the PCFs of I2C channel 0
+        unsigned hw = rand() % 0x80;
+        hal_set_switch(hw, !hal_get_switch(hw));
+        g_load.toggles++;
+    }
+    simAt(g_simNow + SIM_NS_PER_MS, loadSwitches, NULL);
+}
+
+static void loadQueries(void *arg)
+{
+    (void)arg;
+    hostSend("SW?\n");
+    g_load.swQueries++;
+    simAt(g_simNow + 100 * SIM_NS_PER_MS, loadQueries, NULL);
+}
+
+static void report(void *arg)
+{
+    uintptr_t k = (uintptr_t)arg;
+    hostSend("PRF 1\n");
+    g_overrunsAll += g_overruns;
+    printf("[%5u s] %u frames (%u skipped), %u toggles, %u ER:, %u / %u SW?, %llu kB sent | "
+           "%u overruns | heap min. %u B | wait",
+           (unsigned)(k * g_cfg.report), g_load.frames, g_load.framesSkipped, g_load.toggles,
+           g_errors.n, g_swReplies.n, g_load.swQueries,
+           (unsigned long long)(g_load.txBytes / 1024), g_overruns,
+           (unsigned)xPortGetMinimumEverFreeHeapSize());
+    for (unsigned i = 0; i < N_TASKS && g_tasks[i].tcb; i++) {
+        t_soakTask *t = &g_tasks[i];
+        if (t->tcb == g_hSim) continue;
+        printf(" %s %.2f ms", pcTaskGetName(t->tcb), t->maxWait / 1e6);
+        if (t->maxWait > t->maxWaitAll) t->maxWaitAll = t->maxWait;
+        t->maxWait = 0;
+    }
+    printf("\n");
+    fflush(stdout);
+    g_overruns = 0;
+    if (k * g_cfg.report < g_cfg.duration) {
+        simAt(T_LOAD + (k + 1) * g_cfg.report * SIM_NS_PER_S, report, (void *)(k + 1));
+        return;
+    }
+    printf("%u s, %u LED frames of %u LEDs, %u switch toggles\n", g_cfg.duration,
+           g_load.frames, g_cfg.nLeds, g_load.toggles);
+    printf("1 ms loop overruns: %u\n", g_overrunsAll);
+    printHeap(stdout);
+    printf("longest wait ready -> running, waits of more than a tick:\n");
+    for (unsigned i = 0; i < N_TASKS && g_tasks[i].tcb; i++) {
+        t_soakTask *t = &g_tasks[i];
+        if (t->tcb == g_hSim) continue;
+        printf("%24s: %8.3f ms %8u\n", pcTaskGetName(t->tcb), t->maxWaitAll / 1e6, t->nLate);
+    }
+    exit(g_overrunsAll || g_errors.n ? 1 : 0);
+}
+
+static void setup(void *arg)
+{
+    char cmd[64];
+    (void)arg;
+    globalDebugEnabled = 1;
+    for (unsigned pcf = 0; pcf < PCF_MAX_PER_CHANNEL; pcf++) {
+        snprintf(cmd, sizeof(cmd), "HI 0x%x\n", 0x40 + pcf * 8);
+        hostSend(cmd);
+    }
+    // Matrix input i fires a pulse on pin i of I2C channel 1
+    for (unsigned i = 0; i < N_RULES; i++) {
+        snprintf(cmd, sizeof(cmd), "OUT 0x%x 0 0 0\n", 0x80 + i);
+        hostSend(cmd);
+        snprintf(cmd, sizeof(cmd), "RUL %u 0x%x 0x%x 5 10 7 0 0\n", i, i, 0x80 + i);
+        hostSend(cmd);
+    }
+    hostSend("SWE 2\n");
+    simAt(T_LOAD, loadLeds, NULL);
+    simAt(T_LOAD, loadSwitches, NULL);
+    simAt(T_LOAD, loadQueries, NULL);
+    simAt(T_LOAD + g_cfg.report * SIM_NS_PER_S, report, (void *)1);
+    g_monitor = true;
+}
+
+int main(int argc, char *argv[])
+{
+    int c;
+    while ((c = getopt(argc, argv, "t:r:f:l:s:q")) != -1) {
+        switch (c) {
+        case 't': g_cfg.duration = atoi(optarg); break;
+        case 'r': g_cfg.report = atoi(optarg); break;
+        case 'f': g_cfg.fps = atoi(optarg); break;
+        case 'l': g_cfg.nLeds = atoi(optarg); break;
+        case 's': g_cfg.toggles = atoi(optarg); break;
+        case 'q': g_cfg.quiet = true; break;
+        default:
+            fprintf(stderr, "usage: %s [-t s] [-r s] [-f fps] [-l nLeds] [-s toggles/s] [-q]\n",
+                    argv[0]);
+            return 1;
+        }
+    }
+    if (!g_cfg.report || !g_cfg.fps || g_cfg.nLeds < 1 || g_cfg.nLeds > N_LEDS_MAX) {
+        fprintf(stderr, "report, fps: > 0, nLeds: 1 - %u\n", N_LEDS_MAX);
+        return 1;
+    }
+    srand(1);
+    g_t0 = hal_host_ns();
+    g_halClock = HAL_CLOCK_HOST;
+    g_halUart = g_cfg.quiet ? NULL : stderr;
+    g_usbTxSink = soakTxSink;
+    g_simLockHook = soakLock;
+
+    // The simulation task comes first on the heap. Hand the rest over with
+    // as many free bytes as on a fresh heap of the target.
+    if (xTaskCreate(taskSim, "Sim", SOAK_SIM_STACK, NULL, SOAK_SIM_PRIORITY, &g_hSim) != pdPASS) {
+        fprintf(stderr, "no heap for the simulation task\n");
+        return 2;
+    }
+    size_t fresh = (SOAK_FIRMWARE_HEAP_SIZE - 8) & ~(size_t)(portBYTE_ALIGNMENT - 1);
+    size_t used = xPortGetFreeHeapSize() - fresh;
+    if (xPortGetFreeHeapSize() < fresh + 16 || !pvPortMalloc(used - 8) ||
+        xPortGetFreeHeapSize() != fresh) {
+        fprintf(stderr, "can not set up the heap of the target, %u B free\n",
+                (unsigned)xPortGetFreeHeapSize());
+        return 2;
+    }
+    simAt(T_SETUP, setup, NULL);
+    firmware_main();
+    fprintf(stderr, "vTaskStartScheduler() returned\n");
+    return 2;
+}
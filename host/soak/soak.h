@@ -0,0 +1,14 @@
+// Included after FreeRTOS.h by the firmware sources of the soak build, see
+// the soak target in host/Makefile
+#ifndef SOAK_H_
+#define SOAK_H_
+
+// The simulated interrupts run on the thread of a task with the models
+// locked. The context switch they ask for is done when the lock is released.
+#undef portYIELD_FROM_ISR
+#undef portEND_SWITCHING_ISR
+#define portYIELD_FROM_ISR(x)       soakYieldFromIsr(x)
+#define portEND_SWITCHING_ISR(x)    soakYieldFromIsr(x)
+void soakYieldFromIsr(BaseType_t xSwitchRequired);
+
+#endif /* SOAK_H_ */
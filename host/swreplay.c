@@ -0,0 +1,518 @@
+// Record and replay of raw switch samples, see "Host build" in README.md
+//
+// A trace holds the `SR:<tick>=<40 byte hex>` lines of the `SWR` command,
+// one for each 1 ms tick in which the raw inputs changed. Other lines are
+// ignored, so the DEVICE port of a real machine can be captured as it is.
+//
+//   swreplay -r trace [-t seconds] [-n toggles] [-b burst_ms]
+//       Records a trace on the simulated board: bursts of bouncing switch
+//       toggles on the matrix and all PCFs, like a multiball.
+//
+//   swreplay [-x commands] [-e swe] [-o events] [-c cost.csv] trace
+//       Boots the firmware, sends the commands (RUL, SWM, DEB, ... one per
+//       line) and then puts each sample of the trace on the simulated inputs,
+//       one tick before the PCF scan and the matrix read which pick it up.
+//       debounceAlgo(), the switch event reports and processQuickRules() run
+//       as on the board. The switch events the host receives and the rule
+//       firings are written to `events` with the tick they happened in, the
+//       host CPU time of process_IO() and its parts per tick to `cost.csv`.
+//
+// The tool is linked with --wrap=prfStop to get the profiler sections of
+// each tick.
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "hal.h"
+#include "sim.h"
+#include "FreeRTOS.h"
+#include "task.h"
+#include "io_manager.h"
+#include "myTasks.h"
+#include "profiler.h"
+#include "utils/uartstdio.h"
+
+int firmware_main(void);
+
+// taskDemoLED() switches the debug UART off after 1 s
+#define T_SETUP         (1100 * SIM_NS_PER_MS)
+#define T_REPLAY        (T_SETUP + 100 * SIM_NS_PER_MS)
+#define N_INPUTS        (N_CHARS * 8)
+#define HW_PCF0         0x40
+#define N_PCF           32
+#define SR_LINE_MAX     256
+
+static uint64_t tickOf(uint64_t t)
+{
+    return t / SIM_NS_PER_MS;
+}
+
+static void hostSend(const char *cmd)
+{
+    usbHostWrite((const uint8_t *)cmd, strlen(cmd));
+}
+
+// Boot writes 0 to all PCFs, make them readable like the host does
+static void allPcfHigh()
+{
+    char cmd[16];
+    for (unsigned i = 0; i < N_PCF; i++) {
+        snprintf(cmd, sizeof(cmd), "HI 0x%x\n", HW_PCF0 + i * 8);
+        hostSend(cmd);
+    }
+}
+
+//*****************************************************************************
+// Recording
+//*****************************************************************************
+static struct {
+    unsigned seconds;
+    unsigned nToggles;      // per burst
+    unsigned burstMs;
+} g_rec = {10, 24, 100};
+
+static FILE *g_traceOut;
+static unsigned g_nRecorded;
+
+// Keep the SR: lines of the USB stream
+static void recSink(const uint8_t *data, uint32_t len)
+{
+    static char line[SR_LINE_MAX];
+    static unsigned n;
+    for (uint32_t i = 0; i < len; i++) {
+        if (data[i] == '\n') {
+            line[n] = 0;
+            if (!strncmp(line, "SR:", 3)) {
+                fprintf(g_traceOut, "%s\n", line);
+                g_nRecorded++;
+            }
+            n = 0;
+        } else if (n < SR_LINE_MAX - 1) {
+            line[n++] = data[i];
+        }
+    }
+}
+
+// A switch contact bounces 0 - 3 times within 1.5 ms
+static void bounce(void *arg)
+{
+    unsigned hw = (uintptr_t)arg & 0xFFFF;
+    unsigned nLeft = (uintptr_t)arg >> 16;
+    hal_set_switch(hw, !hal_get_switch(hw));
+    if (nLeft) {
+        simAt(g_simNow + 100 * SIM_NS_PER_US + rand() % 400 * SIM_NS_PER_US, bounce,
+              (void *)(uintptr_t)(hw | (nLeft - 1) << 16));
+    }
+}
+
+static void recBurst(void *arg)
+{
+    (void)arg;
+    for (unsigned i = 0; i < g_rec.nToggles; i++) {
+        unsigned hw = rand() % (HW_PCF0 + N_PCF * 8);
+        // An odd number of flips, the switch ends up toggled
+        unsigned nBounce = 2 * (rand() % 2);
+        simAt(g_simNow + rand() % (2 * SIM_NS_PER_MS), bounce, (void *)(uintptr_t)(hw | nBounce << 16));
+    }
+    simAt(g_simNow + (g_rec.burstMs / 2 + rand() % g_rec.burstMs) * SIM_NS_PER_MS, recBurst, NULL);
+}
+
+static void recStart(void *arg)
+{
+    (void)arg;
+    hostSend("SWR 1\n");
+    simAt(T_REPLAY, recBurst, NULL);
+}
+
+static void recSetup(void *arg)
+{
+    (void)arg;
+    allPcfHigh();
+    simAt(T_REPLAY - 10 * SIM_NS_PER_MS, recStart, NULL);
+}
+
+static int record(const char *fileName)
+{
+    g_traceOut = fopen(fileName, "w");
+    if (!g_traceOut) {
+        perror(fileName);
+        return 1;
+    }
+    srand(1);
+    g_halUart = NULL;
+    g_usbTxSink = recSink;
+    simAt(T_SETUP, recSetup, NULL);
+    g_rtosEndTime = T_REPLAY + g_rec.seconds * SIM_NS_PER_S;
+    firmware_main();
+    fclose(g_traceOut);
+    printf("%u samples in %u s, bursts of %u toggles every %u ms on average\n",
+           g_nRecorded, g_rec.seconds, g_rec.nToggles, g_rec.burstMs);
+    return 0;
+}
+
+//*****************************************************************************
+// Replay
+//*****************************************************************************
+typedef struct {
+    uint32_t tick;
+    uint32_t v[N_LONGS];
+} t_sample;
+
+static t_sample *g_samples;
+static unsigned g_nSamples;
+
+static struct {
+    const char *cmdFile;
+    unsigned sweMode;
+    FILE *events;
+    FILE *cost;
+} g_play = {NULL, SWE_TEXT};
+
+// Per tick results
+static uint64_t g_tick0 = SIM_NEVER; // first replayed tick
+static uint32_t g_tickCycles[N_PRF];    // host time at 80 cycles / us
+static uint64_t g_costSum, g_costMax, g_nTicks;
+static unsigned g_nFirings, g_nEvents, g_nLostReports, g_nOverflows, g_nLostEvents;
+static unsigned g_nMismatch;        // ticks in which the firmware sampled something else
+static unsigned g_tickFirings, g_tickEvents, g_tickToggles;
+static uint64_t *g_costs;
+
+void __real_prfStop(t_prfId id, uint32_t t0);
+
+void __wrap_prfStop(t_prfId id, uint32_t t0)
+{
+    g_tickCycles[id] += PRF_CYCLES() - t0;
+    __real_prfStop(id, t0);
+}
+
+static uint64_t cyclesToNs(uint32_t cycles)
+{
+    return (uint64_t)cycles * SIM_NS_PER_S / SIM_CPU_HZ;
+}
+
+static bool parseSample(const char *line, t_sample *s)
+{
+    const char *p = strstr(line, "SR:");
+    char hex[9] = {0};
+    if (!p || sscanf(p, "SR:%8x=", &s->tick) != 1 || strlen(p) < 12 + 8 * N_LONGS) {
+        return false;
+    }
+    p += 12;
+    for (unsigned i = 0; i < N_LONGS; i++, p += 8) {
+        memcpy(hex, p, 8);
+        s->v[i] = strtoul(hex, NULL, 16);
+    }
+    return true;
+}
+
+static int loadTrace(const char *fileName)
+{
+    char line[SR_LINE_MAX];
+    unsigned len = 0;
+    FILE *f = fopen(fileName, "r");
+    if (!f) {
+        perror(fileName);
+        return 1;
+    }
+    while (fgets(line, sizeof(line), f)) {
+        if (g_nSamples >= len) {
+            len = len ? 2 * len : 4096;
+            g_samples = realloc(g_samples, len * sizeof(t_sample));
+        }
+        if (parseSample(line, &g_samples[g_nSamples])) {
+            if (g_nSamples && g_samples[g_nSamples].tick <= g_samples[g_nSamples - 1].tick) {
+                fprintf(stderr, "%s: tick %08x out of order\n", fileName, g_samples[g_nSamples].tick);
+                return 1;
+            }
+            g_nSamples++;
+        }
+    }
+    fclose(f);
+    if (!g_nSamples) {
+        fprintf(stderr, "%s: no SR: lines\n", fileName);
+        return 1;
+    }
+    return 0;
+}
+
+// Bit 0 = closed, on the matrix as well as on the PCFs
+static void applySample(void *arg)
+{
+    const t_sample *s = arg;
+    for (unsigned hw = 0; hw < N_INPUTS; hw++) {
+        hal_set_switch(hw, !((s->v[hw / 32] >> (hw % 32)) & 1));
+    }
+}
+
+static const t_sample *g_expected; // what the firmware should have sampled
+static unsigned g_next;             // next sample to apply
+static uint64_t g_traceT0, g_tEnd;  // simulated time of tick 0 of the trace, end of the replay
+
+// Accounts the tick whose scan is done, then applies the sample of the next
+// tick. Runs late in each tick, the PCF scan and the matrix read of the next
+// tick pick it up
+static void replayTick(void *arg)
+{
+    uint64_t cost = cyclesToNs(g_tickCycles[PRF_PROCESS_IO]);
+    (void)arg;
+    if (g_expected) {
+        if (memcmp(g_SwitchStateSampled.longValues, g_expected->v, sizeof(g_expected->v))) {
+            g_nMismatch++;
+        }
+        g_costs[g_nTicks++] = cost;
+        g_costSum += cost;
+        if (cost > g_costMax) g_costMax = cost;
+        if (g_play.cost) {
+            fprintf(g_play.cost, "%llu,%u,%u,%u,%llu,%llu,%llu,%llu\n",
+                    (unsigned long long)(tickOf(g_simNow) - g_tick0),
+                    g_tickToggles, g_tickEvents, g_tickFirings,
+                    (unsigned long long)cyclesToNs(g_tickCycles[PRF_DEBOUNCE]),
+                    (unsigned long long)cyclesToNs(g_tickCycles[PRF_REPORT_SW]),
+                    (unsigned long long)cyclesToNs(g_tickCycles[PRF_QUICK_RULES]),
+                    (unsigned long long)cost);
+        }
+    }
+    g_tickToggles = g_tickEvents = g_tickFirings = 0;
+    memset(g_tickCycles, 0, sizeof(g_tickCycles));
+    if (g_next < g_nSamples && g_traceT0 + g_samples[g_next].tick * SIM_NS_PER_MS <= g_simNow) {
+        const t_sample *s = &g_samples[g_next++];
+        for (unsigned i = 0; i < N_LONGS; i++) {
+            g_tickToggles += __builtin_popcount(s->v[i] ^ (g_expected ? g_expected->v[i] : s->v[i]));
+        }
+        applySample((void *)s);
+        g_expected = s;
+    }
+    if (g_simNow + SIM_NS_PER_MS < g_tEnd) {
+        simAt(g_simNow + SIM_NS_PER_MS, replayTick, NULL);
+    } else {
+        g_rtosEndTime = g_simNow;
+    }
+}
+
+static void replayStart(void *arg)
+{
+    (void)arg;
+    // Keep going for a second after the last sample to see its effect
+    unsigned nTicks = g_samples[g_nSamples - 1].tick - g_samples[0].tick + 1000;
+    g_traceT0 = T_REPLAY - g_samples[0].tick * SIM_NS_PER_MS;
+    g_tEnd = T_REPLAY + nTicks * SIM_NS_PER_MS;
+    g_tick0 = tickOf(T_REPLAY) + 1;
+    g_costs = calloc(nTicks + 1, sizeof(uint64_t));
+    replayTick(NULL);
+}
+
+static void sendCommands()
+{
+    char line[SR_LINE_MAX];
+    if (!g_play.cmdFile) return;
+    FILE *f = fopen(g_play.cmdFile, "r");
+    if (!f) {
+        perror(g_play.cmdFile);
+        exit(1);
+    }
+    while (fgets(line, sizeof(line), f)) {
+        if (line[0] == '#' || line[0] == '\n') continue;
+        if (!strchr(line, '\n')) strcat(line, "\n");
+        hostSend(line);
+    }
+    fclose(f);
+}
+
+static void replaySetup(void *arg)
+{
+    char cmd[16];
+    (void)arg;
+    allPcfHigh();
+    snprintf(cmd, sizeof(cmd), "SWE %u\n", g_play.sweMode);
+    hostSend(cmd);
+    sendCommands();
+    globalDebugEnabled = 1;
+    // 0.9 ms into the tick
+    simAt(T_REPLAY + SIM_NS_PER_MS * 9 / 10, replayStart, NULL);
+}
+
+static void logEvent(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+
+static void logEvent(const char *fmt, ...)
+{
+    va_list ap;
+    if (!g_play.events || tickOf(g_simNow) < g_tick0) return;
+    fprintf(g_play.events, "%08llx ", (unsigned long long)(tickOf(g_simNow) - g_tick0));
+    va_start(ap, fmt);
+    vfprintf(g_play.events, fmt, ap);
+    va_end(ap);
+}
+
+// SE: lines and BIN_OP_SWE frames from the firmware, the latter are
+// written in the same format as the SE: lines
+static void playSink(const uint8_t *data, uint32_t len)
+{
+    static char line[SR_LINE_MAX];
+    static uint8_t hdr[BIN_HEADER_LEN];
+    static unsigned n, nHdr, nPayload, nRec;
+    static uint8_t rec[6];
+    unsigned recLen = g_play.sweMode == SWE_BIN_TS ? 6 : 2;
+    for (uint32_t i = 0; i < len; i++) {
+        uint8_t c = data[i];
+        if (nPayload) {
+            rec[nRec++] = c;
+            if (nRec == recLen) {
+                unsigned r = rec[0] | rec[1] << 8;
+                if ((r & 0x1FF) == SWE_BIN_OVERFLOW) {
+                    // The number of lost events is only sent with time stamps
+                    g_nOverflows++;
+                    if (recLen == 6) {
+                        unsigned nLost = rec[2] | rec[3] << 8 | rec[4] << 16 | rec[5] << 24;
+                        g_nLostEvents += nLost;
+                        logEvent("SE:lost=%u\n", nLost);
+                    } else {
+                        logEvent("SE:lost\n");
+                    }
+                } else {
+                    logEvent("SE:%03x=%d\n", r & 0x1FF, !!(r & SWE_BIN_STATE));
+                    g_nEvents++;
+                    g_tickEvents++;
+                }
+                nRec = 0;
+            }
+            nPayload--;
+        } else if (nHdr || (!n && c == BIN_FRAME_START)) {
+            hdr[nHdr++] = c;
+            if (nHdr == BIN_HEADER_LEN) {
+                nPayload = hdr[2] | hdr[3] << 8;
+                nHdr = nRec = 0;
+            }
+        } else if (c == '\n') {
+            line[n] = 0;
+            if (!strncmp(line, "SE:", 3)) {
+                logEvent("%s\n", line);
+                for (char *p = line; (p = strchr(p, '=')); p++) {
+                    g_nEvents++;
+                    g_tickEvents++;
+                }
+            }
+            n = 0;
+        } else if (n < SR_LINE_MAX - 1) {
+            line[n++] = c;
+        }
+    }
+}
+
+// The debug UART: quick rules print `R<id> ` when they fire, reports which
+// do not fit into REPORT_SWITCH_BUF_SIZE are dropped with a message
+static ssize_t uartWrite(void *cookie, const char *buf, size_t size)
+{
+    static char last[3];
+    static const char *lostMsg = "buffer overflow!";
+    static unsigned nLostMsg;
+    (void)cookie;
+    for (size_t i = 0; i < size; i++) {
+        char c = buf[i];
+        if (c == ' ' && last[0] == 'R' && last[1] >= '0' && last[1] <= '9' &&
+            last[2] >= '0' && last[2] <= '9') {
+            logEvent("R%c%c\n", last[1], last[2]);
+            g_nFirings++;
+            g_tickFirings++;
+        }
+        nLostMsg = c == lostMsg[nLostMsg] ? nLostMsg + 1 : c == lostMsg[0];
+        if (!lostMsg[nLostMsg]) {
+            logEvent("SE:lost\n");
+            g_nLostReports++;
+            nLostMsg = 0;
+        }
+        last[0] = last[1];
+        last[1] = last[2];
+        last[2] = c;
+    }
+    return size;
+}
+
+static int cmpU64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static int replay(const char *fileName)
+{
+    if (loadTrace(fileName)) return 1;
+    cookie_io_functions_t uart = {NULL, uartWrite, NULL, NULL};
+    g_halUart = fopencookie(NULL, "w", uart);
+    setvbuf(g_halUart, NULL, _IONBF, 0);
+    g_halClock = HAL_CLOCK_HOST;
+    g_usbTxSink = playSink;
+    if (g_play.cost) fprintf(g_play.cost, "tick,toggles,events,firings,debounce_ns,report_ns,rules_ns,process_io_ns\n");
+    simAt(T_SETUP, replaySetup, NULL);
+    firmware_main();
+
+    printf("%u samples over %u ticks, %llu ticks replayed, %u ticks sampled differently\n",
+           g_nSamples, g_samples[g_nSamples - 1].tick - g_samples[0].tick + 1,
+           (unsigned long long)g_nTicks, g_nMismatch);
+    printf("%u switch events (SWE %u), %u SE: reports dropped, %u overflow markers (%u events), "
+           "%u rule firings\n", g_nEvents, g_play.sweMode, g_nLostReports, g_nOverflows,
+           g_nLostEvents, g_nFirings);
+    qsort(g_costs, g_nTicks, sizeof(uint64_t), cmpU64);
+    printf("process_IO() host CPU per tick: mean %.0f ns, 99 %% %llu ns, max %llu ns\n",
+           (double)g_costSum / g_nTicks, (unsigned long long)g_costs[g_nTicks * 99 / 100],
+           (unsigned long long)g_costMax);
+    return 0;
+}
+
+static FILE *openOut(const char *fileName)
+{
+    FILE *f = fopen(fileName, "w");
+    if (!f) {
+        perror(fileName);
+        exit(1);
+    }
+    return f;
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr,
+        "usage: %s -r trace [-t seconds] [-n toggles] [-b burst_ms]\n"
+        "       %s [-x commands] [-e swe] [-o events] [-c cost.csv] trace\n"
+        "  -r  record a trace on the simulated board\n"
+        "  -t  length of the recording [s] (%u)\n"
+        "  -n  switch toggles per burst (%u)\n"
+        "  -b  mean time between bursts [ms] (%u)\n"
+        "  -x  file of commands sent before the replay, one per line\n"
+        "  -e  switch event reports, 1 = text, 2 = binary, 3 = binary with time stamp (%u)\n"
+        "  -o  write switch events and rule firings to this file\n"
+        "  -c  write the cost per tick to this CSV file\n",
+        name, name, g_rec.seconds, g_rec.nToggles, g_rec.burstMs, g_play.sweMode);
+    exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+    int c;
+    const char *recFile = NULL;
+    while ((c = getopt(argc, argv, "r:t:n:b:x:e:o:c:")) != -1) {
+        switch (c) {
+        case 'r': recFile = optarg; break;
+        case 't': g_rec.seconds = atoi(optarg); break;
+        case 'n': g_rec.nToggles = atoi(optarg); break;
+        case 'b': g_rec.burstMs = atoi(optarg); break;
+        case 'x': g_play.cmdFile = optarg; break;
+        case 'e': g_play.sweMode = atoi(optarg); break;
+        case 'o': g_play.events = openOut(optarg); break;
+        case 'c': g_play.cost = openOut(optarg); break;
+        default: usage(argv[0]);
+        }
+    }
+    if (recFile) {
+        if (!g_rec.seconds || !g_rec.burstMs) usage(argv[0]);
+        return record(recFile);
+    }
+    if (optind != argc - 1 || g_play.sweMode < SWE_TEXT || g_play.sweMode > SWE_BIN_TS) {
+        usage(argv[0]);
+    }
+    int ret = replay(argv[optind]);
+    if (g_play.events) fclose(g_play.events);
+    if (g_play.cost) fclose(g_play.cost);
+    return ret;
+}
@@ -0,0 +1,389 @@
+// WS2811 bit stream of an LED channel, see "Host build" in README.md
+//
+// Sends LED frames through the USB command parser, records what spiISR() and
+// the uDMA put on the SSI1 wire (LED channel 0) and decodes it back into
+// WS2811 bits. Checked for every frame:
+//   - the decoded bytes are the frame (fillPiongBuffer() + g_ssi_lut)
+//   - T0H / T0L / T1H / T1L at the bit rate of the SSI are within the WS2811
+//     datasheet (+-150 ns), also across the ping / pong block boundaries
+//   - the SPI_SEND_ZERO words keep the line low >= SPI_LATCH_US
+//   - no uDMA source buffer is written while it is being sent
+// Each speed sends 2 frames of nLeds back to back and one of nLeds - 24,
+// which does not end on a block boundary. Afterwards fillPiongBuffer() is
+// timed and compared with the time one 128 word block takes on the wire.
+//
+//   wsverify [-f spiHz] ... [-n nLeds]
+//
+// Without -f the default speed and 1.6 MHz (WS2811 400 kHz mode) are checked.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "hal.h"
+#include "sim.h"
+#include "FreeRTOS.h"
+#include "mySpi.h"
+
+int firmware_main(void);
+uint8_t *fillPiongBuffer(uint8_t *srcPointer, uint16_t *destPointer, int32_t *nBytesLeft);
+
+#define T_SETUP         (200 * SIM_NS_PER_MS)
+#define MAX_SPEEDS      8
+#define SHORT_FRAME     24          // LEDs less in the 3rd frame of a speed
+#define SPEC_TOL_NS     150
+#define FIFO_WORDS      8
+
+//*****************************************************************************
+// Wire recording
+//*****************************************************************************
+typedef struct {
+    uint64_t rise, fall;
+    uint32_t bitNs;
+} t_pulse;
+
+static t_pulse *g_pulses;
+static unsigned g_nPulses, g_pulsesLen;
+static uint64_t *g_latchEnd;        // end of the SPI_SEND_ZERO transfers
+static unsigned g_nLatches;
+static uint64_t g_wireEnd;          // of the last transfer
+static bool g_high;                 // line level at g_wireEnd
+static unsigned g_nModified;
+
+static void pulseAdd(uint64_t rise, uint64_t fall, uint32_t bitNs)
+{
+    if (g_nPulses >= g_pulsesLen) {
+        g_pulsesLen = g_pulsesLen ? 2 * g_pulsesLen : 65536;
+        g_pulses = realloc(g_pulses, g_pulsesLen * sizeof(t_pulse));
+    }
+    g_pulses[g_nPulses++] = (t_pulse){rise, fall, bitNs};
+}
+
+// Turns the words into high pulses, the line is low between transfers
+static void wireHook(const t_ssiTransfer *t)
+{
+    static uint64_t rise;
+    if (t->ssi != 1) return;
+    if (g_high && t->tStart > g_wireEnd) {
+        pulseAdd(rise, g_wireEnd, t->bitNs);
+        g_high = false;
+    }
+    uint64_t tBit = t->tStart;
+    for (uint32_t i = 0; i < t->nWords; i++) {
+        for (int b = 15; b >= 0; b--, tBit += t->bitNs) {
+            bool high = (t->words[i] >> b) & 1;
+            if (high && !g_high) {
+                rise = tBit;
+            } else if (!high && g_high) {
+                pulseAdd(rise, tBit, t->bitNs);
+            }
+            g_high = high;
+        }
+    }
+    g_wireEnd = tBit;
+    // Data is always sent in blocks of SPI_DMA_BUFFER_SIZE words
+    if (t->nWords != SPI_DMA_BUFFER_SIZE) {
+        g_latchEnd = realloc(g_latchEnd, (g_nLatches + 1) * sizeof(uint64_t));
+        g_latchEnd[g_nLatches++] = g_wireEnd;
+    }
+    g_nModified += t->modified;
+}
+
+//*****************************************************************************
+// Frames sent by the simulated host
+//*****************************************************************************
+typedef struct {
+    uint32_t spiHz;     // LEC speed
+    unsigned nLeds;
+    uint8_t *data;
+} t_frame;
+
+static struct {
+    uint32_t speeds[MAX_SPEEDS];
+    unsigned nSpeeds;
+    unsigned nLeds;
+} g_cfg = {{SPI_DEFAULT_SPEED, 1600000}, 2, N_LEDS_MAX};
+
+static t_frame g_frames[3 * MAX_SPEEDS];
+static unsigned g_nFrames;
+static unsigned g_step;             // speed being sent
+static uint32_t g_spiHz = SPI_DEFAULT_SPEED;
+static bool g_done;
+
+static void hostSend(const void *data, unsigned len)
+{
+    usbHostWrite(data, len);
+}
+
+static void sendFrame(unsigned nLeds)
+{
+    t_frame *f = &g_frames[g_nFrames++];
+    char cmd[32];
+    unsigned n = snprintf(cmd, sizeof(cmd), "LED 0 %u\n", nLeds * 3);
+    f->spiHz = g_spiHz;
+    f->nLeds = nLeds;
+    f->data = malloc(nLeds * 3);
+    for (unsigned i = 0; i < nLeds * 3; i++) {
+        f->data[i] = rand();
+    }
+    hostSend(cmd, n);
+    hostSend(f->data, nLeds * 3);
+}
+
+// Next step once the frames sent so far have been latched
+static void driver(void *arg)
+{
+    (void)arg;
+    if (usbHostPending() || g_nLatches < g_nFrames || g_simNow < g_wireEnd + SIM_NS_PER_MS) {
+        simAt(g_simNow + SIM_NS_PER_MS, driver, NULL);
+        return;
+    }
+    if (g_step >= 2 * g_cfg.nSpeeds) {
+        g_done = true;
+        g_rtosEndTime = g_simNow;
+        return;
+    }
+    if (g_step % 2 == 0) {
+        uint32_t hz = g_cfg.speeds[g_step / 2];
+        if (hz != g_spiHz) {
+            char cmd[32];
+            hostSend(cmd, snprintf(cmd, sizeof(cmd), "LEC 0 %u\n", hz));
+            g_spiHz = hz;
+        }
+        // The second frame waits for the end of the first one in the parser
+        sendFrame(g_cfg.nLeds);
+        sendFrame(g_cfg.nLeds);
+    } else {
+        sendFrame(g_cfg.nLeds - SHORT_FRAME);
+    }
+    g_step++;
+    simAt(g_simNow + SIM_NS_PER_MS, driver, NULL);
+}
+
+//*****************************************************************************
+// Decoding
+//*****************************************************************************
+typedef struct {
+    const char *name;
+    uint32_t nominal;   // [ns]
+    uint32_t min, max;  // measured
+} t_timing;
+
+enum { T0H, T0L, T1H, T1L, N_TIMINGS };
+
+// WS2811 datasheet, 800 kHz (high speed) mode. 400 kHz mode is twice as long
+static const uint32_t g_specHs[N_TIMINGS] = {250, 1000, 600, 650};
+
+typedef struct {
+    t_timing t[N_TIMINGS];
+    uint64_t latchMinNs;        // low time after the last bit until the end of SPI_SEND_ZERO
+    uint64_t gapMinNs;          // low time between frames
+    unsigned nBadFrames;
+    bool lowSpeed;
+} t_speedResult;
+
+static void timingInit(t_speedResult *r, uint32_t bitNs)
+{
+    static const char *names[N_TIMINGS] = {"T0H", "T0L", "T1H", "T1L"};
+    // 4 SPI bits per WS2811 bit
+    r->lowSpeed = 4 * bitNs > 1000000000 / 600000;
+    for (unsigned i = 0; i < N_TIMINGS; i++) {
+        r->t[i] = (t_timing){names[i], g_specHs[i] * (r->lowSpeed ? 2 : 1), UINT32_MAX, 0};
+    }
+    r->latchMinNs = r->gapMinNs = UINT64_MAX;
+}
+
+static void timingAdd(t_timing *t, uint64_t ns)
+{
+    if (ns < t->min) t->min = ns;
+    if (ns > t->max) t->max = ns;
+}
+
+static bool timingOk(const t_timing *t)
+{
+    return t->min + SPEC_TOL_NS >= t->nominal && t->max <= t->nominal + SPEC_TOL_NS;
+}
+
+// Decode the pulses of one frame, starting at *p. A low time longer than
+// 2 WS2811 bits ends it. Returns false if the wire is not the frame
+static bool decodeFrame(unsigned *p, const t_frame *f, const t_frame *prev, t_speedResult *r)
+{
+    uint8_t *bytes = calloc(N_LEDS_MAX * 3 + 2 * SPI_DMA_BUFFER_SIZE, 1);
+    unsigned nBits = 0, nErr = 0, nStale = 0, nStalePrev = 0;
+    unsigned maxBits = 8 * (N_LEDS_MAX * 3 + SPI_DMA_BUFFER_SIZE);
+    const t_pulse *x = NULL;
+    if (*p >= g_nPulses) {
+        printf("  %5u LEDs: nothing on the wire\n", f->nLeds);
+        free(bytes);
+        return false;
+    }
+    uint32_t bitNs = g_pulses[*p].bitNs;
+    uint32_t tHigh = (r->t[T0H].nominal + r->t[T1H].nominal) / 2;
+    for (; *p < g_nPulses && nBits < maxBits; (*p)++) {
+        x = &g_pulses[*p];
+        bool one = x->fall - x->rise > tHigh;
+        bytes[nBits / 8] |= one << (7 - nBits % 8);
+        nBits++;
+        timingAdd(&r->t[one ? T1H : T0H], x->fall - x->rise);
+        if (*p + 1 >= g_nPulses || g_pulses[*p + 1].rise - x->fall > 8 * bitNs) {
+            break;
+        }
+        timingAdd(&r->t[one ? T1L : T0L], g_pulses[*p + 1].rise - x->fall);
+    }
+    (*p)++;
+    // Low time after the last bit, until the end of the latch words and
+    // until the next frame
+    uint64_t latchNs = 0;
+    for (unsigned i = 0; i < g_nLatches; i++) {
+        if (g_latchEnd[i] > x->fall) {
+            latchNs = g_latchEnd[i] - x->fall;
+            break;
+        }
+    }
+    if (latchNs < r->latchMinNs) r->latchMinNs = latchNs;
+    if (*p < g_nPulses && g_pulses[*p].rise - x->fall < r->gapMinNs) {
+        r->gapMinNs = g_pulses[*p].rise - x->fall;
+    }
+
+    unsigned len = f->nLeds * 3, nBytes = nBits / 8;
+    for (unsigned i = 0; i < len; i++) {
+        nErr += i >= nBytes || bytes[i] != f->data[i];
+    }
+    // fillPiongBuffer() always encodes whole blocks, what follows the frame
+    // is left over in g_spiBuffer from earlier frames
+    if (nBytes > len) {
+        nStale = nBytes - len;
+        for (unsigned i = len; prev && i < nBytes && i < prev->nLeds * 3; i++) {
+            nStalePrev += bytes[i] == prev->data[i];
+        }
+    }
+    bool ok = !nErr && nBits % 8 == 0 && nStale < SPI_DMA_BUFFER_SIZE / 2 &&
+              latchNs >= SPI_LATCH_US * SIM_NS_PER_US;
+    printf("  %5u LEDs %6u bits %5u bad bytes, %2u bytes after the end (%2u of the previous frame), "
+           "latch %5.1f us  %s\n",
+           f->nLeds, nBits, nErr, nStale, nStalePrev, latchNs / 1000.0, ok ? "PASS" : "FAIL");
+    free(bytes);
+    return ok;
+}
+
+static unsigned verify()
+{
+    unsigned p = 0, nFail = 0;
+    for (unsigned i = 0; i < g_nFrames;) {
+        uint32_t hz = g_frames[i].spiHz;
+        uint32_t bitNs = p < g_nPulses ? g_pulses[p].bitNs : 0;
+        t_speedResult r;
+        timingInit(&r, bitNs);
+        printf("LEC 0 %u: SSI at %.0f Hz (%u ns / bit), WS2811 %s kHz mode\n",
+               hz, bitNs ? 1e9 / bitNs : 0.0, bitNs, r.lowSpeed ? "400" : "800");
+        for (; i < g_nFrames && g_frames[i].spiHz == hz; i++) {
+            r.nBadFrames += !decodeFrame(&p, &g_frames[i], i ? &g_frames[i - 1] : NULL, &r);
+        }
+        for (unsigned k = 0; k < N_TIMINGS; k++) {
+            const t_timing *t = &r.t[k];
+            bool ok = timingOk(t);
+            if (t->min > t->max) {
+                printf("  %s %-18s", t->name, "not on the wire");
+            } else {
+                printf("  %s %5u - %5u ns, ", t->name, t->min, t->max);
+            }
+            printf("datasheet %4u +- %u ns  %s\n", t->nominal, SPEC_TOL_NS, ok ? "PASS" : "FAIL");
+            r.nBadFrames += !ok;
+        }
+        printf("  latch >= %.1f us (SPI_SEND_ZERO), frame to frame >= %.1f us\n",
+               r.latchMinNs / 1000.0, r.gapMinNs == UINT64_MAX ? 0.0 : r.gapMinNs / 1000.0);
+        nFail += r.nBadFrames;
+    }
+    if (p < g_nPulses) {
+        printf("%u pulses on the wire after the last frame  FAIL\n", g_nPulses - p);
+        nFail++;
+    }
+    printf("uDMA source buffers written while in flight: %u  %s\n",
+           g_nModified, g_nModified ? "FAIL" : "PASS");
+    return nFail + g_nModified;
+}
+
+//*****************************************************************************
+// Encoder cost
+//*****************************************************************************
+static void encodeCost()
+{
+    enum { N_RUNS = 2000 };
+    static uint8_t src[N_LEDS_MAX * 3];
+    static uint16_t dest[SPI_DMA_BUFFER_SIZE];
+    unsigned nBlocks = 0;
+    for (unsigned i = 0; i < sizeof(src); i++) {
+        src[i] = rand();
+    }
+    uint64_t t0 = hal_host_ns();
+    for (unsigned r = 0; r < N_RUNS; r++) {
+        uint8_t *p = src;
+        int32_t nLeft = sizeof(src);
+        while (nLeft > 0) {
+            p = fillPiongBuffer(p, dest, &nLeft);
+            __asm__ volatile("" ::: "memory");
+            nBlocks++;
+        }
+    }
+    double blockNs = (double)(hal_host_ns() - t0) / nBlocks;
+    double ledsPerBlock = SPI_DMA_BUFFER_SIZE / 2 / 3.0;
+    printf("fillPiongBuffer() on this host: %.1f ns / block of %u words, %.2f ns / LED "
+           "(%.1f cycles / LED, host time at 80 cycles / us)\n",
+           blockNs, SPI_DMA_BUFFER_SIZE, blockNs / ledsPerBlock,
+           SIM_NS_TO_CYCLES(blockNs / ledsPerBlock));
+    printf("Budget per block: spiISR() restarts the uDMA within %u words, refills within one block\n",
+           FIFO_WORDS);
+    printf("   SPI Hz | block_us  cycles cyc/LED | restart_us cycles | refill on this host\n");
+    for (unsigned i = 0; i < g_cfg.nSpeeds; i++) {
+        // Divider picked by SSIConfigSetExpClk()
+        ssiModelConfig(SSI1_BASE, SYSTEM_CLOCK, g_cfg.speeds[i]);
+        uint32_t bitNs = ssiModelBitNs(SSI1_BASE);
+        double wordNs = 16.0 * bitNs, block = SPI_DMA_BUFFER_SIZE * wordNs;
+        printf("%9u | %8.1f %7.0f %7.0f | %10.1f %6.0f | %5.2f %% of the block\n",
+               g_cfg.speeds[i], block / 1000, SIM_NS_TO_CYCLES(block),
+               SIM_NS_TO_CYCLES(block) / ledsPerBlock, FIFO_WORDS * wordNs / 1000,
+               SIM_NS_TO_CYCLES(FIFO_WORDS * wordNs), 100 * blockNs / block);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    int c;
+    bool speedGiven = false;
+    while ((c = getopt(argc, argv, "f:n:")) != -1) {
+        switch (c) {
+        case 'f':
+            if (!speedGiven) g_cfg.nSpeeds = 0;
+            speedGiven = true;
+            if (g_cfg.nSpeeds < MAX_SPEEDS) g_cfg.speeds[g_cfg.nSpeeds++] = atoi(optarg);
+            break;
+        case 'n': g_cfg.nLeds = atoi(optarg); break;
+        default:
+            fprintf(stderr, "usage: %s [-f spiHz] ... [-n nLeds]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (g_cfg.nLeds <= SHORT_FRAME || g_cfg.nLeds > N_LEDS_MAX) {
+        fprintf(stderr, "nLeds: %u - %u\n", SHORT_FRAME + 1, N_LEDS_MAX);
+        return 1;
+    }
+    for (unsigned i = 0; i < g_cfg.nSpeeds; i++) {
+        // 40 MHz is the LEC limit, the latch words have to fit a block
+        if (g_cfg.speeds[i] < 400000 || g_cfg.speeds[i] > SYSTEM_CLOCK / 2) {
+            fprintf(stderr, "spiHz: 400000 - %u\n", SYSTEM_CLOCK / 2);
+            return 1;
+        }
+    }
+    srand(1);
+    g_halUart = NULL;
+    g_ssiWireHook = wireHook;
+    simAt(T_SETUP, driver, NULL);
+    g_rtosEndTime = T_SETUP + g_cfg.nSpeeds * 10 * SIM_NS_PER_S;
+    firmware_main();
+    if (!g_done) {
+        printf("stuck after %u of %u frames, %u latched\n", g_nFrames, 3 * g_cfg.nSpeeds, g_nLatches);
+        return 1;
+    }
+    unsigned nFail = verify();
+    encodeCost();
+    return nFail ? 1 : 0;
+}
@@ -25,6 +25,7 @@
 #include "utils/ustdlib.h"
 #include "myTasks.h"
 #include "i2c_inout.h"
+#include "profiler.h"
 
 // Four TI I2C driver instances for 4 I2C channels
 t_i2cChannelState g_sI2CInst[4];
@@ -34,6 +35,15 @@ t_i2cChannelState g_sI2CInst[4];
 static unsigned g_bcmIndex = 0;
 // Counts how many PCM cycles have been triggered
 static unsigned g_i2c_cycle = 0;
+// Cycle counter value when the current PCF scan has been triggered
+static uint32_t g_i2c_cycle_start = 0;
+// Cycle counter value when the last I2C ISR of the current scan has notified
+static volatile uint32_t g_i2c_cycle_done = 0;
+// Transaction buffers, taken by the command parser, released by process_IO()
+static t_i2cSlot g_i2cSlots[I2C_N_SLOTS];
+// ASCII reply of a transaction which fits into a slot, only used by process_IO()
+#define I2C_REPLY_LEN(nRead) (2 * (nRead) + 32)
+static char g_i2cReplyStr[I2C_REPLY_LEN(I2C_SLOT_LEN)];
 
 void i2CIntHandler0(void) {i2c_isr(0);}
 void i2CIntHandler1(void) {i2c_isr(1);}
@@ -215,6 +225,52 @@ void i2c_tx_rx_n(uint32_t b, t_i2cCustom *i2c)
     }
 }
 
+// Only the command parser allocates, so a free slot can not be taken
+// from under us. Too long transactions or all slots busy go on the heap.
+bool i2c_custom_alloc(t_i2cCustom *i2c, const uint8_t *wData)
+{
+    uint8_t *buf = NULL;
+    unsigned len = i2c->nWrite > i2c->nRead ? i2c->nWrite : i2c->nRead;
+    i2c->slot = -1;
+    if (len <= I2C_SLOT_LEN) {
+        for (unsigned i = 0; i < I2C_N_SLOTS; i++) {
+            if (!g_i2cSlots[i].used) {
+                g_i2cSlots[i].used = true;
+                i2c->slot = i;
+                buf = g_i2cSlots[i].buf;
+                break;
+            }
+        }
+    }
+    if (!buf) {
+        buf = pvPortMalloc(I2C_BUF_HDR + len);
+        if (!buf) {
+            return false;
+        }
+    }
+    buf += I2C_BUF_HDR;
+    if (i2c->nWrite) {
+        memcpy(buf, wData, i2c->nWrite);
+    }
+    i2c->writeBuff = buf;
+    i2c->readBuff = buf;
+    return true;
+}
+
+void i2c_custom_free(t_i2cCustom *i2c)
+{
+    if (!i2c->writeBuff) {
+        return;
+    }
+    if (i2c->slot >= 0) {
+        g_i2cSlots[i2c->slot].used = false;
+    } else {
+        vPortFree(i2c->writeBuff - I2C_BUF_HDR);
+    }
+    i2c->writeBuff = NULL;
+    i2c->readBuff = NULL;
+}
+
 // carry out a custom i2c transaction and yield until done
 // can only be called by process_IO(),
 // which makes sure the timing is right. It gets sneaked in after all
@@ -222,6 +278,8 @@ void i2c_tx_rx_n(uint32_t b, t_i2cCustom *i2c)
 void handle_i2c_custom()
 {
     char *hexStr=NULL, *chr=NULL;
+    uint8_t *frame;
+    char okStr[12];
     t_i2cCustom i2c;
     // Do up to one transactions per PCF cycle
     if (!xQueueReceive(g_i2c_queue, &i2c, 0))
@@ -231,45 +289,61 @@ void handle_i2c_custom()
     t_i2cChannelState *c = &g_sI2CInst[i2c.channel];
     if (c->i2c_state != I2C_IDLE) {
         UARTprintf("handle_i2c_custom(): Error! I2C not in IDLE state\n");
-        REPORT_ERROR("ER:0021\n");
+        reportError("ER:0021\n", i2c.seq);
         goto handle_i2c_custom_finally;
     }
     c->i2c_state = I2C_CUSTOM;
     i2c_tx_rx_n(c->base_addr, &i2c);
     c->i2c_state = I2C_IDLE;
 
-    hexStr = pvPortMalloc(2 * i2c.nRead + 24);
-    if (!hexStr) {
-        UARTprintf("handle_i2c_custom(): Could not allocate hexStr buffer!\n");
+    if (i2c.binReply) {
+        // [channel, flags, received data] as BIN_OP_I2C reply frame,
+        // straight from the transaction buffer
+        frame = i2c.readBuff - I2C_BUF_HDR;
+        frame[0] = i2c.channel;
+        frame[1] = i2c.flags;
+        ts_usbSendFrame(BIN_OP_I2C, frame, I2C_BUF_HDR + i2c.nRead);
+        if (i2c.seq != SEQ_NONE) {
+            ts_usbSend((uint8_t *)okStr, usprintf(okStr, "OK #%d\n", i2c.seq));
+        }
         goto handle_i2c_custom_finally;
     }
-    int temp = usprintf(hexStr, "I2: %x, %02x", i2c.channel, i2c.flags);
-    chr = &hexStr[temp];
-    if (i2c.nRead) {
-        hexStr = pvPortMalloc(2 * i2c.nRead + 24);
+
+    // A write only transaction is not reported, unless the host waits for its sequence ID
+    if (!i2c.nRead && i2c.seq == SEQ_NONE)
+        goto handle_i2c_custom_finally;
+
+    // 'I2: 3, 0f, <hexData> #65535\n'
+    // Only replies of transactions too long for a slot need the heap
+    if (i2c.nRead <= I2C_SLOT_LEN) {
+        hexStr = g_i2cReplyStr;
+    } else {
+        hexStr = pvPortMalloc(I2C_REPLY_LEN(i2c.nRead));
         if (!hexStr) {
             UARTprintf("handle_i2c_custom(): Could not allocate hexStr buffer!\n");
-            REPORT_ERROR("ER:0022\n");
+            reportError("ER:0022\n", i2c.seq);
             goto handle_i2c_custom_finally;
         }
-        int temp = usprintf(hexStr, "I2: %x, %02x", i2c.channel, i2c.flags);
-        chr = &hexStr[temp];
-
+    }
+    chr = hexStr;
+    chr += usprintf(chr, "I2: %x, %02x", i2c.channel, i2c.flags);
+    if (i2c.nRead) {
         *chr++ = ',';
         *chr++ = ' ';
         chr = buffToHex(i2c.readBuff, i2c.nRead, chr);
-        temp += 2 + 2 * i2c.nRead;
-
-        *chr++ = '\n';
-        *chr++ = '\0';
-        temp += 1;
-        ts_usbSend((uint8_t *)hexStr, temp);
     }
+    if (i2c.seq != SEQ_NONE) {
+        chr += usprintf(chr, " #%d", i2c.seq);
+    }
+    *chr++ = '\n';
+    ts_usbSend((uint8_t *)hexStr, chr - hexStr);
 
 handle_i2c_custom_finally:
-    vPortFree(i2c.readBuff);  i2c.readBuff  = NULL;
-    vPortFree(i2c.writeBuff); i2c.writeBuff = NULL;
-    vPortFree(hexStr); hexStr = NULL;
+    i2c_custom_free(&i2c);
+    if (hexStr != g_i2cReplyStr) {
+        vPortFree(hexStr);
+    }
+    hexStr = NULL;
 }
 
 // b = base_addr
@@ -314,6 +388,9 @@ static void _isr_notify(unsigned flags, BaseType_t *hpw)
     isrFlags |= flags;
     if (isrFlags == 0x0F) {
         isrFlags = 0;
+#ifdef PRF_ENABLE
+        g_i2c_cycle_done = PRF_CYCLES();
+#endif
         xTaskNotifyFromISR(hPcfInReader, 0, eNoAction, hpw);
     }
 }
@@ -346,6 +423,7 @@ void i2c_isr(unsigned channel)
             // Start a single byte read
             ledOut(2);
             state->currentPcf = 0;
+            state->i2c_state = I2C_PCF;
             pcf = state->pcf_state;
             // Setup first read or write
             while(!setup_pcf_rw(b, pcf)) {
@@ -353,12 +431,12 @@ void i2c_isr(unsigned channel)
                 if (state->currentPcf >= PCF_MAX_PER_CHANNEL){
                     // Nothing to do, notify PCF_Reader
                     state->i2c_state = I2C_IDLE;
+                    prfStop(PRF_I2C_SCAN_0 + channel, g_i2c_cycle_start);
                     _isr_notify((1 << channel), &hpw);
                     break;
                 }
                 pcf++;
             }
-            state->i2c_state = I2C_PCF;
             break;
 
         case I2C_PCF:
@@ -370,6 +448,12 @@ void i2c_isr(unsigned channel)
             // Errata I2C#07: DATACK bit is not cleared on read!
             if (mcs & (I2C_MCS_ADRACK | I2C_MCS_ARBLST | I2C_MCS_CLKTO)) {
                 pcf->err_cnt++;
+#ifdef PRF_ENABLE
+            } else if (pcf->flags & FPCF_RULE_PEND) {
+                // Quick rule output has been written to the PCF
+                pcf->flags &= ~FPCF_RULE_PEND;
+                prfStop(PRF_RULE_I2C, pcf->rule_stamp);
+#endif
             } else if (pcf->value_target && (pcf->flags & FPCF_RENABLED)) {
                 // No error, take read data value and store it
                 *(pcf->value_target) = HWREG(b + I2C_O_MDR);
@@ -378,7 +462,9 @@ void i2c_isr(unsigned channel)
             do {
                 state->currentPcf++;
                 if (state->currentPcf >= PCF_MAX_PER_CHANNEL){
+                    g_switchSampleTime[channel] = US_TIMESTAMP();
                     state->i2c_state = I2C_IDLE;
+                    prfStop(PRF_I2C_SCAN_0 + channel, g_i2c_cycle_start);
                     _isr_notify((1 << channel), &hpw);
                     break;
                 }
@@ -514,6 +600,9 @@ void trigger_i2c_cycle()
     }
     // Trigger a new i2c sequence (takes < 0.5 us until completion)
     t_i2cChannelState *s = g_sI2CInst;
+#ifdef PRF_ENABLE
+    g_i2c_cycle_start = PRF_CYCLES();
+#endif
     for (unsigned i=0; i<=3; i++) {
         s->i2c_state = I2C_START;
 
@@ -555,6 +644,16 @@ void trigger_i2c_cycle()
     }
 }
 
+uint32_t get_i2c_cycle_start()
+{
+    return g_i2c_cycle_start;
+}
+
+uint32_t get_i2c_cycle_done()
+{
+    return g_i2c_cycle_done;
+}
+
 void print_pcf_state()
 {
     UARTprintf("Syntax: R/W[HW_INDEX]: VAL (ERR_CNT)\n");
@@ -33,6 +33,11 @@ typedef struct {
     // uint8_t value;
     uint8_t last_mcs;
     unsigned err_cnt;
+#ifdef PRF_ENABLE
+    // Cycle counter value of the PCF scan which sampled the input that
+    // triggered a quick rule on this output (valid if FPCF_RULE_PEND is set)
+    uint32_t rule_stamp;
+#endif
     // -------------------
     //  Only for outputs:
     // -------------------
@@ -44,6 +49,7 @@ typedef struct {
 // bit masks for t_pcf_state->flags
 #define FPCF_RENABLED (1<<0)    // 1 = Read PCF
 #define FPCF_WENABLED (1<<1)    // 1 = Write PCF
+#define FPCF_RULE_PEND (1<<2)   // 1 = quick rule latency measurement pending
 
 // t_i2cCustom.flags:
 #define I2CC_W_ADR_NACK 0
@@ -59,8 +65,27 @@ typedef struct {
     uint8_t *readBuff;
     uint8_t *writeBuff;
     uint8_t flags;
+    bool binReply;      // reply with a binary frame instead of an `I2:` line
+    int32_t seq;        // sequence ID of the I2C command, SEQ_NONE if there is none
+    int8_t slot;        // index into g_i2cSlots, -1 = buffer is on the heap
 } t_i2cCustom;
 
+// Preallocated buffers for custom I2C transactions, so the common short ones
+// do not go through pvPortMalloc() / vPortFree()
+#define I2C_N_SLOTS   4     // transactions which can be queued without heap
+#define I2C_SLOT_LEN 32     // max. bytes written or read in a slot
+
+// Layout of a transaction buffer (slot or heap):
+// [channel, flags, write data / read data]
+// Both directions share the data area, i2c_tx_rx_n() is done writing before it reads.
+// The whole buffer is sent out as BIN_OP_I2C reply frame.
+#define I2C_BUF_HDR   2
+
+typedef struct {
+    volatile bool used;
+    uint8_t buf[I2C_BUF_HDR + I2C_SLOT_LEN];
+} t_i2cSlot;
+
 typedef enum{
     I2C_START,  // start scanning
     I2C_PCF,    // scan in progress, notify when done
@@ -85,6 +110,10 @@ typedef struct {
 void init_i2c_system(bool isr_init);
 // Shall be called every 1 ms to keep PCF transactions going
 void trigger_i2c_cycle();
+// Cycle counter value when the last PCF scan has been triggered
+uint32_t get_i2c_cycle_start();
+// Cycle counter value when the last I2C ISR of the last PCF scan has finished
+uint32_t get_i2c_cycle_done();
 // Print table of state and error counts to UART
 void print_pcf_state();
 // Return pointer to pcf_state instance of this pin
@@ -93,6 +122,10 @@ t_pcf_state *get_pcf(t_hw_index *pin);
 void set_bcm(uint8_t *bcmBuffer, uint8_t pin, uint8_t pwmValue);
 // Return PWM value of certain pin from bcmbuffer
 uint8_t get_bcm(uint8_t *bcmBuffer, uint8_t pin);
+// Get buffers for i2c->nWrite / i2c->nRead and copy wData into it. Returns false if out of memory
+bool i2c_custom_alloc(t_i2cCustom *i2c, const uint8_t *wData);
+// Release the buffers of a transaction which has been dropped or handled
+void i2c_custom_free(t_i2cCustom *i2c);
 // carry out a custom i2c transaction and yield until done
 void handle_i2c_custom();
 // Send / receive byte over i2c and yield until done (isr & freeRTOS must be setup)
@@ -8,6 +8,7 @@
 #include "myTasks.h"
 #include "switch_matrix.h"
 #include "quick_rules.h"
+#include "profiler.h"
 
 bool g_reDiscover = 0;
 TaskHandle_t hPcfInReader = NULL;
@@ -18,6 +19,21 @@ t_switchStateConverter g_SwitchStateSampled;    //Read values of last I2C scan
 t_switchStateConverter g_SwitchStateNoDebounce; //Debouncing-OFF flags
 t_switchStateConverter g_SwitchStateDebounced;  //Debounced values (the same after 4 reads)
 t_switchStateConverter g_SwitchStateToggled;    //Bits which changed
+// US_TIMESTAMP() when the last sample of a t_channel completed,
+// set by the I2C ISR (channel 0 - 3) and readSwitchMatrix()
+volatile uint32_t g_switchSampleTime[C_INVALID];
+t_switchStateConverter g_SwitchStateUrgent;     //Inputs which bypass the coalescing window
+t_switchStateConverter g_SwitchStateSubscribed; //Inputs which are reported as switch events
+// Binary switch events are collected for up to g_sweWindow ms
+// or up to g_sweFlushLen bytes, before they are sent as one frame
+uint8_t g_sweWindow = 0;
+uint16_t g_sweFlushLen = REPORT_SWITCH_BIN_SIZE;
+// SWS request of the command parser, answered by process_IO() right after debouncing
+static volatile struct {
+    bool pending;
+    bool sampled;
+    int32_t seq;
+} g_swsReq;
 // to keep track of pulsed ouputs
 static t_PCLOutputByte g_outWriterList[OUT_WRITER_LIST_LEN];
 
@@ -95,8 +111,9 @@ void reportSwitchStates() {
     uint32_t tempValue;
     ustrncpy(outBuffer, "SE:", REPORT_SWITCH_BUF_SIZE); // SE = Switch event
     for ( i = 0; i < N_LONGS; i++ ) {                   // Go through all 32 bit Long-values
-        if ( g_SwitchStateToggled.longValues[i] ) {     // If a bit is set
-            tempValue = g_SwitchStateToggled.longValues[i];
+        // Only the inputs the host subscribed to
+        tempValue = g_SwitchStateToggled.longValues[i] & g_SwitchStateSubscribed.longValues[i];
+        if ( tempValue ) {                              // If a bit is set
             for ( j=0; j<=31; j++ ) {
                 //We found a bit that changed, report over serial USB
                 if ( tempValue & 0x00000001 ) {
@@ -111,6 +128,7 @@ void reportSwitchStates() {
                     );
                     if ( charsWritten >= REPORT_SWITCH_BUF_SIZE-10 ) {
                         UARTprintf("reportSwitchStates(): Too much changed, string buffer overflow!\n");
+                        prfCount(PRF_CNT_SE_LOST, 1);
                         return;
                     }
                 }
@@ -128,6 +146,160 @@ void reportSwitchStates() {
     }
 }
 
+// Lossless queue of binary switch events, until the host takes them.
+// Head, tail and release are free running, index with & (SWE_RING_LEN - 1).
+static uint16_t g_sweRec[SWE_RING_LEN];     // hwIndex | SWE_BIN_STATE
+static uint32_t g_sweTs[SWE_RING_LEN];      // US_TIMESTAMP() of the sample
+static unsigned g_sweHead = 0;              // next free entry
+static unsigned g_sweTail = 0;              // oldest entry not yet sent
+static unsigned g_sweRelease = 0;           // entries before this may be sent
+static unsigned g_sweLost = 0;              // events dropped since the last overflow marker
+static unsigned g_sweMaxFill = 0;           // high-water mark
+static bool g_sweWithTime = false;          // record format of the last frame
+// Tick count when the oldest unreleased entry was added
+static TickType_t g_sweFirst = 0;
+
+static void swePut(uint16_t rec, uint32_t ts) {
+    unsigned i = g_sweHead & (SWE_RING_LEN - 1);
+    if (g_sweHead == g_sweRelease) {
+        g_sweFirst = xTaskGetTickCount();
+    }
+    g_sweRec[i] = rec;
+    g_sweTs[i] = ts;
+    g_sweHead++;
+    if (g_sweHead - g_sweTail > g_sweMaxFill) {
+        g_sweMaxFill = g_sweHead - g_sweTail;
+    }
+}
+
+static void swePush(uint16_t rec, uint32_t ts) {
+    // Once full, drop events until there is space for the overflow marker
+    if (g_sweLost || g_sweHead - g_sweTail >= SWE_RING_LEN) {
+        g_sweLost++;
+        prfCount(PRF_CNT_SE_LOST, 1);
+        return;
+    }
+    swePut(rec, ts);
+}
+
+static void sweDrain(bool withTime) {
+    // Send the released entries as long as they fit in the USB buffer,
+    // never make room by flushing it
+    static uint8_t frame[REPORT_SWITCH_BIN_SIZE];
+    unsigned i, n, recLen = withTime ? 6 : 2, maxRecs = g_sweFlushLen / recLen;
+    uint8_t *r;
+    g_sweWithTime = withTime;
+    while (g_sweTail != g_sweRelease) {
+        n = g_sweRelease - g_sweTail;
+        if (n > maxRecs) {
+            n = maxRecs;
+        }
+        r = frame;
+        for (i = g_sweTail; i != g_sweTail + n; i++) {
+            *r++ = g_sweRec[i & (SWE_RING_LEN - 1)] & 0xFF;
+            *r++ = g_sweRec[i & (SWE_RING_LEN - 1)] >> 8;
+            if (withTime) {
+                *r++ = g_sweTs[i & (SWE_RING_LEN - 1)];
+                *r++ = g_sweTs[i & (SWE_RING_LEN - 1)] >> 8;
+                *r++ = g_sweTs[i & (SWE_RING_LEN - 1)] >> 16;
+                *r++ = g_sweTs[i & (SWE_RING_LEN - 1)] >> 24;
+            }
+        }
+        if (!ts_usbTrySendFrame(BIN_OP_SWE, frame, r - frame)) {
+            // Host is busy, try again next tick
+            return;
+        }
+        g_sweTail += n;
+    }
+}
+
+static void flushSwitchEvents() {
+    // Send what is left over from binary mode
+    g_sweRelease = g_sweHead;
+    sweDrain(g_sweWithTime);
+}
+
+static void reportSwitchEventsBin(bool withTime) {
+    // Queue changed switch states. They are sent as BIN_OP_SWE frames of
+    // 2 byte records, or 6 byte records with the timestamp of the sample which
+    // completed the debouncing. Queued events are released when g_sweWindow ms
+    // have passed since the oldest one, when they fill a frame of g_sweFlushLen
+    // bytes, when an urgent input toggled or above the high-water mark.
+    unsigned i, j, recLen = withTime ? 6 : 2;
+    uint32_t tempValue, ts;
+    uint16_t rec;
+    bool isUrgent = false;
+    if (g_sweLost && g_sweHead - g_sweTail < SWE_RING_LEN) {
+        // Tell the host how many events it missed
+        swePut(SWE_BIN_OVERFLOW, g_sweLost);
+        g_sweLost = 0;
+        isUrgent = true;
+    }
+    for (i = 0; i < N_LONGS; i++) {
+        tempValue = g_SwitchStateToggled.longValues[i] & g_SwitchStateSubscribed.longValues[i];
+        if (!tempValue) {
+            continue;
+        }
+        if (tempValue & g_SwitchStateUrgent.longValues[i]) {
+            isUrgent = true;
+        }
+        // longValues[0 - 1] = switch matrix, then 2 words per I2C channel
+        ts = g_switchSampleTime[i < 2 ? C_SWITCH_MATRIX : (i - 2) / 2];
+        while (tempValue) {
+            j = __builtin_ctz(tempValue);   // index of the lowest set bit
+            tempValue &= tempValue - 1;     // clear it
+            rec = i * 32 + j;
+            if ((g_SwitchStateDebounced.longValues[i] >> j) & 1) {
+                rec |= SWE_BIN_STATE;
+            }
+            swePush(rec, ts);
+        }
+    }
+    if (isUrgent ||
+        xTaskGetTickCount() - g_sweFirst >= g_sweWindow ||
+        (g_sweHead - g_sweRelease + 1) * recLen > g_sweFlushLen ||
+        g_sweHead - g_sweTail >= SWE_RING_HIGH_WATER) {
+        g_sweRelease = g_sweHead;
+    }
+    sweDrain(withTime);
+}
+
+void printSwitchEventQueue() {
+    UARTprintf("tWindow: %d ms, nBytes: %d\n", g_sweWindow, g_sweFlushLen);
+    UARTprintf("queued: %d / %d, max: %d, lost: %d\n", g_sweHead - g_sweTail, SWE_RING_LEN, g_sweMaxFill, g_sweLost);
+}
+
+void reportSwitchSamples() {
+    // Report the raw (not debounced) input states whenever they differ from
+    // the previous tick, together with the tick count they were sampled at.
+    // "SR:0001a2f0=<N_LONGS x 8 hex digits>\n"
+    static char outBuffer[REPORT_SAMPLE_BUF_SIZE];
+    static uint32_t lastSample[N_LONGS];
+    uint16_t charsWritten;
+    uint8_t i;
+    bool isChanged = false;
+    for (i = 0; i < N_LONGS; i++) {
+        if (g_SwitchStateSampled.longValues[i] != lastSample[i]) {
+            lastSample[i] = g_SwitchStateSampled.longValues[i];
+            isChanged = true;
+        }
+    }
+    if (!isChanged) {
+        return;
+    }
+    charsWritten = usnprintf(outBuffer, REPORT_SAMPLE_BUF_SIZE, "SR:%08x=", xTaskGetTickCount());
+    for (i = 0; i < N_LONGS; i++) {
+        charsWritten += usnprintf(
+            &outBuffer[charsWritten],
+            REPORT_SAMPLE_BUF_SIZE - charsWritten,
+            "%08x",
+            lastSample[i]
+        );
+    }
+    outBuffer[charsWritten] = '\n';
+    ts_usbSend((uint8_t*) outBuffer, charsWritten + 1);
+}
+
 static void fillBitRule(t_hw_index *pin, t_PCLOutputByte *w, int16_t tPulse, uint16_t highPower, uint16_t lowPower){
     // Fill the output pulse state `b`
     t_BitModifyRules *b = &(w->bitRules[pin->pinIndex]);
@@ -144,7 +316,7 @@ static void fillBitRule(t_hw_index *pin, t_PCLOutputByte *w, int16_t tPulse, uin
     UARTprintf("fillBitRule(): !!! trouble !!!\n");
 }
 
-void setPCFOutput(t_hw_index *pin, int16_t tPulse, uint16_t highPower, uint16_t lowPower) {
+static void updateOutWriterList(t_hw_index *pin, int16_t tPulse, uint16_t highPower, uint16_t lowPower) {
     // Will add or update a job in the output BCM list
     t_PCLOutputByte *w = g_outWriterList;
     if (pin->channel < C_I2C0 ||
@@ -175,6 +347,12 @@ void setPCFOutput(t_hw_index *pin, int16_t tPulse, uint16_t highPower, uint16_t
     REPORT_ERROR("ER:0004\n");
 }
 
+void setPCFOutput(t_hw_index *pin, int16_t tPulse, uint16_t highPower, uint16_t lowPower) {
+    uint32_t t0 = PRF_CYCLES();
+    updateOutWriterList(pin, tPulse, highPower, lowPower);
+    prfStop(PRF_SET_OUTPUT, t0);
+}
+
 void print_out_writer_list()
 {
     UARTprintf(" N: [CH,I2C] PWM0 PWM1 ...\n");
@@ -227,10 +405,43 @@ static void handleBitRules(unsigned dt) {
     }
 }
 
+bool requestSwitchSnapshot(bool sampled, int32_t seq) {
+    if (g_swsReq.pending) {
+        return false;
+    }
+    g_swsReq.sampled = sampled;
+    g_swsReq.seq = seq;
+    g_swsReq.pending = true;
+    return true;
+}
+
+// The I2C scan of the next cycle has not started yet, so both states
+// belong to the cycle which has just been debounced
+static void sendSwitchSnapshot() {
+    // [u32 tick] [debounced] [sampled]
+    static uint8_t snapshot[SWS_SNAPSHOT_LEN];
+    char okStr[12];
+    TickType_t tick = xTaskGetTickCount();
+    snapshot[0] = tick;
+    snapshot[1] = tick >> 8;
+    snapshot[2] = tick >> 16;
+    snapshot[3] = tick >> 24;
+    memcpy(&snapshot[4], g_SwitchStateDebounced.charValues, N_CHARS);
+    memcpy(&snapshot[4 + N_CHARS], g_SwitchStateSampled.charValues, N_CHARS);
+    ts_usbSendFrame(BIN_OP_SWS, snapshot, g_swsReq.sampled ? SWS_SNAPSHOT_LEN : 4 + N_CHARS);
+    if (g_swsReq.seq != SEQ_NONE) {
+        ts_usbSend((uint8_t *)okStr, usprintf(okStr, "OK #%d\n", g_swsReq.seq));
+    }
+    g_swsReq.pending = false;
+}
+
 // Called every 1 ms (hopefully) after new states have been read
 static void process_IO()
 {
     unsigned i;
+    uint32_t t0 = PRF_CYCLES(), t1, nToggles = 0;
+    // Dump raw input states for offline analysis
+    if (g_recordSwitchSamples) reportSwitchSamples();
     // Run debounce algo (14 us)
     debounceAlgo(
         g_SwitchStateSampled.longValues,
@@ -238,10 +449,33 @@ static void process_IO()
         g_SwitchStateToggled.longValues,
         g_SwitchStateNoDebounce.longValues
     );
+    prfStop(PRF_DEBOUNCE, t0);
+    if (g_swsReq.pending) sendSwitchSnapshot();
+    for (i = 0; i < N_LONGS; i++)
+        nToggles += __builtin_popcount(g_SwitchStateToggled.longValues[i]);
+    prfCount(PRF_CNT_TOGGLES, nToggles);
     // Notify Mission pinball over serial port of all changed switches
-    if (g_reportSwitchEvents) reportSwitchStates();
+    if (g_reportSwitchEvents >= SWE_BINARY) {
+        // called every tick, to flush when the window is over
+        t1 = PRF_CYCLES();
+        reportSwitchEventsBin(g_reportSwitchEvents == SWE_BIN_TS);
+        prfStop(PRF_REPORT_SW, t1);
+    } else {
+        // Don't keep binary events from before a SWE 0 / 1
+        flushSwitchEvents();
+        if (g_reportSwitchEvents && nToggles) {
+            t1 = PRF_CYCLES();
+            reportSwitchStates();
+            prfStop(PRF_REPORT_SW, t1);
+        }
+    }
+    t1 = PRF_CYCLES();
     handleBitRules(DEBOUNCER_READ_PERIOD);
+    prfStop(PRF_BIT_RULES, t1);
+    t1 = PRF_CYCLES();
     processQuickRules();
+    prfStop(PRF_QUICK_RULES, t1);
+    prfStop(PRF_PROCESS_IO, t0);
     if (g_reDiscover) {
         g_reDiscover = 0;
         for (i=0; i<MAX_QUICK_RULES; i++) disableQuickRule(i);
@@ -262,9 +496,12 @@ void task_pcf_io(void *pvParameters)
     //     and report its result on USB
     TickType_t xLastWakeTime;
     unsigned i;
+    uint32_t t0;
     // hPcfInReader = xTaskGetCurrentTaskHandle();
     UARTprintf("%22s: Started! Cycle time = %d ms\n", "task_pcf_io()", DEBOUNCER_READ_PERIOD);
     if (!g_i2c_queue) g_i2c_queue = xQueueCreate(32, sizeof(t_i2cCustom));
+    // Report events of all inputs until the host says otherwise
+    for (i=0; i<N_LONGS; i++) g_SwitchStateSubscribed.longValues[i] = 0xFFFFFFFF;
     for (i=0; i<MAX_QUICK_RULES; i++) disableQuickRule(i);
     for (i=0; i<OUT_WRITER_LIST_LEN; i++) g_outWriterList[i].channel = C_INVALID;
     vTaskDelay(1);
@@ -288,19 +525,24 @@ void task_pcf_io(void *pvParameters)
 
         // Wait for all 4 x I2C channel ISRs to complete
         xTaskNotifyWait(0, 0, NULL, portMAX_DELAY);
+        prfStop(PRF_IO_WAKEUP, get_i2c_cycle_done());
         // ledOut(2);
         process_IO();
         handle_i2c_custom();
         //Run every 1 ms --> 4 ms debounce latency
+        if (xTaskGetTickCount() - xLastWakeTime > DEBOUNCER_READ_PERIOD / portTICK_PERIOD_MS) {
+            // vTaskDelayUntil() will return immediately, we've missed a cycle
+            prfCount(PRF_CNT_OVERRUN, 1);
+        }
         vTaskDelayUntil(&xLastWakeTime, DEBOUNCER_READ_PERIOD / portTICK_PERIOD_MS);
         // vTaskDelayUntil(&xLastWakeTime, 3000);
         // ledOut(0);
         //Start background I2C scanner (takes ~ 400 us with all channels fully loaded)
         trigger_i2c_cycle();
         // happens in parallel with the I2C scan so should take about the same time
-        // startTimer();
+        t0 = PRF_CYCLES();
         readSwitchMatrix();  // 317 us
-        // unsigned cycles = stopTimer(); UARTprintf("%d cycles, %d us\n", cycles, cycles * 1000ll * 1000 / SYSTEM_CLOCK);
+        prfStop(PRF_SWITCH_MATRIX, t0);
         g_bFeedWatchdog = true;
         i++;
     }
@@ -12,6 +12,30 @@
 #define DEBOUNCER_READ_PERIOD 1
 // Char buffer size for reporting `input changed events`
 #define REPORT_SWITCH_BUF_SIZE 90
+// Max. payload of one binary switch event frame [bytes]
+#define REPORT_SWITCH_BIN_SIZE 256
+// Binary switch event record: u16 with bits 0 - 8 = hwIndex, bit 15 = new state
+// [, u32 timestamp of the sample in us]
+#define SWE_BIN_STATE (1 << 15)
+
+// g_reportSwitchEvents modes
+#define SWE_OFF    0
+#define SWE_TEXT   1    // `SE:0f8=1 ...` lines
+#define SWE_BINARY 2    // BIN_OP_SWE reply frames of 2 byte records
+#define SWE_BIN_TS 3    // BIN_OP_SWE reply frames of 6 byte records with timestamp
+// Max. time binary switch events are collected before sending them [ms]
+#define SWE_WINDOW_MAX 10
+// Switch events queued until the host takes them (power of 2). Must hold a
+// tick in which all 320 inputs toggle, plus the overflow marker
+#define SWE_RING_LEN 512
+// Above this many queued events they are sent right away
+#define SWE_RING_HIGH_WATER (SWE_RING_LEN * 3 / 4)
+// Record hwIndex of the overflow marker, its timestamp is the number of lost events
+#define SWE_BIN_OVERFLOW 0x1FF
+// SWS reply: u32 tick, debounced and sampled state
+#define SWS_SNAPSHOT_LEN (4 + 2 * N_CHARS)
+// Char buffer size for reporting raw input samples ("SR:" + 8 + "=" + 80 + "\n")
+#define REPORT_SAMPLE_BUF_SIZE 96
 // Max. number of output channels
 #define OUT_WRITER_LIST_LEN 64
 // How many uint32_t values to express all the input states
@@ -75,6 +99,11 @@ extern t_switchStateConverter g_SwitchStateSampled;
 extern t_switchStateConverter g_SwitchStateDebounced;
 extern t_switchStateConverter g_SwitchStateToggled;
 extern t_switchStateConverter g_SwitchStateNoDebounce;
+extern volatile uint32_t g_switchSampleTime[C_INVALID];
+extern t_switchStateConverter g_SwitchStateUrgent;
+extern t_switchStateConverter g_SwitchStateSubscribed;
+extern uint8_t g_sweWindow;
+extern uint16_t g_sweFlushLen;
 extern bool g_reDiscover;
 
 //------------------------
@@ -93,6 +122,17 @@ void print_out_writer_list();
 // asInput: is this supposed to be an input (1) or output (0)
 t_hw_index decodeHwIndex(uint16_t hwIndex, bool asInput);
 
+// Report the raw input states over USB if they changed since the last call
+void reportSwitchSamples();
+
+// Ask process_IO() to send an SWS snapshot right after the next debouncing
+// step, followed by `OK #<seq>` unless seq is SEQ_NONE. Returns false while
+// the previous request has not been answered yet.
+bool requestSwitchSnapshot(bool sampled, int32_t seq);
+
+// Print settings and fill level of the switch event queue to UART
+void printSwitchEventQueue();
+
 // Orchestrates the periodic reading and writing of PCF chips over I2C
 void task_pcf_io(void *pvParameters);
 
@@ -24,6 +24,7 @@
 #include "myTasks.h"
 #include "io_manager.h"
 #include "mySpi.h"
+#include "profiler.h"
 
 TaskHandle_t hUSBCommandParser = NULL;
 volatile bool g_bFeedWatchdog = true;
@@ -53,6 +54,16 @@ uint32_t stopTimer() {
     HWREG(TIMER1_BASE + TIMER_O_TAV) = 0;
     return (timerValue);
 }
+// Wide Timer 0A counts down at 1 MHz from 0xFFFFFFFF, read it with US_TIMESTAMP()
+// (the prescaler only divides when counting down)
+void configureUsTimer() {
+    ROM_SysCtlPeripheralEnable(SYSCTL_PERIPH_WTIMER0);
+    ROM_SysCtlPeripheralReset(SYSCTL_PERIPH_WTIMER0);
+    ROM_TimerConfigure(WTIMER0_BASE, TIMER_CFG_SPLIT_PAIR | TIMER_CFG_A_PERIODIC);
+    ROM_TimerPrescaleSet(WTIMER0_BASE, TIMER_A, SYSTEM_CLOCK / 1000000 - 1);
+    ROM_TimerLoadSet(WTIMER0_BASE, TIMER_A, 0xFFFFFFFF);
+    ROM_TimerEnable(WTIMER0_BASE, TIMER_A);
+}
 uint32_t getTimer(){
     static uint32_t timerValue=0;
     timerValue += stopTimer()>>8;
@@ -270,6 +281,10 @@ int main(void) {
     init_i2c_system(false);
     // Init debug HW timer for measuring processor cycles (%timeit)
     configureTimer();
+    // Init free running us timer for timestamping switch events
+    configureUsTimer();
+    // Init DWT cycle counter for the execution time statistics (PRF command)
+    prfInit();
     // Init 3 SPI channels for setting ws2811 LEDs
     spiSetup();
     // Init the 4 high speed PWM output channels
@@ -3,6 +3,8 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include "inc/hw_memmap.h"
+#include "inc/hw_types.h"
+#include "inc/hw_timer.h"
 #include "driverlib/rom.h"
 #include "driverlib/gpio.h"
 
@@ -23,6 +25,9 @@
 #define DISABLE_SOLENOIDS() ROM_GPIOPinWrite(GPIO_PORTE_BASE, GPIO_PIN_0, 0)
 #define ENABLE_SOLENOIDS()  ROM_GPIOPinWrite(GPIO_PORTE_BASE, GPIO_PIN_0, 1)
 
+// Free running timestamp [us] from Wide Timer 0A, wraps around after 71 minutes
+#define US_TIMESTAMP() (~HWREG(WTIMER0_BASE + TIMER_O_TAV))
+
 #define MIN(X,Y) ((X) < (Y) ? (X) : (Y))
 #define MAX(X,Y) ((X) > (Y) ? (X) : (Y))
 
@@ -33,6 +38,7 @@ extern volatile bool g_bWatchdogIsTripped;
 // Functions
 //---------------------
 void configureTimer();
+void configureUsTimer();
 void startTimer();
 uint32_t stopTimer();
 uint32_t getTimer();
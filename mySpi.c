@@ -21,6 +21,7 @@
 #include "usblib/device/usbdevice.h"
 #include "myTasks.h"
 #include "mySpi.h"
+#include "profiler.h"
 
 //*****************************************************************************
 // The control table used by the uDMA controller.  This table must be aligned
@@ -40,6 +41,8 @@ unsigned char ucControlTable[1024] __attribute__ ((aligned(1024)));
 // Global vars
 //*****************************************************************************
 t_spiTransferState g_spiState[3];
+static volatile uint8_t g_spiSyncMask;  //Channels waiting for a synchronized start
+static volatile uint8_t g_spiSyncWait;  //... which are still sending their previous frame
 uint8_t g_spiBuffer[3][N_LEDS_MAX*3];   //3 channels * 3 colors --> 9.2 kByte
 
 
@@ -90,7 +93,7 @@ void spiHwSetup( uint8_t channel, uint32_t ssin_base, uint8_t intNo, uint32_t dm
     // USer internal 80 MHz clock
     ROM_SSIClockSourceSet( ssin_base, SSI_CLOCK_SYSTEM );
     // SPI at 3.2 MHz, 16 bit SPI words (encoding 4 bit data each)
-    ROM_SSIConfigSetExpClk( ssin_base, SYSTEM_CLOCK, SSI_FRF_MOTO_MODE_1, SSI_MODE_MASTER, 3200000, 16 );
+    ROM_SSIConfigSetExpClk( ssin_base, SYSTEM_CLOCK, SSI_FRF_MOTO_MODE_1, SSI_MODE_MASTER, SPI_DEFAULT_SPEED, 16 );
     // Enable it
     ROM_SSIEnable( ssin_base );
     // Enable DMA
@@ -111,6 +114,11 @@ void spiHwSetup( uint8_t channel, uint32_t ssin_base, uint8_t intNo, uint32_t dm
     g_spiState[channel].baseAdr = ssin_base;
     g_spiState[channel].dmaChannel = dmaChannel;
     g_spiState[channel].intNo = intNo;
+    g_spiState[channel].spiSpeed = SPI_DEFAULT_SPEED;
+    g_spiState[channel].nLatchWords = spiLatchWords( SPI_DEFAULT_SPEED );
+    g_spiState[channel].frontBuffer = g_spiBuffer[channel];
+    g_spiState[channel].backBuffer = g_spiBuffer[channel];
+    g_spiState[channel].pendingLen = -1;
     g_spiState[channel].semaToReleaseWhenFinished = xSemaphoreCreateBinary();
     xSemaphoreGive( g_spiState[channel].semaToReleaseWhenFinished );
 }
@@ -159,6 +167,29 @@ void spiSetup(){
     spiHwSetup( 2, SSI3_BASE, INT_SSI3, UDMA_CH15_SSI3TX );
 }
 
+uint16_t spiLatchWords( uint32_t spiSpeed ){
+    // Round up and add one word, as the first one might still be in the FIFO
+    return ( (uint64_t)spiSpeed * SPI_LATCH_US / 1000000 ) / 16 + 1;
+}
+
+void spiPrintTiming( uint8_t channel ){
+    // Each WS2811 bit is encoded as 4 SPI bits, see g_ssi_lut
+    //   0 = 1000 --> T0H = 1 SPI bit, T0L = 3 SPI bits
+    //   1 = 1100 --> T1H = 2 SPI bits, T1L = 2 SPI bits
+    t_spiTransferState *state = &g_spiState[channel];
+    uint32_t tBit = 1000000000 / state->spiSpeed;   // [ns]
+    UARTprintf(
+        "%22s: T0H = %d, T0L = %d, T1H = %d, T1L = %d ns\n",
+        "spiPrintTiming()", tBit, 3 * tBit, 2 * tBit, 2 * tBit
+    );
+    UARTprintf(
+        "%22s: latch = %d us, DMA block = %d us\n",
+        "spiPrintTiming()",
+        state->nLatchWords * 16 * tBit / 1000,
+        SPI_DMA_BUFFER_SIZE * 16 * tBit / 1000
+    );
+}
+
 uint8_t *fillPiongBuffer( uint8_t *srcPointer, uint16_t *destPointer, int32_t *nBytesLeft ){
     // Encodes a data byte to 2 x 16 bit words to be sent over SPI to WS2811
     // Fills a complete Ping/Pong buffer (destPointer) and returns incremented
@@ -179,6 +210,35 @@ uint8_t *fillPiongBuffer( uint8_t *srcPointer, uint16_t *destPointer, int32_t *n
     return srcPointer;
 }
 
+// Same as fillPiongBuffer(), but looks up the colors of the LED indices in the palette
+void fillPiongBufferIndexed( t_spiTransferState *state, uint16_t *destPointer ){
+    uint8_t i, c;
+    if( state->nLEDBytesLeft <= 0 ){
+        return;
+    }
+    for( i=0; i<SPI_DMA_BUFFER_SIZE/2; i++ ){
+        c = state->palette[ (*state->currentLEDByte)*3 + state->colorIdx ];
+        *destPointer++ = g_ssi_lut[ c>>4 ];
+        *destPointer++ = g_ssi_lut[ c& 0x0F ];
+        if( ++state->colorIdx >= 3 ){
+            state->colorIdx = 0;
+            state->currentLEDByte++;
+        }
+        state->nLEDBytesLeft--;
+    }
+}
+
+static void refillPiongBuffer( t_spiTransferState *state, uint16_t *destPointer ){
+    if( state->palette ){
+        fillPiongBufferIndexed( state, destPointer );
+    } else {
+        state->currentLEDByte = fillPiongBuffer( state->currentLEDByte, destPointer, &state->nLEDBytesLeft );
+    }
+}
+
+static void spiSwapAndStart( uint8_t channel );
+static void spiSyncStart( bool fromISR );
+
 void spiISR(uint8_t channel)
 {
     //Is called by uDMA interrupt after one block has been transferred! (takes 640 us)
@@ -232,13 +292,26 @@ void spiISR(uint8_t channel)
         ROM_uDMAChannelTransferSet( state->dmaChannel | UDMA_PRI_SELECT,
                                        UDMA_MODE_BASIC, state->pingBuffer,
                                        (void *)(state->baseAdr + SSI_O_DR),
-                                       11 );    //10 * 16 * 1 / 3.2MHz = 50 us
+                                       state->nLatchWords );    //11 * 16 * 1 / 3.2MHz = 55 us
         ROM_uDMAChannelEnable( state->dmaChannel );
 //        ROM_SysCtlDelay( 1000 );
         state->state = SPI_IDLE;
         return;
 
     case SPI_IDLE:
+        // Keep the channel locked until all synchronized channels are idle
+        if( g_spiSyncMask & (1<<channel) ){
+            g_spiSyncWait &= ~(1<<channel);
+            if( g_spiSyncWait == 0 ){
+                spiSyncStart( true );
+            }
+            return;
+        }
+        // Swap in the next frame during the latch gap, keep the channel locked
+        if( state->pendingLen >= 0 ){
+            spiSwapAndStart( channel );
+            return;
+        }
         xSemaphoreGiveFromISR(state->semaToReleaseWhenFinished, NULL);
         return;
 
@@ -253,27 +326,144 @@ void spiISR(uint8_t channel)
         state->state = SPI_SEND_ZERO;    //Send 50 us of LOW to latch LEDs
     } else {
         // Otherwise refill the buffer
-        state->currentLEDByte = fillPiongBuffer( state->currentLEDByte, bufferToRefill, &state->nLEDBytesLeft );
+        temp = PRF_CYCLES();
+        refillPiongBuffer( state, bufferToRefill );
+        prfStop(PRF_FILL_PIONG, temp);
     }
 }
 
-void spiSend( uint8_t channel, int32_t nBytes ){
-    uint8_t *srcPointer;//, i;
+static void spiStart( uint8_t channel, int32_t nBytes ){
     t_spiTransferState *state = &g_spiState[channel];
     ASSERT( !ROM_uDMAChannelIsEnabled(state->dmaChannel) );
     ROM_uDMAChannelControlSet(  state->dmaChannel | UDMA_PRI_SELECT,
                                       UDMA_SIZE_16 | UDMA_SRC_INC_16 | UDMA_DST_INC_NONE | UDMA_ARB_4 );
     //Need to init the PING buffer first
-    srcPointer = g_spiBuffer[channel];
+    state->currentLEDByte = state->frontBuffer;
+    state->colorIdx = 0;
+    state->nLEDBytesLeft = nBytes;
 //    for( i=0; i<SPI_DMA_BUFFER_SIZE; i++ ){
 //        state->pingBuffer[i] = SPI_LOW_VALUE;
 //    }
-    srcPointer = fillPiongBuffer( srcPointer, state->pingBuffer, &nBytes );
-    state->currentLEDByte = srcPointer;
-    state->nLEDBytesLeft = nBytes;
+    refillPiongBuffer( state, state->pingBuffer );
     //Start transmission of PING buffer in the ISR
     state->state = SPI_SEND_PING;
     // Artificially Trigger SSI interrupt here
     IntTrigger( state->intNo );
     // As soon as the first DMA is finished, the ISR will take over control
 }
+
+void spiSend( uint8_t channel, int32_t nBytes ){
+    g_spiState[channel].palette = NULL;
+    g_spiState[channel].frontLen = nBytes;
+    spiStart( channel, nBytes );
+}
+
+void spiSendIndexed( uint8_t channel, int32_t nLeds ){
+    g_spiState[channel].palette = SPI_PALETTE(channel);
+    g_spiState[channel].frontLen = nLeds;
+    spiStart( channel, nLeds*3 );
+}
+
+void spiSetDoubleBuffer( uint8_t channel, bool on ){
+    t_spiTransferState *state = &g_spiState[channel];
+    state->doubleBuf = on;
+    state->backStale = false;
+    state->frontBuffer = g_spiBuffer[channel];
+    state->backBuffer = on ? &g_spiBuffer[channel][SPI_HALF_LEN] : g_spiBuffer[channel];
+    state->frontLen = 0;
+    state->pendingLen = -1;
+}
+
+// Make the pending back buffer the front buffer and send it
+static void spiSwapAndStart( uint8_t channel ){
+    t_spiTransferState *state = &g_spiState[channel];
+    uint8_t *temp = state->frontBuffer;
+    int32_t nBytes = state->pendingLen;
+    state->frontBuffer = state->backBuffer;
+    state->backBuffer = temp;
+    state->backStale = true;
+    state->pendingLen = -1;
+    if( state->pendingIndexed ){
+        spiSendIndexed( channel, nBytes );
+    } else {
+        spiSend( channel, nBytes );
+    }
+}
+
+// Start the pending frames of all channels in g_spiSyncMask right after each other
+static void spiSyncStart( bool fromISR ){
+    uint8_t ch;
+    for( ch=0; ch<3; ch++ ){
+        if( !(g_spiSyncMask & (1<<ch)) ){
+            continue;
+        }
+        if( g_spiState[ch].pendingLen >= 0 ){
+            spiSwapAndStart( ch );
+        } else if( fromISR ){
+            // Frame has been cancelled by spiOpenBack()
+            xSemaphoreGiveFromISR( g_spiState[ch].semaToReleaseWhenFinished, NULL );
+        } else {
+            xSemaphoreGive( g_spiState[ch].semaToReleaseWhenFinished );
+        }
+    }
+    g_spiSyncMask = 0;
+}
+
+void spiLatchSync( uint8_t mask, const int32_t *nBytes, uint8_t indexedMask ){
+    t_spiTransferState *state;
+    uint8_t ch;
+    taskENTER_CRITICAL();
+    for( ch=0; ch<3; ch++ ){
+        if( !(mask & (1<<ch)) ){
+            continue;
+        }
+        state = &g_spiState[ch];
+        state->pendingLen = nBytes[ch];
+        state->pendingIndexed = (indexedMask>>ch) & 1;
+        // Channels of an earlier, still waiting sync are locked or in g_spiSyncWait already
+        if( g_spiSyncMask & (1<<ch) ){
+            continue;
+        }
+        if( state->doubleBuf && !xSemaphoreTake( state->semaToReleaseWhenFinished, 0 ) ){
+            g_spiSyncWait |= 1<<ch;
+        }
+    }
+    g_spiSyncMask |= mask;
+    if( g_spiSyncWait == 0 ){
+        spiSyncStart( false );
+    }
+    taskEXIT_CRITICAL();
+}
+
+uint8_t *spiOpenBack( uint8_t channel, bool keep ){
+    t_spiTransferState *state = &g_spiState[channel];
+    taskENTER_CRITICAL();
+    state->pendingLen = -1;     // The ISR must not swap while the back buffer is written
+    taskEXIT_CRITICAL();
+    if( keep && state->backStale ){
+        // The front buffer is only read by the ISR, copying it is safe
+        memcpy( state->backBuffer, state->frontBuffer, state->frontLen );
+    }
+    state->backStale = false;
+    return state->backBuffer;
+}
+
+void spiLatch( uint8_t channel, int32_t nBytes, bool indexed ){
+    t_spiTransferState *state = &g_spiState[channel];
+    if( !state->doubleBuf ){
+        if( indexed ){
+            spiSendIndexed( channel, nBytes );
+        } else {
+            spiSend( channel, nBytes );
+        }
+        return;
+    }
+    taskENTER_CRITICAL();
+    state->pendingLen = nBytes;
+    state->pendingIndexed = indexed;
+    // If the channel is idle, send right away. Otherwise the ISR does it after the current frame
+    if( xSemaphoreTake( state->semaToReleaseWhenFinished, 0 ) ){
+        spiSwapAndStart( channel );
+    }
+    taskEXIT_CRITICAL();
+}
@@ -17,6 +17,14 @@
 #define N_LEDS_MAX 1024         //Max number of WS2811 LEDs per channel (limited by RAM)
 #define SPI_DMA_BUFFER_SIZE 128 //Number of 16 bit SPI words which will be precomputed
                                 // 200 = 1 ms worth of SPI data
+#define SPI_LATCH_US 50         //Min. time the line is kept low after a frame to latch the LEDs [us]
+#define SPI_DEFAULT_SPEED 3200000   //SPI bit rate after reset [Hz], 4 SPI bits = 1 WS2811 bit
+#define SPI_PALETTE_LEN 256     //Number of RGB colors of an indexed frame
+// In indexed mode, g_spiBuffer[channel] holds 1 byte per LED followed by the palette at its end
+#define N_LEDS_MAX_INDEXED (N_LEDS_MAX*3 - SPI_PALETTE_LEN*3)
+#define SPI_PALETTE(channel) (&g_spiBuffer[channel][N_LEDS_MAX_INDEXED])
+// In double buffered mode, g_spiBuffer[channel] is split into 2 frame buffers of this size
+#define SPI_HALF_LEN (N_LEDS_MAX*3/2)
 
 //*****************************************************************************
 // Custom types
@@ -31,6 +39,18 @@ typedef struct {
     uint8_t intNo;              //Hardware interrupt number
     uint8_t *currentLEDByte;    //points into g_spiBuffer
     int32_t nLEDBytesLeft;      //refers to data from g_spiBuffer
+    uint8_t *palette;           //NULL: g_spiBuffer holds RGB bytes, else LED indices into palette
+    uint8_t colorIdx;           //Next color (0-2) of the LED at currentLEDByte in indexed mode
+    // Double buffering
+    bool doubleBuf;             //Frames are written to backBuffer while frontBuffer is sent
+    bool backStale;             //backBuffer holds an older frame than frontBuffer
+    uint8_t *frontBuffer;       //Frame which is sent, points into g_spiBuffer
+    uint8_t *backBuffer;        //Frame which is written, same as frontBuffer if !doubleBuf
+    int32_t frontLen;           //Bytes of frontBuffer used by its frame (LEDs in indexed mode)
+    int32_t pendingLen;         //Bytes of backBuffer to send after the current frame, -1 = none
+    bool pendingIndexed;
+    uint32_t spiSpeed;          //SPI bit rate [Hz]
+    uint16_t nLatchWords;       //Number of SPI_LOW_VALUE words sent in SPI_SEND_ZERO
     // DMA stuff
     t_spiDmaState state;
     uint16_t pingBuffer[SPI_DMA_BUFFER_SIZE];   // 1 ms worth of SPI data
@@ -50,7 +70,24 @@ extern t_spiTransferState g_spiState[3];
 // Function / Task declaations
 //*****************************************************************************
 void spiSend( uint8_t channel, int32_t nBytes );
+// Send nLeds palette indices from g_spiBuffer[channel], looked up in SPI_PALETTE(channel)
+void spiSendIndexed( uint8_t channel, int32_t nLeds );
+// Switch double buffering of a channel on or off. The channel must be idle and locked
+void spiSetDoubleBuffer( uint8_t channel, bool on );
+// Double buffered mode: Returns the back buffer to write the next frame to.
+// If keep is set, it holds the current frame. A pending frame is cancelled
+uint8_t *spiOpenBack( uint8_t channel, bool keep );
+// Double buffered mode: Send the back buffer now or at the end of the current frame.
+// Otherwise same as spiSend() / spiSendIndexed()
+void spiLatch( uint8_t channel, int32_t nBytes, bool indexed );
+// Send the frames of all channels in mask at the same time, once the last of them
+// has finished its current frame. Single buffered channels must be locked
+void spiLatchSync( uint8_t mask, const int32_t *nBytes, uint8_t indexedMask );
 void spiSetup();
 void spiISR( uint8_t channel );
+// Number of 16 bit SPI words needed to keep the line low for SPI_LATCH_US
+uint16_t spiLatchWords( uint32_t spiSpeed );
+// Print the resulting WS2811 bit timing of a channel to UART
+void spiPrintTiming( uint8_t channel );
 
 #endif /* FAN_TAS_TIC_CONTROLLER_MYSPI_H_ */
@@ -8,13 +8,13 @@
 #include "inc/hw_memmap.h"
 #include "inc/hw_types.h"
 #include "inc/hw_ssi.h"
+#include "inc/hw_nvic.h"
 // TivaWare includes
 #include "driverlib/ssi.h"
 #include "driverlib/gpio.h"
 #include "driverlib/debug.h"
 #include "driverlib/rom.h"
 #include "utils/ustdlib.h"
-#include "utils/cmdline.h"
 #include "my_uartstdio.h"
 // USB stuff
 #include "usblib/usblib.h"
@@ -25,55 +25,190 @@
 #include "myTasks.h"
 #include "mySpi.h"
 #include "quick_rules.h"
+#include "profiler.h"
+
+//-------------------
+// Custom types
+//-------------------
+// Each command is described by an entry in g_cmdTable. The parser converts
+// and range-checks all arguments according to this schema in one pass,
+// so the Cmd_*() handlers get validated values only.
+typedef enum{
+    ARG_NUM,        // Number in the range [min, max]. 123, 0x7B or 0173
+    ARG_HW_IN,      // hwIndex of an input, decoded into t_argValue.hw
+    ARG_HW_OUT,     // hwIndex of an output (I2C or HW. PWM), decoded into t_argValue.hw
+    ARG_PWM,        // PWM value, max. depends on the preceding ARG_HW_OUT
+    ARG_HEX         // Hex string, decoded into t_cmdArgs.hex. [min, max] = number of bytes
+}t_argType;
+
+typedef struct{
+    uint8_t type;           // t_argType
+    uint8_t binSize;        // Size in a binary frame [bytes], 1, 2, 4, BIN_DATA or BIN_BLOB
+    uint32_t min;
+    uint32_t max;
+}t_argSpec;
+
+typedef struct{
+    uint32_t u;             // Numerical value (also for ARG_HW_IN and ARG_HW_OUT)
+    t_hw_index hw;          // Decoded hwIndex
+}t_argValue;
+
+typedef struct{
+    uint8_t argc;                   // Number of arguments received (without the command)
+    bool binReply;                  // Command came as binary frame, reply with one
+    t_argValue v[CMD_MAX_ARGS];     // Converted arguments, in schema order, 0 if not given
+    const uint8_t *hex;             // Decoded ARG_HEX data, borrowed from the parser, only valid during the handler call
+    uint8_t nHex;
+}t_cmdArgs;
+
+typedef int (*t_cmdHandler)(t_cmdArgs *a);
+
+typedef struct{
+    const char *name;
+    t_cmdHandler handler;
+    uint8_t opcode;         // t_binOpcode of the binary frame, 0 = ASCII only
+    uint8_t nMin;           // Minimum number of arguments
+    uint8_t nMax;           // Maximum number of arguments
+    uint8_t optArg;         // Argument which is left out if nMax - 1 are given,
+                            // must not be followed by an ARG_HEX argument
+                            // OPT_END = missing arguments are at the end
+    t_argSpec args[CMD_MAX_ARGS];
+    const char *help;
+}t_cmdEntry;
 
 //-------------------
 // Global vars
 //-------------------
-bool g_reportSwitchEvents = 0;
-uint8_t g_errorBuffer[8];
+uint8_t g_reportSwitchEvents = SWE_OFF;
+bool g_recordSwitchSamples = 0;
 
 //-------------------
 // cmd line commands
 //-------------------
-int Cmd_help(int argc, char *argv[]);
-int Cmd_IDN(int argc, char *argv[]);
-int Cmd_IL(int argc, char *argv[]);
-int Cmd_OL(int argc, char *argv[]);
-int Cmd_IR(int argc, char *argv[]);
-int Cmd_SW(int argc, char *argv[]);
-int Cmd_SWE(int argc, char *argv[]);
-int Cmd_DEB(int argc, char *argv[]);
-int Cmd_SOE(int argc, char *argv[]);
-int Cmd_OUT(int argc, char *argv[]);
-int Cmd_RUL(int argc, char *argv[]);
-int Cmd_RULE(int argc, char *argv[]);
-int Cmd_LEC(int argc, char *argv[]);
-int Cmd_LED(int argc, char *argv[]);
-int Cmd_I2C(int argc, char *argv[]);
-int Cmd_HI(int argc, char *argv[]);
-
-// This is the table that holds the command names,
-// implementing functions, and brief description.
-tCmdLineEntry g_psCmdTable[] = {
-        {"?",     Cmd_help, ": Display list of commands"},
-        {"*IDN?", Cmd_IDN,  ": Display ID and version info"},
-        {"IL",    Cmd_IL,   ": I2C: List status of GPIO expanders"},
-        {"IR",    Cmd_IR,   ": I2C: Reset I2C system"},
-        {"OL",    Cmd_OL,   ": I2C: List output writers"},
-        {"HI",    Cmd_HI,   ": <hwIndex> set all ports of PCF high (input mode)"},
-        {"SWE",   Cmd_SWE,  ": <OnOff> En./Dis. reporting of switch events"},
-        {"DEB",   Cmd_DEB,  ": <hwIndex> <OnOff> En./Dis. 12 ms debouncing"},
-        {"SW?",   Cmd_SW,   ": Return the state of ALL switches (40 bytes)"},
-        {"SOE",   Cmd_SOE,  ": <OnOff> En./Dis. 24 V solenoid power (careful!)"},
-        {"OUT",   Cmd_OUT,  ": <hwIndex> <PWMlow> [tPulse] [PWMhigh]"},
-        {"RUL",   Cmd_RUL,  ": <ID> <IDin> <IDout> <trHoldOff>\n        <tPulse> <pwmOn> <pwmOff> <bPosEdge>"},
-        {"RULE",  Cmd_RULE, ": En./Dis a prev. def. rule: RULE <ID> <OnOff>"},
-        {"LEC",   Cmd_LEC,  ": <channel> <spiSpeed [Hz]> [frameFmt]"},
-        {"LED",   Cmd_LED,  ": <channel> <nBytes>\\n<binary blob of nBytes>"},
-        {"I2C",   Cmd_I2C,  ": <channel> <I2Caddr> [hexSendData] <nBytesRx>"},
-        {NULL, NULL, NULL}
+int Cmd_help(t_cmdArgs *a);
+int Cmd_IDN(t_cmdArgs *a);
+int Cmd_IL(t_cmdArgs *a);
+int Cmd_OL(t_cmdArgs *a);
+int Cmd_IR(t_cmdArgs *a);
+int Cmd_SW(t_cmdArgs *a);
+int Cmd_SWS(t_cmdArgs *a);
+int Cmd_SWE(t_cmdArgs *a);
+int Cmd_SWR(t_cmdArgs *a);
+int Cmd_DEB(t_cmdArgs *a);
+int Cmd_SWC(t_cmdArgs *a);
+int Cmd_SWU(t_cmdArgs *a);
+int Cmd_SWM(t_cmdArgs *a);
+int Cmd_SOE(t_cmdArgs *a);
+int Cmd_OUT(t_cmdArgs *a);
+int Cmd_RUL(t_cmdArgs *a);
+int Cmd_RULE(t_cmdArgs *a);
+int Cmd_LEC(t_cmdArgs *a);
+int Cmd_LED(t_cmdArgs *a);
+int Cmd_LEP(t_cmdArgs *a);
+int Cmd_LEDD(t_cmdArgs *a);
+int Cmd_LEDR(t_cmdArgs *a);
+int Cmd_LEDI(t_cmdArgs *a);
+int Cmd_LPAL(t_cmdArgs *a);
+int Cmd_FADE(t_cmdArgs *a);
+int Cmd_LDB(t_cmdArgs *a);
+int Cmd_LSTG(t_cmdArgs *a);
+int Cmd_LCMT(t_cmdArgs *a);
+int Cmd_I2C(t_cmdArgs *a);
+int Cmd_HI(t_cmdArgs *a);
+int Cmd_PRF(t_cmdArgs *a);
+
+// Argument types for the command table
+//                          type        binSize   min  max
+#define A_U8(min, max)    { ARG_NUM,    1,        min, max }
+#define A_U16(min, max)   { ARG_NUM,    2,        min, max }
+#define A_U32(min, max)   { ARG_NUM,    4,        min, max }
+#define A_BOOL            { ARG_NUM,    1,        0,   1 }
+#define A_HW_IN           { ARG_HW_IN,  2,        0,   HW_INDEX_MAX }
+#define A_HW_OUT          { ARG_HW_OUT, 2,        0,   HW_INDEX_MAX }
+#define A_PWM             { ARG_PWM,    2,        0,   MAX_PWM }
+#define A_HEX(min, max)   { ARG_HEX,    BIN_DATA, min, max }
+#define A_BLOB(max)       { ARG_NUM,    BIN_BLOB, 0,   max }
+#define A_NONE            {{ 0 }}
+
+// This is the table that holds the command names, implementing functions,
+// argument schema and brief description.
+static const t_cmdEntry g_cmdTable[] = {
+//       name    handler   binary opcode nMin nMax optArg   arguments
+        {"?",     Cmd_help, 0,           0,   0,   OPT_END, A_NONE,
+                  ": Display list of commands"},
+        {"*IDN?", Cmd_IDN,  0,           0,   0,   OPT_END, A_NONE,
+                  ": Display ID and version info"},
+        {"IL",    Cmd_IL,   0,           0,   0,   OPT_END, A_NONE,
+                  ": I2C: List status of GPIO expanders"},
+        {"IR",    Cmd_IR,   0,           0,   0,   OPT_END, A_NONE,
+                  ": I2C: Reset I2C system"},
+        {"OL",    Cmd_OL,   0,           0,   0,   OPT_END, A_NONE,
+                  ": I2C: List output writers"},
+        {"PRF",   Cmd_PRF,  0,           0,   1,   OPT_END, {A_BOOL},
+                  ": [bReset] List execution time statistics"},
+        {"HI",    Cmd_HI,   0,           1,   1,   OPT_END, {A_HW_IN},
+                  ": <hwIndex> set all ports of PCF high (input mode)"},
+        {"SWE",   Cmd_SWE,  BIN_OP_SWE,  1,   1,   OPT_END, {A_U8(SWE_OFF, SWE_BIN_TS)},
+                  ": <mode> Report switch events: 0 = off, 1 = text, 2 = bin.\n        3 = bin. with timestamps"},
+        {"SWR",   Cmd_SWR,  0,           1,   1,   OPT_END, {A_BOOL},
+                  ": <OnOff> En./Dis. recording of raw switch samples"},
+        {"DEB",   Cmd_DEB,  BIN_OP_DEB,  2,   2,   OPT_END, {A_HW_IN, A_BOOL},
+                  ": <hwIndex> <OnOff> En./Dis. 12 ms debouncing"},
+        {"SWC",   Cmd_SWC,  0,           0,   2,   OPT_END, {A_U8(0, SWE_WINDOW_MAX), A_U16(6, REPORT_SWITCH_BIN_SIZE)},
+                  ": [tWindow] [nBytes] Collect bin. switch events"},
+        {"SWU",   Cmd_SWU,  0,           2,   2,   OPT_END, {A_HW_IN, A_BOOL},
+                  ": <hwIndex> <OnOff> Send its events without delay"},
+        {"SWM",   Cmd_SWM,  BIN_OP_SWM,  1,   1,   OPT_END, {A_HEX(N_CHARS, N_CHARS)},
+                  ": <hexMask> Report events of these inputs only"},
+        {"SW?",   Cmd_SW,   BIN_OP_SW,   0,   0,   OPT_END, A_NONE,
+                  ": Return the state of ALL switches (40 bytes)"},
+        {"SWS",   Cmd_SWS,  BIN_OP_SWS,  0,   1,   OPT_END, {A_BOOL},
+                  ": [bSampled] Binary snapshot of ALL switches"},
+        {"SOE",   Cmd_SOE,  0,           1,   1,   OPT_END, {A_BOOL},
+                  ": <OnOff> En./Dis. 24 V solenoid power (careful!)"},
+        {"OUT",   Cmd_OUT,  BIN_OP_OUT,  2,   4,   OPT_END, {A_HW_OUT, A_PWM, A_U16(0, 0x7FFF), A_PWM},
+                  ": <hwIndex> <PWMlow> [tPulse] [PWMhigh]"},
+        {"RUL",   Cmd_RUL,  BIN_OP_RUL,  8,   8,   OPT_END, {A_U8(0, MAX_QUICK_RULES - 1), A_HW_IN, A_HW_OUT,
+                  A_U16(0, 0xFFFF), A_U16(0, 0x7FFF), A_PWM, A_PWM, A_BOOL},
+                  ": <ID> <IDin> <IDout> <trHoldOff>\n        <tPulse> <pwmOn> <pwmOff> <bPosEdge>"},
+        {"RULE",  Cmd_RULE, BIN_OP_RULE, 2,   2,   OPT_END, {A_U8(0, MAX_QUICK_RULES - 1), A_BOOL},
+                  ": En./Dis a prev. def. rule: RULE <ID> <OnOff>"},
+        {"LEC",   Cmd_LEC,  0,           2,   3,   OPT_END, {A_U8(0, 2), A_U32(1, SYSTEM_CLOCK / 2), A_U8(0, 0xFF)},
+                  ": <channel> <spiSpeed [Hz]> [frameFmt]"},
+        {"LED",   Cmd_LED,  BIN_OP_LED,  2,   2,   OPT_END, {A_U8(0, 2), A_BLOB(N_LEDS_MAX * 3)},
+                  ": <channel> <nBytes>\\n<binary blob of nBytes>"},
+        {"LEP",   Cmd_LEP,  BIN_OP_LEP,  4,   4,   OPT_END, {A_U8(0, 2), A_U16(0, N_LEDS_MAX * 3 - 3), A_BOOL,
+                  A_BLOB(N_LEDS_MAX * 3)},
+                  ": <channel> <offset> <bLatch> <nBytes>\\n<blob>"},
+        {"LEDD",  Cmd_LEDD, BIN_OP_LEDD, 2,   2,   OPT_END, {A_U8(0, 2), A_BLOB(0xFFFF)},
+                  ": <channel> <nBytes>\\n<spans of changed LEDs>"},
+        {"LEDR",  Cmd_LEDR, BIN_OP_LEDR, 2,   2,   OPT_END, {A_U8(0, 2), A_BLOB(0xFFFF)},
+                  ": <channel> <nBytes>\\n<runs of [nLEDs, R, G, B]>"},
+        {"LEDI",  Cmd_LEDI, BIN_OP_LEDI, 2,   2,   OPT_END, {A_U8(0, 2), A_BLOB(N_LEDS_MAX_INDEXED)},
+                  ": <channel> <nLEDs>\\n<palette index per LED>"},
+        {"LPAL",  Cmd_LPAL, BIN_OP_LPAL, 3,   3,   OPT_END, {A_U8(0, 2), A_U8(0, SPI_PALETTE_LEN - 1),
+                  A_BLOB(SPI_PALETTE_LEN * 3)},
+                  ": <channel> <first> <nBytes>\\n<RGB palette colors>"},
+        {"FADE",  Cmd_FADE, BIN_OP_FADE, 5,   5,   OPT_END, {A_U8(0, 2), A_U16(0, N_LEDS_MAX - 1),
+                  A_U16(1, N_LEDS_MAX), A_U32(0, 0xFFFFFF), A_U16(0, 0xFFFF)},
+                  ": <channel> <first> <nLEDs> <0xRRGGBB> <tFade [ms]>"},
+        {"LDB",   Cmd_LDB,  0,           2,   2,   OPT_END, {A_U8(0, 2), A_BOOL},
+                  ": <channel> <OnOff> En./Dis. LED double buffering"},
+        {"LSTG",  Cmd_LSTG, 0,           1,   1,   OPT_END, {A_BOOL},
+                  ": <OnOff> En./Dis. staging of LED frames until LCMT"},
+        {"LCMT",  Cmd_LCMT, BIN_OP_LCMT, 0,   0,   OPT_END, A_NONE,
+                  ": Send all staged LED frames at the same time"},
+        {"I2C",   Cmd_I2C,  BIN_OP_I2C,  3,   4,   2,       {A_U8(0, 3), A_U8(0, 127), A_HEX(1, CMD_HEX_MAX), A_U8(0, 255)},
+                  ": <channel> <I2Caddr> [hexSendData] <nBytesRx>"},
+        {NULL}
 };
 
+// Open addressing hash table of the command names, filled by cmdInit().
+// Holds the g_cmdTable index + 1, 0 = empty slot
+static uint8_t g_cmdHash[CMD_HASH_SIZE];
+// Look up table of the commands which can be sent as binary frame
+static const t_cmdEntry *g_binCmd[N_BIN_OP];
+
 uint16_t strMyStrip(uint8_t *cmdString, uint16_t cmdLen) {
     //Remove \n, \r and make sure there is a \0 at the end
     uint8_t *pos = cmdString;
@@ -102,162 +237,956 @@ void taskDemoLED(void *pvParameters) {
     vTaskDelete(NULL);
 }
 
-int8_t cmdParse( uint8_t *charBuffer, uint16_t nCharsRead ){
-    if (nCharsRead == 0){   //This must be a \n, ignore silently
-        return( 0 );
+static uint32_t cmdHash(const char *name) {
+    uint32_t h = CMD_HASH_INIT;
+    while (*name) {
+        h = CMD_HASH_STEP(h, *name++);
+    }
+    return h;
+}
+
+// Build the hash table for the command names and the opcode look up table
+static void cmdInit() {
+    const t_cmdEntry *cmd;
+    unsigned i;
+    for (cmd = g_cmdTable; cmd->name; cmd++) {
+        i = cmdHash(cmd->name) & (CMD_HASH_SIZE - 1);
+        while (g_cmdHash[i]) {               // Collision, take the next free slot
+            i = (i + 1) & (CMD_HASH_SIZE - 1);
+        }
+        g_cmdHash[i] = cmd - g_cmdTable + 1;
+        if (cmd->opcode > 0 && cmd->opcode < N_BIN_OP) {
+            g_binCmd[cmd->opcode] = cmd;
+        }
+    }
+}
+
+// Returns the command table entry of name or NULL, hash = cmdHash(name)
+static const t_cmdEntry *cmdFind(const char *name, uint32_t hash) {
+    const t_cmdEntry *cmd;
+    unsigned i = hash & (CMD_HASH_SIZE - 1);
+    while (g_cmdHash[i]) {
+        cmd = &g_cmdTable[g_cmdHash[i] - 1];
+        if (ustrcmp(cmd->name, name) == 0) {
+            return cmd;
+        }
+        i = (i + 1) & (CMD_HASH_SIZE - 1);
+    }
+    return NULL;
+}
+
+// Is argument i of the schema given, if nGiven arguments were received?
+static bool argPresent(const t_cmdEntry *cmd, unsigned nGiven, unsigned i) {
+    if (nGiven >= cmd->nMax) {
+        return true;
+    }
+    if (cmd->optArg == OPT_END) {
+        return i < nGiven;
+    }
+    return i != cmd->optArg;
+}
+
+// Range check and decode the arguments in a->v[].u according to the schema
+static int cmdCheckArgs(const t_cmdEntry *cmd, t_cmdArgs *a) {
+    const t_argSpec *spec;
+    const t_hw_index *out = NULL;
+    uint32_t val, max;
+    for (unsigned i = 0; i < cmd->nMax; i++) {
+        if (!argPresent(cmd, a->argc, i)) {
+            continue;
+        }
+        spec = &cmd->args[i];
+        val = a->v[i].u;
+        max = spec->max;
+        if (spec->type == ARG_HEX) {
+            // Data left out of a binary frame is only fine if it may be empty
+            if (!a->hex && (spec->min == 0 || cmd->optArg == i)) {
+                continue;
+            }
+            val = a->nHex;
+        }
+        if (spec->type == ARG_PWM && out && out->channel <= C_I2C3) {
+            max = (1 << N_BIT_PWM) - 1;
+        }
+        if (val < spec->min || val > max) {
+            UARTprintf("%22s: %s argument %d = %d not in [%d, %d]\n", "cmdCheckArgs()", cmd->name, i + 1, val, spec->min, max);
+            return CMD_INVALID_ARG;
+        }
+        if (spec->type == ARG_HW_IN || spec->type == ARG_HW_OUT) {
+            a->v[i].hw = decodeHwIndex(val, spec->type == ARG_HW_IN);
+            if (a->v[i].hw.channel == C_INVALID) {
+                UARTprintf("%22s: %s argument %d: hwIndex 0x%03x invalid\n", "cmdCheckArgs()", cmd->name, i + 1, val);
+                return CMD_INVALID_ARG;
+            }
+            if (spec->type == ARG_HW_OUT) {
+                out = &a->v[i].hw;
+            }
+        }
+    }
+    return 0;
+}
+
+// Check the arguments, then execute the command
+static int cmdRun(const t_cmdEntry *cmd, t_cmdArgs *a) {
+    int retVal = cmdCheckArgs(cmd, a);
+    if (retVal == 0) {
+        return cmd->handler(a);
     }
-    int8_t retVal = CmdLineProcess((char*)charBuffer); //, nCharsRead );
+    return retVal;
+}
+
+static void cmdReportError(int retVal, const char *cmdName) {
     switch (retVal) {
-     case CMDLINE_BAD_CMD:
+     case CMD_BAD_CMD:
          REPORT_ERROR( "ER:0006\n" );
-         UARTprintf("[CMDLINE_BAD_CMD] %s\n", charBuffer);
+         UARTprintf("[CMDLINE_BAD_CMD] %s\n", cmdName);
          break;
-     case CMDLINE_INVALID_ARG:
+     case CMD_INVALID_ARG:
          REPORT_ERROR( "ER:0007\n" );
-         UARTprintf("[CMDLINE_INVALID_ARG] %s\n", charBuffer);
+         UARTprintf("[CMDLINE_INVALID_ARG] %s\n", cmdName);
          break;
-     case CMDLINE_TOO_FEW_ARGS:
+     case CMD_TOO_FEW_ARGS:
          REPORT_ERROR( "ER:0008\n" );
-         UARTprintf("[CMDLINE_TOO_FEW_ARGS] %s\n", charBuffer);
+         UARTprintf("[CMDLINE_TOO_FEW_ARGS] %s\n", cmdName);
          break;
-     case CMDLINE_TOO_MANY_ARGS:
+     case CMD_TOO_MANY_ARGS:
          REPORT_ERROR( "ER:0009\n" );
-         UARTprintf("[CMDLINE_TOO_MANY_ARGS] %s\n", charBuffer);
+         UARTprintf("[CMDLINE_TOO_MANY_ARGS] %s\n", cmdName);
          break;
     }
-    return retVal;
 }
 
-int16_t eolSearch( uint8_t *charPointer, uint16_t nChars ){
-//  Return -1 if no eol has been found, otherwise return offset to eol
-    uint16_t i;
-    for( i=0; i<nChars; i++ ){          // Find the end of line in received chars
-        if( *charPointer=='\n' || *charPointer=='\r' || *charPointer=='\0' ){
-            *charPointer = '\0';        //Replace EOL with \0
-            return i;
+static uint16_t getU16(const uint8_t *p) {
+    return p[0] | (p[1] << 8);
+}
+
+static uint32_t getU32(const uint8_t *p) {
+    return getU16(p) | (getU16(&p[2]) << 16);
+}
+
+// Number of payload bytes of the fixed size fields of a binary frame
+static unsigned binFixedLen(const t_cmdEntry *cmd) {
+    unsigned n = 0;
+    for (unsigned i = 0; i < cmd->nMax; i++) {
+        if (cmd->args[i].binSize != BIN_DATA && cmd->args[i].binSize != BIN_BLOB) {
+            n += cmd->args[i].binSize;
         }
-        charPointer++;
     }
-    return -1;
+    return n;
 }
 
+// Does the binary frame end with a blob, which the handler takes care of?
+static bool binHasBlob(const t_cmdEntry *cmd) {
+    return cmd->nMax > 0 && cmd->args[cmd->nMax - 1].binSize == BIN_BLOB;
+}
+
+// Unpack the little endian fields of a binary frame payload into a,
+// in the same order as the command schema. Optional arguments at the end of
+// a schema without variable length data may be left out, like in ASCII.
+static int binUnpackArgs(const t_cmdEntry *cmd, const uint8_t *pl, uint16_t len, t_cmdArgs *a) {
+    unsigned nFixed = binFixedLen(cmd), nVar = 0, i;
+    if (len < nFixed) {
+        if (cmd->optArg != OPT_END || (cmd->nMax > 0 && cmd->args[cmd->nMax - 1].binSize >= BIN_DATA)) {
+            return CMD_TOO_FEW_ARGS;
+        }
+    } else {
+        nVar = len - nFixed;
+    }
+    memset(a, 0, sizeof(*a));
+    a->binReply = 1;
+    for (i = 0; i < cmd->nMax; i++) {
+        if (cmd->args[i].binSize < BIN_DATA) {
+            if (len == 0) {
+                break;
+            }
+            if (len < cmd->args[i].binSize) {
+                // A field cut short is not an omitted optional argument
+                return CMD_TOO_FEW_ARGS;
+            }
+            len -= cmd->args[i].binSize;
+        }
+        switch (cmd->args[i].binSize) {
+        case 1:
+            a->v[i].u = pl[0];
+            break;
+        case 2:
+            a->v[i].u = getU16(pl);
+            break;
+        case 4:
+            a->v[i].u = getU32(pl);
+            break;
+        case BIN_DATA:
+            // Variable length data, leave a->hex = NULL if there is none
+            if (nVar > 0xFF) {
+                return CMD_TOO_MANY_ARGS;
+            }
+            if (nVar > 0) {
+                a->hex = pl;
+                a->nHex = nVar;
+            }
+            pl += nVar;
+            nVar = 0;
+            continue;
+        case BIN_BLOB:
+            // The rest of the frame is not in pl, it is streamed by the handler
+            a->v[i].u = nVar;
+            nVar = 0;
+            continue;
+        }
+        pl += cmd->args[i].binSize;
+    }
+    a->argc = i;
+    if (a->argc < cmd->nMin) {
+        return CMD_TOO_FEW_ARGS;
+    }
+    if (nVar > 0) {
+        return CMD_TOO_MANY_ARGS;
+    }
+    return 0;
+}
+
+//-------------------
+// Command parser state
+//-------------------
 typedef enum{
-    PARS_MODE_ASCII, PARS_MODE_BIN_LED
+    PARS_MODE_ASCII,        // Tokenize an ASCII command line
+    PARS_MODE_BIN_LED,      // Copy LED data into the spiBuffer
+    PARS_MODE_BIN_FRAME,    // Collect header and fixed size fields of a binary frame
+    PARS_MODE_SKIP          // Drop the rest of a rejected binary frame
 }t_usbParserMode;
 
-uint32_t g_LEDnBytesToCopy;
-int8_t g_LEDChannel;
+// State of the ASCII tokenizer. It is fed char by char, so a command line
+// never needs to be copied or to fit into a buffer.
+typedef struct{
+    int32_t seq;                    // `#<seq>` prefix, SEQ_NONE if there is none
+    bool inSeq;
+    bool seqBad;
+    uint8_t nSeqDigits;
+    char name[CMD_NAME_LEN + 1];    // Command name, \0 terminated after the token
+    uint8_t nName;
+    uint32_t hash;                  // CMD_HASH_STEP() over the name
+    const t_cmdEntry *cmd;          // Looked up after the name token
+    uint8_t nTokens;                // Tokens started so far, including the name
+    bool inToken;
+    // Current argument token
+    uint8_t base;                   // 8, 10 or 16, 0 = no char yet
+    uint8_t nDigits;
+    bool isHex;                     // Token is decoded into hex[] too
+    // Converted arguments, in the order received
+    uint32_t val[CMD_MAX_ARGS];
+    uint16_t notNum;                // Bit k set: argument k is not a valid number
+    uint8_t hex[CMD_HEX_MAX];       // ARG_HEX argument
+    uint16_t nHexChars;
+    bool hexValid;
+}t_lineState;
 
-void taskUsbCommandParser( void *pvParameters ) {
-    // Read data from USB serial and parse it
-    UARTprintf("%22s: %s", "taskUsbCommandParser()", "Started!\n");
-    static uint8_t charBuffer[CMD_PARSER_BUF_LEN];
-    uint32_t nCharsRead=0, tempCharsRead=0, remainderSize=0;
-    int16_t retVal;
-    uint8_t *writePointer = charBuffer;                         // Points to first free place in charBuffer
-    uint8_t *readPointer = charBuffer;                          // Points to the next unprocessed character
-    uint8_t *spiWritePointer;                                   // Points to first free place in spiBuffer
-    t_usbParserMode currentMode = PARS_MODE_ASCII;
-    while (1) {
-        switch (currentMode) {
-        case PARS_MODE_ASCII:
-            // -----------------------------------------------------------
-            //  Check if there is any data in the buffer to process
-            // -----------------------------------------------------------
-            if (remainderSize == 0) {                           // There's no unprocessed data in the buffer
-                while (!USBBufferDataAvailable(&g_sRxBuffer)) {
-                    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);   // Wait for receiving new serial data over USB
-                }                                              // Here we must have new data in any case
-                tempCharsRead = USBBufferRead(&g_sRxBuffer, writePointer, CMD_PARSER_BUF_LEN - nCharsRead - 1);
-//                UARTwrite( writePointer, tempCharsRead );
-                writePointer += tempCharsRead;
-                remainderSize += tempCharsRead;                 // How many chars to process
+static t_usbParserMode g_parserMode = PARS_MODE_ASCII;
+static t_lineState g_line;
+static uint8_t g_frame[BIN_HEADER_LEN + BIN_MAX_PAYLOAD];  // Binary frame header and fields
+static uint16_t g_frameFill, g_frameLen;                   // received / needed bytes of g_frame
+static uint32_t g_parserRemaining;                          // chars left in PARS_MODE_BIN_LED / SKIP
+
+// How the LED data following an LED command is written to the spiBuffer
+typedef enum{
+    LED_SINK_RAW,           // RGB bytes, copied as they are
+    LED_SINK_DELTA,         // Spans of [u16 first LED] [u8 nLEDs] [nLEDs * RGB]
+    LED_SINK_RLE,           // Runs of [u8 nLEDs] [RGB]
+    LED_SINK_INDEXED,       // 1 byte palette index per LED, copied as they are
+    LED_SINK_PALETTE        // RGB bytes, copied into the palette
+}t_ledSinkMode;
+
+// Where the LED data following an LED command goes to
+typedef struct{
+    uint8_t channel;
+    uint8_t mode;           // t_ledSinkMode
+    bool latch;             // spiSend() the frame after the last byte
+    uint16_t frameLen;      // Bytes (LEDs for LED_SINK_INDEXED) to send when latching
+    uint8_t *dest;          // Next free place in the (back) buffer of channel
+    // LED_SINK_DELTA, LED_SINK_RLE
+    uint8_t hdr[4];         // Span header / run
+    uint8_t nHdr;           // Bytes received of hdr
+    uint32_t nSpanLeft;     // RGB bytes left of the current span
+    bool bad;               // Invalid span / run, drop the rest
+}t_ledSink;
+
+static t_ledSink g_ledSink;
+static uint8_t g_ledLocked;                 // Bit N set: the parser holds the spiBuffer lock of channel N
+static uint16_t g_ledFrameLen[3];           // Bytes of the last RGB frame sent on each channel
+static bool g_ledStage;                     // Only stage latched frames until LCMT
+static uint8_t g_ledStagedMask;             // Bit N set: channel N has a staged frame
+static uint8_t g_ledStagedIndexed;          // Bit N set: the staged frame is palette indexed
+static int32_t g_ledStagedLen[3];
+
+// A fade of a range of LEDs towards a solid color
+typedef struct{
+    uint16_t first;         // First LED
+    uint16_t nLeds;
+    uint8_t rgb[3];         // Target color
+    uint16_t nSteps;        // Steps left until the target is reached, 0 = idle
+}t_ledFade;
+
+static t_ledFade g_ledFade[3];
+static TickType_t g_ledFadeNext;            // Tick count of the next fade step
+static int32_t g_cmdSeq = SEQ_NONE;     // Sequence ID of the command being executed
+static bool g_cmdReplied;               // An error or a deferred reply will tell the host about g_cmdSeq
+
+static void lineReset() {
+    g_line.seq = SEQ_NONE;
+    g_line.inSeq = false;
+    g_line.seqBad = false;
+    g_line.nSeqDigits = 0;
+    g_line.nName = 0;
+    g_line.hash = CMD_HASH_INIT;
+    g_line.cmd = NULL;
+    g_line.nTokens = 0;
+    g_line.inToken = false;
+    g_line.notNum = 0;
+}
+
+// Value of a hex digit, 16 if c is not one
+static unsigned digitValue(char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    } else if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    } else if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return 16;
+}
+
+static void tokenEnd() {
+    t_lineState *l = &g_line;
+    unsigned k = l->nTokens - 2;
+    l->inToken = false;
+    if (l->nTokens == 1) {
+        // The command name is complete
+        if (l->nName <= CMD_NAME_LEN) {
+            l->name[l->nName] = '\0';
+            l->cmd = cmdFind(l->name, l->hash);
+        }
+    } else if (k < CMD_MAX_ARGS && l->nDigits == 0) {
+        l->notNum |= 1 << k;
+    }
+}
+
+// Tokenize one char of an ASCII command line. Numbers are converted on the
+// fly, with the same notation as ustrtoul(): 123, 0x7B or 0173
+static void lineChar(char c) {
+    t_lineState *l = &g_line;
+    unsigned k, d;
+    if (c == ' ') {
+        if (l->inSeq) {
+            l->inSeq = false;
+        } else if (l->inToken) {
+            tokenEnd();
+        }
+        return;
+    }
+    // Optional `#<seq>` prefix, decimal
+    if (l->nTokens == 0 && !l->inSeq && c == '#' && l->seq == SEQ_NONE) {
+        l->inSeq = true;
+        l->seq = 0;
+        return;
+    }
+    if (l->inSeq) {
+        d = digitValue(c);
+        if (d > 9 || l->seq * 10 + d > SEQ_MAX) {
+            l->seqBad = true;
+        } else {
+            l->seq = l->seq * 10 + d;
+            l->nSeqDigits = 1;
+        }
+        return;
+    }
+    if (!l->inToken) {
+        l->inToken = true;
+        if (l->nTokens < 0xFF) {
+            l->nTokens++;
+        }
+        k = l->nTokens - 2;
+        if (l->nTokens > 1 && k < CMD_MAX_ARGS) {
+            l->val[k] = 0;
+            l->base = 0;
+            l->nDigits = 0;
+            l->isHex = l->cmd && l->cmd->args[k].type == ARG_HEX;
+            l->nHexChars = 0;
+            l->hexValid = true;
+        }
+    }
+    if (l->nTokens == 1) {
+        if (l->nName < CMD_NAME_LEN) {
+            l->name[l->nName] = c;
+        }
+        if (l->nName <= CMD_NAME_LEN) {
+            l->nName++;
+        }
+        l->hash = CMD_HASH_STEP(l->hash, c);
+        return;
+    }
+    k = l->nTokens - 2;
+    if (k >= CMD_MAX_ARGS) {
+        return;
+    }
+    d = digitValue(c);
+    if (l->isHex) {
+        if (d > 15) {
+            l->hexValid = false;
+        } else if (l->nHexChars / 2 < CMD_HEX_MAX) {
+            if (l->nHexChars % 2) {
+                l->hex[l->nHexChars / 2] |= d;
+            } else {
+                l->hex[l->nHexChars / 2] = d << 4;
+            }
+        }
+        l->nHexChars++;
+    }
+    if (l->base == 8 && l->nDigits == 1 && l->val[k] == 0 && (c == 'x' || c == 'X')) {
+        l->base = 16;
+        l->nDigits = 0;
+        return;
+    }
+    if (l->base == 0) {
+        l->base = (c == '0') ? 8 : 10;
+    }
+    if (d >= l->base) {
+        l->notNum |= 1 << k;
+    } else if (l->val[k] > (0xFFFFFFFF - d) / l->base) {
+        l->val[k] = 0xFFFFFFFF;             // Saturate, fails the range check
+    } else {
+        l->val[k] = l->val[k] * l->base + d;
+        l->nDigits++;
+    }
+}
+
+// Check and convert the arguments of a tokenized command line
+static int lineArgs(t_cmdArgs *a) {
+    t_lineState *l = &g_line;
+    const t_cmdEntry *cmd = l->cmd;
+    unsigned argc = l->nTokens - 1, i, k;
+    if (!cmd) {
+        return CMD_BAD_CMD;
+    }
+    if (argc < cmd->nMin) {
+        return CMD_TOO_FEW_ARGS;
+    }
+    if (argc > cmd->nMax) {
+        return CMD_TOO_MANY_ARGS;
+    }
+    memset(a, 0, sizeof(*a));
+    a->argc = argc;
+    for (i = 0, k = 0; i < cmd->nMax; i++) {
+        if (!argPresent(cmd, argc, i)) {
+            continue;
+        }
+        if (cmd->args[i].type == ARG_HEX) {
+            if (!l->hexValid || l->nHexChars % 2 || l->nHexChars / 2 > CMD_HEX_MAX) {
+                UARTprintf("%22s: %s argument %d is not a valid hex string\n", "lineArgs()", cmd->name, i + 1);
+                return CMD_INVALID_ARG;
+            }
+            a->nHex = l->nHexChars / 2;
+            a->hex = l->hex;
+        } else {
+            if (l->notNum & (1 << k)) {
+                UARTprintf("%22s: %s argument %d is not a number\n", "lineArgs()", cmd->name, i + 1);
+                return CMD_INVALID_ARG;
+            }
+            a->v[i].u = l->val[k];
+        }
+        k++;
+    }
+    return 0;
+}
+
+static void parserSkip(uint32_t n) {
+    g_parserRemaining = n;
+    g_parserMode = n > 0 ? PARS_MODE_SKIP : PARS_MODE_ASCII;
+}
+
+// Start executing a command with sequence ID seq
+static void cmdBegin(int32_t seq) {
+    g_cmdSeq = seq;
+    g_cmdReplied = false;
+}
+
+// The command has been completely processed. Send `OK #<seq>` if it had a
+// sequence ID and nothing else has been reported for it.
+static void cmdEnd() {
+    char buf[12];           // 'OK #65535\n'
+    if (g_cmdSeq != SEQ_NONE && !g_cmdReplied) {
+        ts_usbSend((uint8_t *)buf, usprintf(buf, "OK #%d\n", g_cmdSeq));
+    }
+    g_cmdSeq = SEQ_NONE;
+}
+
+// Returns the valid sequence ID of the current line or SEQ_NONE
+static int32_t lineSeq() {
+    if (g_line.seq != SEQ_NONE && (g_line.seqBad || g_line.nSeqDigits == 0)) {
+        UARTprintf("%22s: invalid sequence ID\n", "lineSeq()");
+        return SEQ_NONE;
+    }
+    return g_line.seq;
+}
+
+// Max. bytes of a frame in the (back) buffer of channel. The palette is
+// always kept at the end of g_spiBuffer[channel]
+static unsigned ledMaxBytes(unsigned channel, t_ledSinkMode mode) {
+    bool dbl = g_spiState[channel].doubleBuf;
+    if (mode == LED_SINK_INDEXED) {
+        return dbl ? N_LEDS_MAX_INDEXED - SPI_HALF_LEN : N_LEDS_MAX_INDEXED;
+    }
+    if (mode == LED_SINK_PALETTE) {
+        return N_LEDS_MAX * 3;
+    }
+    return dbl ? SPI_HALF_LEN : N_LEDS_MAX * 3;
+}
+
+// Lock the spiBuffer of channel and point the LED sink to offset.
+// Returns PARS_MODE_BIN_LED if the nBytes following the command are to be
+// written into the spiBuffer
+static int ledOpen(unsigned channel, unsigned offset, unsigned nBytes, bool latch, t_ledSinkMode mode) {
+    t_spiTransferState *state = &g_spiState[channel];
+    if ((mode == LED_SINK_RAW || mode == LED_SINK_PALETTE) && (nBytes % 3 || offset % 3)) {
+        REPORT_ERROR("ER:001A\n");
+        UARTprintf("%22s: Invalid number of bytes (%d)\n", "ledOpen()", nBytes);
+        return 0;
+    }
+    if ((mode == LED_SINK_RAW || mode == LED_SINK_PALETTE || mode == LED_SINK_INDEXED) &&
+        offset + nBytes > ledMaxBytes(channel, mode)) {
+        UARTprintf("%22s: %d bytes at offset %d do not fit\n", "ledOpen()", nBytes, offset);
+        return CMD_INVALID_ARG;
+    }
+    // The lock is kept over several LEP commands until the frame is latched.
+    // With double buffering, only the back buffer is written, which needs no lock.
+    // The palette is then changed while frames are sent.
+    if (!(g_ledLocked & (1 << channel)) && !(mode == LED_SINK_PALETTE && state->doubleBuf)) {
+        if (state->doubleBuf) {
+            // Partial updates start from the current frame
+            spiOpenBack(channel, mode == LED_SINK_DELTA || offset > 0 || !latch);
+        } else if (!xSemaphoreTake(state->semaToReleaseWhenFinished, 1000)) {
+            REPORT_ERROR("ER:001B\n");
+            UARTprintf("%22s: Timeout, could not access sendBuffer %d\n", "ledOpen()", channel);
+            return 0;
+        }
+        g_ledLocked |= 1 << channel;
+    }
+    g_ledFade[channel].nSteps = 0;     // New LED data stops a fade
+    g_ledSink.channel = channel;
+    g_ledSink.mode = mode;
+    g_ledSink.latch = latch;
+    if (mode == LED_SINK_PALETTE) {
+        g_ledSink.dest = &g_spiBuffer[channel][offset];
+    } else {
+        g_ledSink.dest = &state->backBuffer[offset];
+    }
+    g_ledSink.nHdr = 0;
+    g_ledSink.nSpanLeft = 0;
+    g_ledSink.bad = false;
+    if (mode == LED_SINK_DELTA) {
+        // Resend the last frame, extended by spans beyond its end
+        g_ledSink.frameLen = g_ledFrameLen[channel];
+    } else if (mode == LED_SINK_RLE) {
+        g_ledSink.frameLen = 0;     // Grows with each decoded run
+    } else {
+        g_ledSink.frameLen = offset + nBytes;
+    }
+    g_parserRemaining = nBytes;
+    return PARS_MODE_BIN_LED;
+}
+
+// Keep a latched frame until ledCommit(). A single buffered channel stays locked
+static void ledStageFrame(unsigned channel, int32_t len, bool indexed) {
+    g_ledStagedMask |= 1 << channel;
+    g_ledStagedLen[channel] = len;
+    g_ledStagedIndexed &= ~(1 << channel);
+    g_ledStagedIndexed |= indexed << channel;
+    if (g_spiState[channel].doubleBuf) {
+        g_ledLocked &= ~(1 << channel);
+    }
+}
+
+// Send all staged frames at the same time
+static void ledCommit() {
+    unsigned ch;
+    if (!g_ledStagedMask) {
+        return;
+    }
+    for (ch = 0; ch < 3; ch++) {
+        // spiLatchSync() releases the lock when done
+        if ((g_ledStagedMask & (1 << ch)) && !g_spiState[ch].doubleBuf) {
+            g_ledLocked &= ~(1 << ch);
+        }
+    }
+    spiLatchSync(g_ledStagedMask, g_ledStagedLen, g_ledStagedIndexed);
+    g_ledStagedMask = 0;
+}
+
+// All LED data has been received
+static void ledClose() {
+    t_ledSink *s = &g_ledSink;
+    g_parserMode = PARS_MODE_ASCII;
+    if ((s->mode == LED_SINK_DELTA || s->mode == LED_SINK_RLE) && !s->bad && (s->nHdr || s->nSpanLeft)) {
+        REPORT_ERROR("ER:002A\n");
+        UARTprintf("%22s: last span / run is incomplete\n", "ledClose()");
+    }
+    if (s->latch) {
+        if (s->mode != LED_SINK_INDEXED) {
+            g_ledFrameLen[s->channel] = s->frameLen;
+        }
+        if (g_ledStage) {
+            ledStageFrame(s->channel, s->frameLen, s->mode == LED_SINK_INDEXED);
+        } else {
+            // spiLatch() releases the lock when done
+            g_ledLocked &= ~(1 << s->channel);
+            spiLatch(s->channel, s->frameLen, s->mode == LED_SINK_INDEXED);
+        }
+    }
+    cmdEnd();
+}
+
+// Patch the spans of a delta update into the spiBuffer
+static void ledDeltaWrite(const uint8_t *p, uint32_t n) {
+    t_ledSink *s = &g_ledSink;
+    unsigned first, nLeds, nCopy;
+    while (n > 0) {
+        if (s->nHdr < 3) {
+            s->hdr[s->nHdr++] = *p++;
+            n--;
+            if (s->nHdr < 3) {
+                continue;
+            }
+            first = getU16(s->hdr);
+            nLeds = s->hdr[2];
+            if (!s->bad && (first + nLeds) * 3 > ledMaxBytes(s->channel, LED_SINK_DELTA)) {
+                REPORT_ERROR("ER:002A\n");
+                UARTprintf("%22s: span %d + %d out of range\n", "ledDeltaWrite()", first, nLeds);
+                s->bad = true;
+            }
+            s->dest = &g_spiState[s->channel].backBuffer[first * 3];
+            s->nSpanLeft = nLeds * 3;
+            if (!s->bad && (first + nLeds) * 3 > s->frameLen) {
+                s->frameLen = (first + nLeds) * 3;
             }
-            // -----------------------------------------------------------
-            //  Wait for a EOL character, then parse the substring
-            // -----------------------------------------------------------
-            retVal = eolSearch(readPointer, remainderSize);
-            if (retVal > -1) {                                              //EOL was found in new chars
-                readPointer += retVal + 1;                                  //Points to the first remainder char after the found EOL char
-                remainderSize -= retVal + 1;                                //Length of the remainder after the CMD
-                //Parse cmd from beginning of charBuffer
-                if (cmdParse(charBuffer, nCharsRead + retVal) == PARS_MODE_BIN_LED) {
-                    // cmdParse might enable PARS_MODE_BIN_LED
-                    // cmdParse calls CMD_LED, which will wait until a previous send on this channel is finished
-                    // -----------------------------------------------------------
-                    //  Switch to binary input mode
-                    // -----------------------------------------------------------
-                    currentMode = PARS_MODE_BIN_LED;
-                    //Okay we need to copy the remainder from the charBuffer into the SPI buffer
-                    nCharsRead = MIN(remainderSize, g_LEDnBytesToCopy);      //How many chars to copy? remainder might contain more commands!
-                    memcpy(g_spiBuffer[g_LEDChannel], readPointer, nCharsRead);
-                    spiWritePointer = &g_spiBuffer[g_LEDChannel][nCharsRead];//Points to next free char in spiBuffer
-                    readPointer += nCharsRead;
-                    remainderSize -= nCharsRead;                            //This is the remainder after taking the LED data out
-                                                                            //Might not be zero if multiple commands are in charBuffer!
-                } else {
-                    nCharsRead = 0;                                         //We've processed one command, start again with the next!
-                }
-                // -----------------------------------------------------------
-                //  Prepare parsing of the next Ascii cmd
-                // -----------------------------------------------------------
-                //Okay we need to copy the remainder from the charBuffer into the beginning of the charBuffer
-                memcpy( charBuffer, readPointer, remainderSize );       //Remainder is now in the beginning
-                // At this point, either all chars are processed (reminderSize=0)
-                // Or the remaining chars have been copied to the beginning of the charBuffer
-                readPointer = charBuffer;
-                writePointer = &charBuffer[remainderSize];              //Point to first free char
+        }
+        nCopy = MIN(n, s->nSpanLeft);
+        if (!s->bad) {
+            memcpy(s->dest, p, nCopy);
+        }
+        s->dest += nCopy;
+        p += nCopy;
+        n -= nCopy;
+        s->nSpanLeft -= nCopy;
+        if (s->nSpanLeft == 0) {
+            s->nHdr = 0;
+        }
+    }
+}
 
+// Decompress runs of equal LEDs into the spiBuffer
+static void ledRleWrite(const uint8_t *p, uint32_t n) {
+    t_ledSink *s = &g_ledSink;
+    unsigned i;
+    while (n > 0) {
+        s->hdr[s->nHdr++] = *p++;
+        n--;
+        if (s->nHdr < 4) {
+            continue;
+        }
+        s->nHdr = 0;
+        if (s->bad) {
+            continue;
+        }
+        if (s->frameLen + s->hdr[0] * 3 > ledMaxBytes(s->channel, LED_SINK_RLE)) {
+            REPORT_ERROR("ER:002A\n");
+            UARTprintf("%22s: too many LEDs\n", "ledRleWrite()");
+            s->bad = true;
+            continue;
+        }
+        for (i = 0; i < s->hdr[0]; i++) {
+            *s->dest++ = s->hdr[1];
+            *s->dest++ = s->hdr[2];
+            *s->dest++ = s->hdr[3];
+        }
+        s->frameLen += s->hdr[0] * 3;
+    }
+}
+
+// Do one step of all active fades and send the frames. Channels which are
+// still busy sending are tried again on the next step
+static void ledFadeRun() {
+    unsigned ch, i, end;
+    uint8_t *p;
+    t_ledFade *f;
+    if ((int32_t)(xTaskGetTickCount() - g_ledFadeNext) < 0) {
+        return;
+    }
+    g_ledFadeNext = xTaskGetTickCount() + LED_FADE_MS / portTICK_PERIOD_MS;
+    for (ch = 0; ch < 3; ch++) {
+        f = &g_ledFade[ch];
+        if (f->nSteps == 0 || (g_ledLocked | g_ledStagedMask) & (1 << ch)) {
+            continue;
+        }
+        if (g_spiState[ch].doubleBuf) {
+            p = spiOpenBack(ch, true);
+        } else if (xSemaphoreTake(g_spiState[ch].semaToReleaseWhenFinished, 0)) {
+            p = g_spiBuffer[ch];
+        } else {
+            continue;
+        }
+        // Move each byte 1 / nSteps of the way towards the target
+        p += f->first * 3;
+        for (i = 0; i < f->nLeds * 3; i++) {
+            *p += ((int)f->rgb[i % 3] - *p) / (int)f->nSteps;
+            p++;
+        }
+        f->nSteps--;
+        end = (f->first + f->nLeds) * 3;
+        if (end > g_ledFrameLen[ch]) {
+            g_ledFrameLen[ch] = end;
+        }
+        spiLatch(ch, g_ledFrameLen[ch], false);     // releases the lock when done
+    }
+}
+
+// Ticks until ledFadeRun() needs to run again
+static TickType_t ledFadeWait() {
+    int32_t dt = g_ledFadeNext - xTaskGetTickCount();
+    unsigned ch;
+    for (ch = 0; ch < 3; ch++) {
+        if (g_ledFade[ch].nSteps) {
+            return dt > 0 ? dt : 0;
+        }
+    }
+    return portMAX_DELAY;
+}
+
+// Write LED data straight from the USB receive ring into the spiBuffer.
+// Returns the number of chars taken from p
+static uint32_t ledSinkWrite(const uint8_t *p, uint32_t n) {
+    uint32_t nCopy = MIN(n, g_parserRemaining);
+    if (g_ledSink.mode == LED_SINK_DELTA) {
+        ledDeltaWrite(p, nCopy);
+    } else if (g_ledSink.mode == LED_SINK_RLE) {
+        ledRleWrite(p, nCopy);
+    } else {
+        memcpy(g_ledSink.dest, p, nCopy);
+        g_ledSink.dest += nCopy;
+    }
+    g_parserRemaining -= nCopy;
+    if (g_parserRemaining == 0) {
+        ledClose();
+    }
+    return nCopy;
+}
+
+// ledOpen() succeeded, switch the parser to LED data
+static void parserStartLed() {
+    g_parserMode = PARS_MODE_BIN_LED;
+    if (g_parserRemaining == 0) {
+        ledClose();
+    }
+}
+
+// End of an ASCII command line, execute it
+static void lineEnd() {
+    static t_cmdArgs a;
+    uint32_t t0;
+    int8_t retVal;
+    int32_t seq = lineSeq();
+    if (g_line.inToken) {
+        tokenEnd();
+    }
+    if (g_line.nTokens == 0 && g_line.seq == SEQ_NONE) {      //This must be a \n, ignore silently
+        lineReset();
+        return;
+    }
+    cmdBegin(seq);
+    t0 = PRF_CYCLES();
+    if (seq == SEQ_NONE && g_line.seq != SEQ_NONE) {
+        retVal = CMD_INVALID_ARG;
+    } else {
+        retVal = lineArgs(&a);
+    }
+    if (retVal == 0) {
+        retVal = cmdRun(g_line.cmd, &a);
+    }
+    prfStop(PRF_CMD_PARSE, t0);
+    prfCount(PRF_CNT_CMDS, 1);
+    g_line.name[MIN(g_line.nName, CMD_NAME_LEN)] = '\0';
+    cmdReportError(retVal, g_line.name);
+    lineReset();
+    if (retVal == PARS_MODE_BIN_LED) {
+        parserStartLed();
+    } else {
+        cmdEnd();
+    }
+}
+
+// Process a binary frame once its header and fixed size fields are in
+// g_frame. Execute it and select how the rest of the frame is handled.
+static void binFrameExec() {
+    const t_cmdEntry *cmd = g_binCmd[g_frame[1]];
+    uint16_t len = getU16(&g_frame[2]);
+    uint16_t nRead = g_frameLen - BIN_HEADER_LEN;
+    static t_cmdArgs a;
+    uint32_t t0 = PRF_CYCLES();
+    int8_t retVal = binUnpackArgs(cmd, &g_frame[BIN_HEADER_LEN], len, &a);
+    if (retVal == 0) {
+        retVal = cmdRun(cmd, &a);
+    }
+    prfStop(PRF_CMD_PARSE, t0);
+    prfCount(PRF_CNT_CMDS, 1);
+    cmdReportError(retVal, cmd->name);
+    if (retVal == PARS_MODE_BIN_LED) {
+        parserStartLed();
+    } else {
+        parserSkip(len - nRead);
+        cmdEnd();
+    }
+}
+
+// Collect the binary frame header and fixed size fields in g_frame.
+// Returns the number of chars taken from p
+static uint32_t binFrameCollect(const uint8_t *p, uint32_t n) {
+    const t_cmdEntry *cmd = NULL;
+    uint16_t len, nRead;
+    uint32_t nCopy = MIN(n, g_frameLen - g_frameFill);
+    memcpy(&g_frame[g_frameFill], p, nCopy);
+    g_frameFill += nCopy;
+    if (g_frameFill < g_frameLen) {
+        return nCopy;
+    }
+    if (g_frameLen > BIN_HEADER_LEN) {
+        // Got the payload
+        binFrameExec();
+        return nCopy;
+    }
+    // Got the header, find out how much of the payload we need to collect
+    len = getU16(&g_frame[2]);
+    if (g_frame[1] < N_BIN_OP) {
+        cmd = g_binCmd[g_frame[1]];
+    }
+    if (!cmd) {
+        REPORT_ERROR("ER:0027\n");
+        UARTprintf("%22s: unknown opcode 0x%02x\n", "binFrameCollect()", g_frame[1]);
+        parserSkip(len);
+        cmdEnd();
+        return nCopy;
+    }
+    // For LED frames, only take the channel. The LED data is copied into the spiBuffer
+    nRead = binHasBlob(cmd) ? MIN(len, binFixedLen(cmd)) : len;
+    if (nRead > BIN_MAX_PAYLOAD) {
+        REPORT_ERROR("ER:0028\n");
+        UARTprintf("%22s: payload too long (%d)\n", "binFrameCollect()", len);
+        parserSkip(len);
+        cmdEnd();
+        return nCopy;
+    }
+    g_frameLen = BIN_HEADER_LEN + nRead;
+    if (nRead == 0) {
+        binFrameExec();
+    }
+    return nCopy;
+}
+
+// Feed n received chars to the parser. Everything is processed in place,
+// only the LED data is copied (into the spiBuffer).
+static void parserFeed(const uint8_t *p, uint32_t n) {
+    uint32_t nCopy;
+    uint8_t c;
+    while (n > 0) {
+        switch (g_parserMode) {
+        case PARS_MODE_ASCII:
+            c = *p++;
+            n--;
+            if (c == '\n' || c == '\r' || c == '\0') {
+                lineEnd();
+            } else if (c == BIN_FRAME_START && g_line.nTokens == 0 && !g_line.inSeq) {
+                // A binary frame starts here, it takes the sequence ID of the line
+                cmdBegin(lineSeq());
+                lineReset();
+                g_frame[0] = c;
+                g_frameFill = 1;
+                g_frameLen = BIN_HEADER_LEN;
+                g_parserMode = PARS_MODE_BIN_FRAME;
             } else {
-                // -----------------------------------------------------------
-                //  Here we have processed all chars in charBuffer and haven't
-                //  Found any EOL. Keep appending new stuff to it.
-                //  Also Check how many chars we can still append
-                // -----------------------------------------------------------
-                nCharsRead += remainderSize;
-                readPointer += remainderSize;
-                remainderSize = 0;
-                if( nCharsRead >= CMD_PARSER_BUF_LEN - 1 ){
-                    REPORT_ERROR( "ER:000A\n" );
-                    UARTprintf("%22s: %s", "taskUsbCommandParser()", "Command buffer overflow, try a shorter command!\n");
-                    USBBufferFlush( &g_sRxBuffer );
-                    writePointer = charBuffer;
-                    nCharsRead = 0;
-                    remainderSize = 0;
-                }                                       //We still have space!
+                lineChar(c);
             }
             break;
 
+        case PARS_MODE_BIN_FRAME:
+            nCopy = binFrameCollect(p, n);
+            p += nCopy;
+            n -= nCopy;
+            break;
+
         case PARS_MODE_BIN_LED:
-            // -----------------------------------------------------------
-            //  simply take g_LEDnBytesToCopy bytes from USB and put them
-            //  in the spiBuffer
-            // -----------------------------------------------------------
-            if(nCharsRead < g_LEDnBytesToCopy) {       //If there was not enough data in the remainder, get more over USB
-                ASSERT(remainderSize == 0);           //Remainder must be empty before we take data from USB
-                tempCharsRead = USBBufferRead(&g_sRxBuffer, spiWritePointer, g_LEDnBytesToCopy - nCharsRead);
-                spiWritePointer += tempCharsRead;
-                nCharsRead += tempCharsRead;
-            }
-            if(nCharsRead >= g_LEDnBytesToCopy) {      // Are we good already?
-                spiSend(g_LEDChannel, g_LEDnBytesToCopy);
-                // xSemaphoreGive(g_spiState[g_LEDChannel].semaToReleaseWhenFinished);
-                nCharsRead = 0;
-                currentMode = PARS_MODE_ASCII;
+            nCopy = ledSinkWrite(p, n);
+            p += nCopy;
+            n -= nCopy;
+            break;
+
+        case PARS_MODE_SKIP:
+            nCopy = MIN(n, g_parserRemaining);
+            p += nCopy;
+            n -= nCopy;
+            g_parserRemaining -= nCopy;
+            if (g_parserRemaining == 0) {
+                g_parserMode = PARS_MODE_ASCII;
             }
             break;
 
         default:
             REPORT_ERROR("ER:000B\n");
-            UARTprintf("%22s: currentMode unknown, 0x%02x\n", "taskUsbCommandParser()", currentMode);
-            currentMode = PARS_MODE_ASCII;
+            UARTprintf("%22s: currentMode unknown, 0x%02x\n", "parserFeed()", g_parserMode);
+            g_parserMode = PARS_MODE_ASCII;
         }
     }
 }
 
+void taskUsbCommandParser( void *pvParameters ) {
+    // Read data from USB serial and parse it
+    // The chars are parsed where they are in the USB receive ring buffer.
+    // Each contiguous chunk is released after processing,
+    // so lines wrapping around the end of the ring buffer need no copy.
+    UARTprintf("%22s: %s", "taskUsbCommandParser()", "Started!\n");
+    tUSBRingBufObject ring;
+    uint32_t nChars;
+    cmdInit();
+    lineReset();
+    while (1) {
+        ledFadeRun();
+        USBBufferInfoGet(&g_sRxBuffer, &ring);
+        nChars = USBRingBufContigUsed(&ring);
+        if (nChars == 0) {
+            ulTaskNotifyTake(pdTRUE, ledFadeWait());   // Wait for receiving new serial data over USB
+            continue;
+        }
+        prfCount(PRF_CNT_RX_BYTES, nChars);
+        parserFeed(&ring.pui8Buf[ring.ui32ReadIndex], nChars);
+        USBBufferDataRemoved(&g_sRxBuffer, nChars);
+    }
+}
+
+static bool isParserTask() {
+    return !(HWREG(NVIC_INT_CTRL) & NVIC_INT_CTRL_VEC_ACT_M) && xTaskGetCurrentTaskHandle() == hUSBCommandParser;
+}
+
+static void usbWaitTxSpace(uint32_t len) {
+//    The parser waits until the host has taken enough of the previous replies.
+//    Interrupts and the I/O task must not block, their replies are dropped instead.
+    if (!isParserTask()) {
+        return;
+    }
+    for (unsigned i = 0; i < USB_TX_WAIT_MS && USBBufferSpaceAvailable(&g_sTxBuffer) < len; i++) {
+        vTaskDelay(1);
+    }
+}
+
 void ts_usbSend(uint8_t *data, uint16_t len) {
 //    Do a thread safe USB TX transfer in background (add data to USB send buffer)
     uint32_t freeSpace;
+    usbWaitTxSpace(len);
     taskENTER_CRITICAL();
     UARTwrite((const char*) data, len);   //Echo to debug connection
     freeSpace = USBBufferSpaceAvailable(&g_sTxBuffer);
@@ -265,28 +1194,77 @@ void ts_usbSend(uint8_t *data, uint16_t len) {
     if (freeSpace >= len) {
         USBBufferWrite(&g_sTxBuffer, data, len);
     } else {
-       UARTprintf(
-            "%22s: Not enough space in USB TX buffer! Need %d have %d. <FLUSH>\n",
+        // Drop this message only, what is queued already (switch events) stays intact
+        UARTprintf(
+            "%22s: Not enough space in USB TX buffer! Need %d have %d. <DROP>\n",
             "ts_usbSend()",
             len,
             freeSpace
         );
-        USBBufferFlush(&g_sTxBuffer);
+        prfCount(PRF_CNT_USB_DROP, 1);
+    }
+    taskEXIT_CRITICAL();
+}
+
+int32_t cmdSeq() {
+    // Errors raised by interrupts or other tasks don't belong to the command
+    if (!isParserTask()) {
+        return SEQ_NONE;
+    }
+    return g_cmdSeq;
+}
+
+void reportError(const char *errStr, int32_t seq) {
+    char buf[16];           // 'ER:1234 #65535\n'
+    unsigned len = 8;
+    memcpy(buf, errStr, 8);
+    if (seq != SEQ_NONE) {
+        len = 7 + usprintf(&buf[7], " #%d\n", seq);
+        if (seq == cmdSeq()) {
+            g_cmdReplied = true;
+        }
+    }
+    ts_usbSend((uint8_t *)buf, len);
+}
+
+bool ts_usbTrySendFrame(uint8_t opcode, uint8_t *data, uint16_t len) {
+//    Send a binary reply frame only if it fits completely, keeps the USB buffer intact
+    uint8_t header[BIN_HEADER_LEN] = {BIN_FRAME_START, opcode | BIN_REPLY, len & 0xFF, len >> 8};
+    bool isSent = false;
+    taskENTER_CRITICAL();
+    if (USBBufferSpaceAvailable(&g_sTxBuffer) >= BIN_HEADER_LEN + len) {
+        USBBufferWrite(&g_sTxBuffer, header, BIN_HEADER_LEN);
+        USBBufferWrite(&g_sTxBuffer, data, len);
+        isSent = true;
     }
     taskEXIT_CRITICAL();
+    return isSent;
+}
+
+void ts_usbSendFrame(uint8_t opcode, uint8_t *data, uint16_t len) {
+//    Send a binary reply frame to the host, thread safe like ts_usbSend()
+    usbWaitTxSpace(BIN_HEADER_LEN + len);
+    if (!ts_usbTrySendFrame(opcode, data, len)) {
+        UARTprintf(
+            "%22s: Not enough space in USB TX buffer! Need %d. <DROP>\n",
+            "ts_usbSendFrame()",
+            BIN_HEADER_LEN + len
+        );
+        prfCount(PRF_CNT_USB_DROP, 1);
+    }
 }
 
 // This function implements the "help" command.  It prints a simple list of the available commands with a brief description.
-int Cmd_help(int argc, char *argv[]) {
-    tCmdLineEntry *pEntry;
+int Cmd_help(t_cmdArgs *a) {
+    const t_cmdEntry *pEntry;
     UARTprintf("\n**************************************************\n");
     UARTprintf(  " Available commands   <required>  [optional]\n");
     UARTprintf(  "**************************************************\n");
-    pEntry = &g_psCmdTable[0];    // Point at the beginning of the command table.
+    pEntry = &g_cmdTable[0];    // Point at the beginning of the command table.
     // Enter a loop to read each entry from the command table.  The end of the
     // table has been reached when the command name is NULL.
-    while (pEntry->pcCmd) {
-        UARTprintf("%6s%s\n", pEntry->pcCmd, pEntry->pcHelp);// Print the command name and the brief description.
+    while (pEntry->name) {
+        UARTprintf("%6s%s\n", pEntry->name, pEntry->help);// Print the command name and the brief description.
         pEntry++;                    // Advance to the next entry in the table.
 #ifdef UART_BUFFERED
         while( UARTTxBytesFree() < 150 ){
@@ -297,7 +1275,7 @@ int Cmd_help(int argc, char *argv[]) {
     return 0;                                                // Return success.
 }
 
-int Cmd_IDN(int argc, char *argv[]) {
+int Cmd_IDN(t_cmdArgs *a) {
     const uint8_t buff[] = VERSION_IDN;
     ts_usbSend((uint8_t*)buff, VERSION_IDN_LEN);
     UARTprintf(VERSION_INFO);
@@ -305,17 +1283,29 @@ int Cmd_IDN(int argc, char *argv[]) {
     return 0;
 }
 
-int Cmd_OL(int argc, char *argv[]){
+int Cmd_OL(t_cmdArgs *a){
     print_out_writer_list();
     return 0;
 }
 
-int Cmd_IL(int argc, char *argv[]){
+int Cmd_IL(t_cmdArgs *a){
     print_pcf_state();
     return 0;
 }
 
-int Cmd_IR(int argc, char *argv[]){
+int Cmd_PRF(t_cmdArgs *a){
+    prfPrint();
+    // Resource usage, lowest values since boot
+    UARTprintf("%20s %8d bytes (now %d)\n", "min. free heap", xPortGetMinimumEverFreeHeapSize(), xPortGetFreeHeapSize());
+    UARTprintf("%20s %8d words\n", "min. free stack IO", uxTaskGetStackHighWaterMark(hPcfInReader));
+    UARTprintf("%20s %8d words\n", "min. free stack Pars", uxTaskGetStackHighWaterMark(hUSBCommandParser));
+    if (a->v[0].u) {
+        prfReset();
+    }
+    return 0;
+}
+
+int Cmd_IR(t_cmdArgs *a){
     UARTprintf("Reseting I2C system ... ");
     g_reDiscover = 1;
     // task might be blocked (no pullups?) ...
@@ -323,11 +1313,15 @@ int Cmd_IR(int argc, char *argv[]){
     return 0;
 }
 
-int Cmd_SW(int argc, char *argv[]) {
+int Cmd_SW(t_cmdArgs *a) {
     // Report state of all switches
     static char outBuffer[REPORT_SWITCH_BUF_SIZE];
     uint16_t charsWritten = 3;
     uint8_t i;
+    if (a->binReply) {
+        ts_usbSendFrame(BIN_OP_SW, g_SwitchStateDebounced.charValues, N_CHARS);
+        return 0;
+    }
     ustrncpy(outBuffer, "SW:", REPORT_SWITCH_BUF_SIZE); //SW = Hex coded switch state
     for (i = 0; i < N_LONGS; i++) {
         charsWritten += usnprintf(
@@ -347,148 +1341,112 @@ int Cmd_SW(int argc, char *argv[]) {
     return 0;
 }
 
-int Cmd_DEB(int argc, char *argv[]) {
-    //Enable / Disable the 12 ms debouncing timer for an input
-    uint16_t hwIndex;
-    uint8_t onOff;
-    t_hw_index inputSwitchId;
-    if (argc == 3) {
-        hwIndex = ustrtoul(argv[1], NULL, 0);
-        onOff = ustrtoul(argv[2], NULL, 0);     // 1: Debouncing ON
-        inputSwitchId = decodeHwIndex( hwIndex, 1 );
-        if (inputSwitchId.channel == C_INVALID) {
-            REPORT_ERROR( "ER:000D\n" );
-            UARTprintf( "%22s: inputSwitchId = %s invalid\n", "Cmd_DEB()", argv[1] );
-            return 0;
-        }
-        if( onOff ){
-            // Reset noDebounce Flag
-            HWREGBITB( &g_SwitchStateNoDebounce.charValues[inputSwitchId.byteIndex], inputSwitchId.pinIndex ) = 0;
-        } else {
-            // Set noDebounce Flag
-            HWREGBITB( &g_SwitchStateNoDebounce.charValues[inputSwitchId.byteIndex], inputSwitchId.pinIndex ) = 1;
-        }
+int Cmd_SWS(t_cmdArgs *a) {
+    // Binary snapshot of all switches, also when sent as ASCII command
+    // [u32 tick] [40 bytes debounced] [40 bytes sampled (optional)]
+    // process_IO() sends it right after the next debouncing step
+    if (!requestSwitchSnapshot(a->v[0].u, cmdSeq())) {
+        REPORT_ERROR("ER:002B\n");
+        UARTprintf("%22s: I/O task did not send the previous snapshot yet\n", "Cmd_SWS()");
         return 0;
     }
-    return CMDLINE_TOO_FEW_ARGS;
+    g_cmdReplied = true;    // process_IO() replies with the sequence ID
+    return 0;
 }
 
-int Cmd_SOE(int argc, char *argv[]) {
-    uint8_t onOff;
-    if (argc == 2) {
-        onOff = ustrtoul(argv[1], NULL, 0);
-        if (onOff) {
-            ENABLE_SOLENOIDS();
-            UARTprintf("Cmd_SOE(): 24 V enabled.\n");
-            return 0;
-        } else {
-            DISABLE_SOLENOIDS();
-            UARTprintf("Cmd_SOE(): 24 V disabled.\n");
-            return 0;
-        }
+int Cmd_DEB(t_cmdArgs *a) {
+    //Enable / Disable the 12 ms debouncing timer for an input
+    t_hw_index *inputSwitchId = &a->v[0].hw;
+    if( a->v[1].u ){
+        // Reset noDebounce Flag
+        HWREGBITB( &g_SwitchStateNoDebounce.charValues[inputSwitchId->byteIndex], inputSwitchId->pinIndex ) = 0;
+    } else {
+        // Set noDebounce Flag
+        HWREGBITB( &g_SwitchStateNoDebounce.charValues[inputSwitchId->byteIndex], inputSwitchId->pinIndex ) = 1;
     }
-    return CMDLINE_TOO_FEW_ARGS;
+    return 0;
 }
 
-int Cmd_OUT(int argc, char *argv[]) {
-//    OUT <hwIndex> <PWMlow> <tPulse> <PWMhigh>   or OUT <hwIndex> <PWMvalue>
-//    OUT 0x0FE 1 1500 15
-//    OUT 0x0FE 2
-    int32_t hwIndex;
-    t_hw_index outLocation;
-    uint16_t tPulse, pwmHigh, pwmLow;
-    if (argc == 5) {
-        tPulse  = ustrtoul(argv[3], NULL, 0);
-        pwmHigh = ustrtoul(argv[4], NULL, 0);
-        pwmLow  = ustrtoul(argv[2], NULL, 0);
-    } else if (argc == 3) {
-        tPulse  = 0;
-        pwmLow  = ustrtoul(argv[2], NULL, 0);
-        pwmHigh = pwmLow;
-    } else {
-        return( CMDLINE_TOO_FEW_ARGS );
-    }
-    hwIndex = ustrtoul(argv[1], NULL, 0);
-    outLocation = decodeHwIndex(hwIndex, 0);
-    switch(outLocation.channel){
-    case C_I2C0:
-    case C_I2C1:
-    case C_I2C2:
-    case C_I2C3:
-        if (pwmHigh >= (1 << N_BIT_PWM) || pwmLow >= (1 << N_BIT_PWM)) {
-            REPORT_ERROR( "ER:000E\n" );
-            UARTprintf("Cmd_OUT(): I2C PWMvalue must be < %d\n", (1 << N_BIT_PWM));
-            return 0;
-        }
-        UARTprintf("Cmd_OUT(): i2cCh %d, i2cAdr 0x%02x, bit %d = tp %d, pH %d, pL %d\n", outLocation.channel, outLocation.i2c_addr, outLocation.pinIndex, tPulse, pwmHigh, pwmLow);
-        setPCFOutput(&outLocation, tPulse, pwmHigh, pwmLow);
-        return 0;
-
-    case C_FAST_PWM:
-        if ( pwmHigh > MAX_PWM || pwmLow > MAX_PWM ) {
-            REPORT_ERROR( "ER:000F\n" );
-            UARTprintf("Cmd_OUT(): HW PWMvalue must be <= %d\n", MAX_PWM);
-            return 0;
-        }
-        UARTprintf("Cmd_OUT(): HW_PWM_CH %d, tp %d, pH %d, pL %d\n", outLocation.pinIndex, tPulse, pwmHigh, pwmLow);
-        setPCFOutput(&outLocation, tPulse, pwmHigh, pwmLow);
+int Cmd_SWC(t_cmdArgs *a) {
+    // Setup the coalescing window of binary switch events
+    if (a->argc == 0) {
+        printSwitchEventQueue();
         return 0;
+    }
+    g_sweWindow = a->v[0].u;
+    g_sweFlushLen = a->argc > 1 ? a->v[1].u : REPORT_SWITCH_BIN_SIZE;
+    return 0;
+}
 
-    case C_SWITCH_MATRIX:
-        REPORT_ERROR( "ER:0010\n" );
-        UARTprintf("Cmd_OUT(): HW_INDEX_INVALID: %s\n", argv[1]);
-        return 0;
+int Cmd_SWU(t_cmdArgs *a) {
+    // Flag an input as urgent, its events bypass the coalescing window
+    t_hw_index *inputSwitchId = &a->v[0].hw;
+    HWREGBITB( &g_SwitchStateUrgent.charValues[inputSwitchId->byteIndex], inputSwitchId->pinIndex ) = a->v[1].u ? 1 : 0;
+    return 0;
+}
 
-    case C_INVALID:
-        REPORT_ERROR( "ER:0011\n" );
-        UARTprintf("Cmd_OUT(): HW_INDEX_INVALID: %s\n", argv[1]);
-        return 0;
+int Cmd_SWM(t_cmdArgs *a) {
+    // Set which inputs are reported as switch events, 1 bit per hwIndex.
+    // Debouncing and quick rules still see all of them.
+    taskENTER_CRITICAL();
+    memcpy(g_SwitchStateSubscribed.charValues, a->hex, N_CHARS);
+    taskEXIT_CRITICAL();
+    return 0;
+}
 
-    default:
+int Cmd_SOE(t_cmdArgs *a) {
+    if (a->v[0].u) {
+        ENABLE_SOLENOIDS();
+        UARTprintf("Cmd_SOE(): 24 V enabled.\n");
+    } else {
         DISABLE_SOLENOIDS();
-        REPORT_ERROR( "ER:0012\n" );
+        UARTprintf("Cmd_SOE(): 24 V disabled.\n");
     }
     return 0;
 }
 
-int Cmd_SWE(int argc, char *argv[]) {
-    //Enable / Disable the reporting of Switch Events
-    uint8_t onOff;
-    if (argc == 2) {
-        onOff = ustrtoul(argv[1], NULL, 0);
-        if( onOff ){
-            g_reportSwitchEvents = 1;
-        } else {
-            g_reportSwitchEvents = 0;
-        }
-        return 0;
+int Cmd_OUT(t_cmdArgs *a) {
+//    OUT <hwIndex> <PWMlow> <tPulse> <PWMhigh>   or OUT <hwIndex> <PWMvalue>
+//    OUT 0x0FE 1 1500 15
+//    OUT 0x0FE 2
+//    PWM ranges of I2C and HW. PWM outputs have been checked by the schema
+    t_hw_index *outLocation = &a->v[0].hw;
+    uint16_t pwmLow = a->v[1].u, tPulse = a->v[2].u, pwmHigh = a->v[3].u;
+    if (a->argc < 4) {
+        pwmHigh = pwmLow;
+    }
+    if (outLocation->channel == C_FAST_PWM) {
+        UARTprintf("Cmd_OUT(): HW_PWM_CH %d, tp %d, pH %d, pL %d\n", outLocation->pinIndex, tPulse, pwmHigh, pwmLow);
+    } else {
+        UARTprintf("Cmd_OUT(): i2cCh %d, i2cAdr 0x%02x, bit %d = tp %d, pH %d, pL %d\n", outLocation->channel, outLocation->i2c_addr, outLocation->pinIndex, tPulse, pwmHigh, pwmLow);
     }
-    return CMDLINE_TOO_FEW_ARGS;
+    setPCFOutput(outLocation, tPulse, pwmHigh, pwmLow);
+    return 0;
+}
+
+int Cmd_SWE(t_cmdArgs *a) {
+    //Enable / Disable the reporting of Switch Events, as text or binary frames
+    g_reportSwitchEvents = a->v[0].u;
+    return 0;
+}
+
+int Cmd_SWR(t_cmdArgs *a) {
+    //Enable / Disable the reporting of raw (not debounced) switch samples
+    g_recordSwitchSamples = a->v[0].u;
+    return 0;
 }
 
-int Cmd_RULE(int argc, char *argv[]) {
+int Cmd_RULE(t_cmdArgs *a) {
     //Enable / Disable a quickfire rule
-    uint8_t id, onOff;
-    if (argc == 3) {
-        id = ustrtoul(argv[1], NULL, 0);
-        onOff = ustrtoul(argv[2], NULL, 0);
-        if (id >= MAX_QUICK_RULES) {
-            REPORT_ERROR( "ER:0013\n" );
-            UARTprintf("%22s: quickRuleId must be < %d\n", "Cmd_RULE()",
-                    MAX_QUICK_RULES);
-            return 0;
-        }
-        if( onOff ){
-            enableQuickRule(id);
-        } else {
-            disableQuickRule(id);
-        }
-        return 0;
+    if( a->v[1].u ){
+        enableQuickRule(a->v[0].u);
+    } else {
+        disableQuickRule(a->v[0].u);
     }
-    return CMDLINE_TOO_FEW_ARGS;
+    return 0;
 }
 
-int Cmd_RUL(int argc, char *argv[]) {
+int Cmd_RUL(t_cmdArgs *a) {
 // Configure and activate a Quick-fire rule:
 //  * quickRuleId (0 .. MAX_QUICK_RULES - 1)
 //  * input switch hwIndex
@@ -503,174 +1461,157 @@ int Cmd_RUL(int argc, char *argv[]) {
 //  ------------------
 //  RUL ID IDin IDout trHoldOff tPulse pwmOn pwmOff bPosEdge
 //  RUL 0 0x23 0x100 4 1 15 3 1
-    uint8_t id;
-    int16_t pwmHigh, pwmLow;
-    uint16_t triggerHoldOffTime, tPulse, hwIndex;
-    t_hw_index inputSwitchId, outputDriverId;
-    bool trigPosEdge;
-    if (argc == 9) {
-        id = ustrtoul(argv[1], NULL, 0);
-        triggerHoldOffTime = ustrtoul(argv[4], NULL, 0);
-        tPulse = ustrtoul(argv[5], NULL, 0);
-        pwmHigh = ustrtoul(argv[6], NULL, 0);
-        pwmLow = ustrtoul(argv[7], NULL, 0);
-        trigPosEdge = ustrtoul(argv[8], NULL, 0) == 1;
-        if (id >= MAX_QUICK_RULES) {
-            REPORT_ERROR( "ER:0014\n" );
-            UARTprintf("%22s: quickRuleId must be < %d\n", "Cmd_RUL()",
-                    MAX_QUICK_RULES);
-            return 0;
-        }
-        inputSwitchId = decodeHwIndex( ustrtoul(argv[2], NULL, 0), 1 );
-        if ( inputSwitchId.channel == C_INVALID) {
-            REPORT_ERROR( "ER:0015\n" );
-            UARTprintf( "%22s: inputSwitchId = %s invalid\n", "Cmd_RUL()", argv[2] );
-            return 0;
-        }
-        hwIndex = ustrtoul(argv[3], NULL, 0);
-        outputDriverId = decodeHwIndex(hwIndex, 0);
-        switch (outputDriverId.channel){
-        case C_I2C0:
-        case C_I2C1:
-        case C_I2C2:
-        case C_I2C3:
-            if ( pwmHigh >= (1 << N_BIT_PWM) || pwmLow >= (1 << N_BIT_PWM) ) {
-                REPORT_ERROR( "ER:0016\n" );
-                UARTprintf( "%22s: pwmValues must be < %d\n", "Cmd_RUL()", (1 << N_BIT_PWM) );
-                return 0;
-            }
-            break;
-        case C_FAST_PWM:
-            if (pwmHigh > MAX_PWM || pwmLow > MAX_PWM) {
-                REPORT_ERROR("ER:0017\n");
-                UARTprintf("%22s: HW pwmValues must be < %d\n", "Cmd_RUL()", MAX_PWM);
-                return 0;
-            }
-            break;
-        case C_INVALID:
-        case C_SWITCH_MATRIX:
-            REPORT_ERROR( "ER:0018\n" );
-            UARTprintf( "%22s: outputDriverId = %s invalid\n", "Cmd_RUL()", argv[3] );
-            return 0;
-        }
-        UARTprintf("%22s: Setting up autofiring rule %d\n", "Cmd_RUL()", id);
-        setupQuickRule( id, inputSwitchId, outputDriverId, triggerHoldOffTime,
-                tPulse, pwmHigh, pwmLow, trigPosEdge );
-        return 0;
-    }
-    return CMDLINE_TOO_FEW_ARGS;
+    UARTprintf("%22s: Setting up autofiring rule %d\n", "Cmd_RUL()", a->v[0].u);
+    setupQuickRule(
+        a->v[0].u,              // id
+        a->v[1].hw,             // inputSwitchId
+        a->v[2].hw,             // outputDriverId
+        a->v[3].u,              // triggerHoldOffTime
+        a->v[4].u,              // tPulse
+        a->v[5].u,              // pwmHigh
+        a->v[6].u,              // pwmLow
+        a->v[7].u               // trigPosEdge
+    );
+    return 0;
 }
 
-int Cmd_LEC(int argc, char *argv[]) {   //Here we need re - initialize the SPI module
+int Cmd_LEC(t_cmdArgs *a) {   //Here we need re - initialize the SPI module
     //LEC <channel> <spiSpeed [Hz]> <SSI_FRF (opt)>"
-    uint8_t channel;
-    uint32_t baseAddr, spiSpeed, frameFmt=SSI_FRF_MOTO_MODE_1;
-    if( argc==3 || argc==4 ){
-        channel = ustrtoul(argv[1], NULL, 0);
-        if( channel<=2 ){
-            baseAddr = g_spiState[channel].baseAdr;
-        } else {
-            REPORT_ERROR( "ER:0019\n" );
-            UARTprintf("%22s: Invalid LED channel (%d)\n", "Cmd_LEC()", channel);
-            return 0;
-        }
-        spiSpeed = ustrtoul(argv[2], NULL, 0);
-        if( argc == 4 ){
-            frameFmt = ustrtoul(argv[3], NULL, 0);
-        }
-        while( HWREG( baseAddr + SSI_O_SR ) & SSI_SR_BSY ){  //Wait for SPI to finish
-            vTaskDelay( 10 );
-        }
-        UARTprintf("%22s: Setting SPI to %d Hz, frameFmt = 0x%02x\n", "Cmd_LEC()", spiSpeed, frameFmt);
-        ROM_SSIDisable( baseAddr );
-        // SPI at 3.2 MHz, 16 bit SPI words (encoding 4 bit data each)
-        ROM_SSIConfigSetExpClk( baseAddr, SYSTEM_CLOCK, frameFmt, SSI_MODE_MASTER, spiSpeed, 16 );
-        ROM_SSIEnable( baseAddr );
-    } else {
-        return( CMDLINE_TOO_FEW_ARGS );
+    uint8_t channel = a->v[0].u;
+    uint32_t baseAddr = g_spiState[channel].baseAdr;
+    uint32_t spiSpeed = a->v[1].u, frameFmt=SSI_FRF_MOTO_MODE_1;
+    if( a->argc == 3 ){
+        frameFmt = a->v[2].u;
     }
-
+    while( HWREG( baseAddr + SSI_O_SR ) & SSI_SR_BSY ){  //Wait for SPI to finish
+        vTaskDelay( 10 );
+    }
+    UARTprintf("%22s: Setting SPI to %d Hz, frameFmt = 0x%02x\n", "Cmd_LEC()", spiSpeed, frameFmt);
+    ROM_SSIDisable( baseAddr );
+    // SPI at 3.2 MHz, 16 bit SPI words (encoding 4 bit data each)
+    ROM_SSIConfigSetExpClk( baseAddr, SYSTEM_CLOCK, frameFmt, SSI_MODE_MASTER, spiSpeed, 16 );
+    ROM_SSIEnable( baseAddr );
+    // Keep the latch gap >= SPI_LATCH_US at the new speed
+    g_spiState[channel].spiSpeed = spiSpeed;
+    g_spiState[channel].nLatchWords = spiLatchWords( spiSpeed );
+    spiPrintTiming( channel );
     return 0;
 }
 
 //Here we need to switch the serialCommandParser to Binary mode
-int Cmd_LED(int argc, char *argv[])
+int Cmd_LED(t_cmdArgs *a)
 {
     //LED 0 128\nxxxxxx
-    unsigned channel, blobSize;
-    if(argc != 3) {
-        REPORT_ERROR( "ER:001D\n" );
-        UARTprintf("%22s: Invalid number of arguments (%d)\n", "Cmd_LED()", argc);
-        return 0;
-    }
-    channel = ustrtoul(argv[1], NULL, 0);
-    if (channel > 2) {
-        REPORT_ERROR( "ER:001C\n" );
-        UARTprintf("%22s: Invalid LED channel (%d)\n", "Cmd_LED()", channel);
-        return 0;
-    }
-    blobSize = ustrtoul(argv[2], NULL, 0);
-    if((blobSize % 3) || (blobSize > N_LEDS_MAX * 3)) {
-        REPORT_ERROR("ER:001A\n");
-        UARTprintf("%22s: Invalid number of bytes (%d)\n", "Cmd_LED()", blobSize);
-        return 0;
+    return ledOpen(a->v[0].u, 0, a->v[1].u, true, LED_SINK_RAW);
+}
+
+// Write a part of the LED frame, other commands can be sent in between
+int Cmd_LEP(t_cmdArgs *a)
+{
+    //LEP 0 384 1 6\nxxxxxx
+    return ledOpen(a->v[0].u, a->v[1].u, a->v[3].u, a->v[2].u, LED_SINK_RAW);
+}
+
+// Patch spans of LEDs and resend the frame
+int Cmd_LEDD(t_cmdArgs *a)
+{
+    //LEDD 0 9\n[u16 first LED][u8 nLEDs][nLEDs * RGB] ...
+    return ledOpen(a->v[0].u, 0, a->v[1].u, true, LED_SINK_DELTA);
+}
+
+// Receive a run length encoded frame
+int Cmd_LEDR(t_cmdArgs *a)
+{
+    //LEDR 0 8\n[u8 nLEDs][RGB] ...
+    return ledOpen(a->v[0].u, 0, a->v[1].u, true, LED_SINK_RLE);
+}
+
+// Fade a range of LEDs from their current color to a solid color
+int Cmd_FADE(t_cmdArgs *a)
+{
+    //FADE 0 10 20 0xFF8000 500
+    unsigned channel = a->v[0].u, first = a->v[1].u, nLeds = a->v[2].u;
+    uint32_t rgb = a->v[3].u;
+    t_ledFade *f = &g_ledFade[channel];
+    // The frame buffer holds palette indices, not colors
+    if (g_spiState[channel].palette) {
+        UARTprintf("%22s: channel %d is palette indexed\n", "Cmd_FADE()", channel);
+        return CMD_INVALID_ARG;
     }
-    //-------------------------
-    // Lock the SPI channel
-    //-------------------------
-    t_spiTransferState *state = &g_spiState[channel];
-    if(!xSemaphoreTake(state->semaToReleaseWhenFinished, 1000)) {
-        REPORT_ERROR( "ER:001B\n" );
-        UARTprintf("%22s: Timeout, could not access sendBuffer %d\n", "spiSend()", channel);
-        return 0;
+    if ((first + nLeds) * 3 > ledMaxBytes(channel, LED_SINK_RAW)) {
+        UARTprintf("%22s: LEDs %d - %d out of range\n", "Cmd_FADE()", first, first + nLeds - 1);
+        return CMD_INVALID_ARG;
     }
-    g_LEDnBytesToCopy = blobSize;   //We got the Lock, start copy process
-    g_LEDChannel = channel;
-    return PARS_MODE_BIN_LED;
+    f->first = first;
+    f->nLeds = nLeds;
+    f->rgb[0] = rgb >> 16;
+    f->rgb[1] = rgb >> 8;
+    f->rgb[2] = rgb;
+    f->nSteps = MAX(a->v[4].u / LED_FADE_MS, 1);
+    g_ledFadeNext = xTaskGetTickCount();
+    return 0;
+}
+
+// Receive a frame of palette indices, 1 byte per LED
+int Cmd_LEDI(t_cmdArgs *a)
+{
+    //LEDI 0 300\n<300 indices>
+    return ledOpen(a->v[0].u, 0, a->v[1].u, true, LED_SINK_INDEXED);
 }
 
-static uint8_t hexToNibble(char hexChar)
+// Write colors of the palette used by LEDI
+int Cmd_LPAL(t_cmdArgs *a)
 {
-    if(hexChar >= '0' && hexChar <= '9') {
-        return(hexChar - '0');
-    } else if (hexChar >= 'a' && hexChar <= 'f'){
-        return(hexChar - 'a' + 10);
-    } else if (hexChar >= 'A' && hexChar <= 'F'){
-        return(hexChar - 'A' + 10);
+    //LPAL 0 16 6\nRGBRGB
+    // The palette is kept at the end of the spiBuffer. Without double buffering,
+    // it is locked until the next frame is latched
+    return ledOpen(a->v[0].u, N_LEDS_MAX_INDEXED + a->v[1].u * 3, a->v[2].u, false, LED_SINK_PALETTE);
+}
+
+// Stage latched LED frames until LCMT. Switching it off sends staged frames
+int Cmd_LSTG(t_cmdArgs *a)
+{
+    //LSTG 1
+    g_ledStage = a->v[0].u;
+    if (!g_ledStage) {
+        ledCommit();
     }
-    return(0);
+    return 0;
 }
 
-static char nibbleToHex(unsigned nibble)
+// Send all staged LED frames at the same time
+int Cmd_LCMT(t_cmdArgs *a)
 {
-    return "0123456789ABCDEF"[nibble & 0x0F];
+    //LCMT
+    ledCommit();
+    return 0;
 }
 
-// Takes a string, returns a buff. Make sure to free it after use.
-uint8_t *hexToBuff(char *str, unsigned *nWritten)
+// Switch double buffering of a channel on / off
+int Cmd_LDB(t_cmdArgs *a)
 {
-    uint8_t *p, *buff;
-    unsigned nBytesTx = ustrlen(str);      //argv[3] string contains hex characters [0FFEDEADBEEF]
-    if (nBytesTx % 2) {
-        UARTprintf("%22s: hex string must be even length\n", "hexToBuff()");
-        *nWritten = 0;
-        return NULL;
-    }
-    nBytesTx /= 2;
-    buff = pvPortMalloc(nBytesTx);
-    if (!buff) {
-        UARTprintf("%22s: pvPortMalloc() failed\n", "hexToBuff()");
-        *nWritten = 0;
-        return NULL;
-    }
-    p = buff;
-    for(unsigned i=0; i<nBytesTx; i++) {
-        *p  = hexToNibble(*str++) << 4;
-        *p |= hexToNibble(*str++);
-        p++;
-    }
-    *nWritten = nBytesTx;
-    return buff;
+    //LDB 0 1
+    unsigned channel = a->v[0].u;
+    t_spiTransferState *state = &g_spiState[channel];
+    // Without double buffering, an open frame holds the lock already
+    bool locked = (g_ledLocked & (1 << channel)) && !state->doubleBuf;
+    if (!locked && !xSemaphoreTake(state->semaToReleaseWhenFinished, 1000)) {
+        REPORT_ERROR("ER:001B\n");
+        UARTprintf("%22s: Timeout, could not access sendBuffer %d\n", "Cmd_LDB()", channel);
+        return 0;
+    }
+    g_ledLocked &= ~(1 << channel);
+    g_ledStagedMask &= ~(1 << channel);
+    g_ledFade[channel].nSteps = 0;
+    g_ledFrameLen[channel] = 0;
+    spiSetDoubleBuffer(channel, a->v[1].u);
+    xSemaphoreGive(state->semaToReleaseWhenFinished);
+    return 0;
+}
+
+static char nibbleToHex(unsigned nibble)
+{
+    return "0123456789ABCDEF"[nibble & 0x0F];
 }
 
 // Takes a buffer, writes hex string to dest
@@ -685,94 +1626,68 @@ char *buffToHex(uint8_t *buf, unsigned len, char *dest)
     return dest;
 }
 
-// Fills up a t_i2cCustom after sanity checking and puts it on the queue
-int Cmd_I2C(int argc, char *argv[]) {
+// Fills up a t_i2cCustom and puts it on the queue
+int Cmd_I2C(t_cmdArgs *a) {
     //I2C <channel> <I2Caddr> [<sendData>] <nBytesRx>
     t_i2cCustom i2c;
-    if (argc == 5 || argc == 4) {
-        i2c.channel = ustrtoul(argv[1], NULL, 0);
-        if (i2c.channel > 3) {
-            REPORT_ERROR("ER:001E\n");
-            UARTprintf("%22s: I2C Channel must be <= 4\n", "Cmd_I2C()");
-            return 0;
-        }
-        i2c.i2c_addr = ustrtoul(argv[2], NULL, 0);
-        if (i2c.i2c_addr > 127) {
-            REPORT_ERROR("ER:001E\n");
-            UARTprintf("%22s: I2Caddr must be <= 127\n", "Cmd_I2C()");
-            return 0;
-        }
-        i2c.readBuff = NULL;
-        if (argc == 4) {
-            i2c.nWrite = 0;
-            i2c.writeBuff = NULL;
-            i2c.nRead = ustrtoul(argv[3], NULL, 0);
-        } else {
-            i2c.writeBuff = hexToBuff(argv[3], (unsigned*)&i2c.nWrite);
-            if (!i2c.writeBuff) return 0;
-            i2c.nRead = ustrtoul(argv[4], NULL, 0);
-        }
-        if (i2c.nRead > 0) {
-            i2c.readBuff = pvPortMalloc(i2c.nRead);
-            if (!i2c.readBuff) {
-                UARTprintf("%22s: read buffer not allocated :(\n", "Cmd_I2C()");
-                vPortFree(i2c.writeBuff); i2c.writeBuff = NULL;
-                vPortFree(i2c.readBuff); i2c.readBuff = NULL;
-                return 0;
-            }
-        }
-        // UARTprintf(
-        //     "CH: %x, addr: %x, nRead: %x, nWrite: %x [",
-        //     i2c.channel,
-        //     i2c.i2c_addr,
-        //     i2c.nRead,
-        //     i2c.nWrite
-        // );
-        // for (unsigned i=0; i<i2c.nWrite; i++) {
-        //     UARTprintf("%02x ", i2c.writeBuff[i]);
-        // }
-        // UARTprintf("]\n");
-        if(!xQueueSendToBack(g_i2c_queue, &i2c, 100 / portTICK_PERIOD_MS)) {
-            UARTprintf("%22s: I2C queue full!\n", "Cmd_I2C()");
-            vPortFree(i2c.writeBuff); i2c.writeBuff = NULL;
-            vPortFree(i2c.readBuff); i2c.readBuff = NULL;
-        }
+    i2c.channel = a->v[0].u;
+    i2c.i2c_addr = a->v[1].u;
+    i2c.nWrite = a->nHex;
+    i2c.nRead = a->v[3].u;
+    i2c.binReply = a->binReply;
+    i2c.seq = cmdSeq();
+    // a->hex is gone after we return, copy it into a transaction buffer
+    if (!i2c_custom_alloc(&i2c, a->hex)) {
+        REPORT_ERROR("ER:0022\n");
+        UARTprintf("%22s: transaction buffer not allocated :(\n", "Cmd_I2C()");
+        return 0;
+    }
+    // UARTprintf(
+    //     "CH: %x, addr: %x, nRead: %x, nWrite: %x [",
+    //     i2c.channel,
+    //     i2c.i2c_addr,
+    //     i2c.nRead,
+    //     i2c.nWrite
+    // );
+    // for (unsigned i=0; i<i2c.nWrite; i++) {
+    //     UARTprintf("%02x ", i2c.writeBuff[i]);
+    // }
+    // UARTprintf("]\n");
+    if(!xQueueSendToBack(g_i2c_queue, &i2c, 100 / portTICK_PERIOD_MS)) {
+        REPORT_ERROR("ER:0029\n");
+        UARTprintf("%22s: I2C queue full!\n", "Cmd_I2C()");
+        i2c_custom_free(&i2c);
         return 0;
     }
-    return CMDLINE_TOO_FEW_ARGS;
+    g_cmdReplied = true;    // handle_i2c_custom() replies with the sequence ID
+    return 0;
 }
 
-int Cmd_HI(int argc, char *argv[]) {
+int Cmd_HI(t_cmdArgs *a) {
     // Writes a 0xFF to the relevant PCF to be used as input
     // HI 0x123
     t_i2cCustom i2c;
-    if(argc != 2) return CMDLINE_TOO_FEW_ARGS;
-    t_hw_index i = decodeHwIndex(ustrtoul(argv[1], NULL, 0), 1);
-    if (i.channel > 3) {
-        REPORT_ERROR("ER:001E\n");
-        UARTprintf("%22s: Not a I2C channel: %x\n", "Cmd_HI()", i.channel);
-        return 0;
-    }
-    if (i.i2c_addr > 0x27) {
+    t_hw_index *i = &a->v[0].hw;
+    if (i->channel > 3) {
         REPORT_ERROR("ER:001E\n");
-        UARTprintf("%22s: Invalid i2c_addr: %x\n", "Cmd_HI()", i.i2c_addr);
+        UARTprintf("%22s: Not a I2C channel: %x\n", "Cmd_HI()", i->channel);
         return 0;
     }
-    i2c.channel = i.channel;
-    i2c.i2c_addr = i.i2c_addr;
+    i2c.channel = i->channel;
+    i2c.i2c_addr = i->i2c_addr;
     i2c.nWrite = 1;
     i2c.nRead = 0;
-    i2c.readBuff = NULL;
-    i2c.writeBuff = pvPortMalloc(1);
-    if (!i2c.writeBuff) {
-        UARTprintf("%22s: pvPortMalloc() failed\n", "Cmd_HI()");
+    i2c.binReply = 0;
+    i2c.seq = SEQ_NONE;
+    if (!i2c_custom_alloc(&i2c, (const uint8_t *)"\xFF")) {
+        REPORT_ERROR("ER:0022\n");
+        UARTprintf("%22s: transaction buffer not allocated :(\n", "Cmd_HI()");
         return 0;
     }
-    *i2c.writeBuff = 0xFF;
     // UARTprintf("%22s: CH: %x, ADDR: %x gets high\n", "Cmd_HI()", i2c.channel, i2c.i2c_addr);
     if(!xQueueSendToBack(g_i2c_queue, &i2c, 100 / portTICK_PERIOD_MS)) {
         UARTprintf("%22s: I2C queue full!\n", "Cmd_HI()");
-        vPortFree(i2c.writeBuff); i2c.writeBuff = NULL;
+        i2c_custom_free(&i2c);
     }
     return 0;
 }
@@ -16,21 +16,84 @@
 //*****************************************************************************
 // Defines
 //*****************************************************************************
-//#define CMD_PARSER_BUF_LEN (N_LEDS_MAX*3+28)   //Need 3072 for LED data blob of 1 channel
-#define CMD_PARSER_BUF_LEN 128                   //Most commands fit
+#define LED_FADE_MS     20      // Time between the steps of a LED fade [ms]
+#define USB_TX_WAIT_MS  50      // Max. time the parser waits for USB TX space before dropping a reply [ms]
+
+//-----------------------------------------------------------------------------
+// Binary command frames
+//-----------------------------------------------------------------------------
+// A command starting with BIN_FRAME_START is not parsed as ASCII, but as
+//   [BIN_FRAME_START] [opcode] [payload length, 16 bit LE] [payload]
+// Multi byte payload fields are little endian. Replies to the host use the
+// same framing with the BIN_REPLY bit set in the opcode.
+#define BIN_FRAME_START 0xFF
+#define BIN_HEADER_LEN  4
+#define BIN_MAX_PAYLOAD 64      // Does not apply to BIN_OP_LED
+#define BIN_REPLY       0x80
+// t_argSpec.binSize of variable length fields
+#define BIN_DATA        0xFE    // ARG_HEX: all bytes not taken by the fixed size fields
+#define BIN_BLOB        0xFF    // Length of the remaining payload, which is streamed by the handler
+//-----------------------------------------------------------------------------
+// Command schema
+//-----------------------------------------------------------------------------
+#define CMD_MAX_ARGS    8       // Max. number of arguments of a command
+#define CMD_HASH_SIZE   64      // Slots of the command name hash table, power of 2
+#define OPT_END         0xFF    // t_cmdEntry.optArg: optional arguments are at the end
+#define HW_INDEX_MAX    0x13F   // Highest valid hwIndex
+#define CMD_NAME_LEN    8       // Longest command name
+#define CMD_HEX_MAX     64      // Max. decoded bytes of an ASCII hex string argument
+
+// djb2 style hash of the command names, fed one char at a time
+#define CMD_HASH_INIT       5381
+#define CMD_HASH_STEP(h, c) (((h) * 33) ^ (uint8_t)(c))
+
+// Return values of the command handlers (same as in TivaWare cmdline.h)
+#define CMD_BAD_CMD         (-1)
+#define CMD_TOO_MANY_ARGS   (-2)
+#define CMD_TOO_FEW_ARGS    (-3)
+#define CMD_INVALID_ARG     (-4)
+
+// Sequence IDs. A command line can be prefixed with `#<seq> `, its errors and
+// its completion are then reported with ` #<seq>` appended.
+#define SEQ_NONE        (-1)
+#define SEQ_MAX         0xFFFF
 
 //*****************************************************************************
 // Custom types
 //*****************************************************************************
+typedef enum{
+    BIN_OP_OUT  = 0x01,   // u16 hwIndex, u16 PWMlow, u16 tPulse, u16 PWMhigh
+    BIN_OP_RUL  = 0x02,   // u8 ID, u16 IDin, u16 IDout, u16 trHoldOff, u16 tPulse,
+                          // u16 pwmOn, u16 pwmOff, u8 bPosEdge
+    BIN_OP_RULE = 0x03,   // u8 ID, u8 OnOff
+    BIN_OP_DEB  = 0x04,   // u16 hwIndex, u8 OnOff
+    BIN_OP_SWE  = 0x05,   // u8 mode, reply: 2 byte switch event records
+    BIN_OP_LED  = 0x06,   // u8 channel, binary blob of (length - 1) bytes
+    BIN_OP_I2C  = 0x07,   // u8 channel, u8 I2Caddr, sendData, u8 nBytesRx
+                          // reply: u8 channel, u8 flags, received data
+    BIN_OP_SW   = 0x08,   // no payload, reply: 40 bytes of switch states
+    BIN_OP_LEP  = 0x09,   // u8 channel, u16 offset, u8 bLatch, binary blob of (length - 4) bytes
+    BIN_OP_LEDD = 0x0A,   // u8 channel, LED spans of (length - 1) bytes
+    BIN_OP_LEDR = 0x0B,   // u8 channel, LED runs of (length - 1) bytes
+    BIN_OP_LEDI = 0x0C,   // u8 channel, palette indices of (length - 1) LEDs
+    BIN_OP_LPAL = 0x0D,   // u8 channel, u8 first color, RGB colors of (length - 2) bytes
+    BIN_OP_FADE = 0x0E,   // u8 channel, u16 first LED, u16 nLEDs, u32 RGB, u16 tFade
+    BIN_OP_LCMT = 0x0F,   // no payload
+    BIN_OP_SWS  = 0x10,   // [u8 bSampled], reply: u32 tick, 40 bytes debounced [, 40 bytes sampled]
+    BIN_OP_SWM  = 0x11,   // 40 bytes subscription mask
+    N_BIN_OP
+}t_binOpcode;
 
 //*****************************************************************************
 // Global vars
 //*****************************************************************************
 extern TaskHandle_t hUSBCommandParser;
-extern bool g_reportSwitchEvents;     //Flag: Should Switch events be reported on the serial port?
-extern uint8_t g_errorBuffer[8];      //For reporting 'ER:1234\n' style errors over USB
+extern uint8_t g_reportSwitchEvents;  //How should Switch events be reported on the serial port? (SWE_OFF, ...)
+extern bool g_recordSwitchSamples;    //Flag: Should raw switch samples be reported on the serial port?
 
-#define REPORT_ERROR(errStr) {memcpy(g_errorBuffer,errStr,8); ts_usbSend(g_errorBuffer,8);}
+// Report a 'ER:1234\n' style error over USB, tagged with the sequence ID of
+// the command being executed (if any)
+#define REPORT_ERROR(errStr) reportError(errStr, cmdSeq())
 
 //*****************************************************************************
 // Function / Task declarations
@@ -41,10 +104,13 @@ void taskUsbCommandParser(void *pvParameters);
 void taskI2CCustomReporter(void *pvParameters);
 void usbReporter(void *pvParameters);
 void ts_usbSend(uint8_t *data, uint16_t len);
-
-// Takes a string, returns a buff.
-// Make sure to free it after use.
-uint8_t *hexToBuff(char *str, unsigned *nWritten);
+void ts_usbSendFrame(uint8_t opcode, uint8_t *data, uint16_t len);
+// Like ts_usbSendFrame(), but returns false instead of reporting the dropped frame
+bool ts_usbTrySendFrame(uint8_t opcode, uint8_t *data, uint16_t len);
+// Sends errStr (8 chars), with ` #<seq>` inserted if seq is not SEQ_NONE
+void reportError(const char *errStr, int32_t seq);
+// Sequence ID of the command executed by the calling task, SEQ_NONE if there is none
+int32_t cmdSeq();
 
 // Takes a buffer, writes hex string to dest
 // returns pointer to \0 of \0 terminated string.
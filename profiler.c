@@ -0,0 +1,126 @@
+// Execution time statistics, see profiler.h
+#include <stdint.h>
+#include <stdbool.h>
+#include "inc/hw_types.h"
+#include "FreeRTOS.h"
+#include "task.h"
+#include "my_uartstdio.h"
+#include "main.h"
+#include "profiler.h"
+
+#ifdef PRF_ENABLE
+
+static t_prfCounter g_prfCounters[N_PRF];
+static t_prfEvent g_prfEvents[N_PRF_CNT];
+// Tick count at the last reset, to calculate event rates
+static TickType_t g_prfResetTick = 0;
+
+static const char *g_prfNames[N_PRF] = {
+    "process_IO",
+    "debounceAlgo",
+    "reportSwitchStates",
+    "handleBitRules",
+    "processQuickRules",
+    "setPCFOutput",
+    "readSwitchMatrix",
+    "fillPiongBuffer",
+    "i2c scan ch0",
+    "i2c scan ch1",
+    "i2c scan ch2",
+    "i2c scan ch3",
+    "cmdParse",
+    "rule -> i2c write",
+    "rule -> hw pwm",
+    "scan done -> procIO"
+};
+
+static const char *g_prfCntNames[N_PRF_CNT] = {
+    "commands",
+    "USB rx bytes",
+    "switch toggles",
+    "lost SE reports",
+    "1 ms loop overruns",
+    "dropped USB replies"
+};
+
+void prfInit()
+{
+    HWREG(DEMCR) |= DEMCR_TRCENA;
+    HWREG(DWT_CYCCNT) = 0;
+    HWREG(DWT_CTRL) |= DWT_CTRL_CYCCNTENA;
+    prfReset();
+}
+
+void prfReset()
+{
+    t_prfCounter *c = g_prfCounters;
+    for (unsigned i=0; i<N_PRF; i++) {
+        c->n = 0;
+        c->min = 0xFFFFFFFF;
+        c->max = 0;
+        c->sum = 0;
+        c++;
+    }
+    for (unsigned i=0; i<N_PRF_CNT; i++) {
+        g_prfEvents[i].n = 0;
+        g_prfEvents[i].max = 0;
+    }
+    g_prfResetTick = xTaskGetTickCount();
+}
+
+void prfStop(t_prfId id, uint32_t t0)
+{
+    // unsigned arithmetic takes care of counter wrap around
+    uint32_t dt = PRF_CYCLES() - t0;
+    t_prfCounter *c = &g_prfCounters[id];
+    c->n++;
+    c->sum += dt;
+    if (dt < c->min) c->min = dt;
+    if (dt > c->max) c->max = dt;
+}
+
+void prfCount(t_prfCntId id, uint32_t n)
+{
+    t_prfEvent *e = &g_prfEvents[id];
+    e->n += n;
+    if (n > e->max) e->max = n;
+}
+
+void prfPrint()
+{
+    // Values in [cycles], in brackets in [us]
+    UARTprintf("%20s %8s %14s %14s %14s\n", "Name", "N", "min", "avg", "max");
+    t_prfCounter *c = g_prfCounters;
+    for (unsigned i=0; i<N_PRF; i++) {
+        if (c->n == 0) {
+            UARTprintf("%20s %8d\n", g_prfNames[i], 0);
+        } else {
+            uint32_t avg = c->sum / c->n;
+            UARTprintf(
+                "%20s %8d %7d (%4d) %7d (%4d) %7d (%4d)\n",
+                g_prfNames[i],
+                c->n,
+                c->min, c->min / (SYSTEM_CLOCK / 1000000),
+                avg, avg / (SYSTEM_CLOCK / 1000000),
+                c->max, c->max / (SYSTEM_CLOCK / 1000000)
+            );
+        }
+        c++;
+    }
+    // Event rates over the time since the last reset
+    uint32_t dt = (xTaskGetTickCount() - g_prfResetTick) / portTICK_PERIOD_MS;
+    UARTprintf("%20s %8s %14s %14s   (%d ms)\n", "Event", "N", "per second", "max", dt);
+    t_prfEvent *e = g_prfEvents;
+    for (unsigned i=0; i<N_PRF_CNT; i++) {
+        UARTprintf(
+            "%20s %8d %14d %14d\n",
+            g_prfCntNames[i],
+            e->n,
+            dt ? (uint32_t)((uint64_t)e->n * 1000 / dt) : 0,
+            e->max
+        );
+        e++;
+    }
+}
+
+#endif /* PRF_ENABLE */
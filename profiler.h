@@ -0,0 +1,102 @@
+// Execution time statistics for the time critical parts of the firmware.
+// Based on the free running cycle counter of the Cortex-M4 DWT unit,
+// so numbers are in CPU cycles (80 per us) and can be read out at any time
+// with the PRF command.
+// Only built with PRF_ENABLE defined (make PRF=1), otherwise the functions
+// below are no-ops and their arguments are not evaluated.
+
+#ifndef PROFILER_H_
+#define PROFILER_H_
+#include <stdint.h>
+#include <stdbool.h>
+#include "inc/hw_types.h"
+
+//*****************************************************************************
+// Defines
+//*****************************************************************************
+// Data Watchpoint and Trace unit registers (not covered by TivaWare)
+#define DWT_CTRL            0xE0001000
+#define DWT_CYCCNT          0xE0001004
+#define DWT_CTRL_CYCCNTENA  (1 << 0)
+// Debug Exception and Monitor Control Register
+#define DEMCR               0xE000EDFC
+#define DEMCR_TRCENA        (1 << 24)
+
+// Current value of the free running cycle counter
+#ifdef PRF_ENABLE
+#define PRF_CYCLES() HWREG(DWT_CYCCNT)
+#else
+#define PRF_CYCLES() 0
+#endif
+
+//--------------
+// Custom types
+//--------------
+// One slot for each measured code section
+typedef enum {
+    PRF_PROCESS_IO,     // whole process_IO()
+    PRF_DEBOUNCE,       // debounceAlgo()
+    PRF_REPORT_SW,      // reportSwitchStates()
+    PRF_BIT_RULES,      // handleBitRules()
+    PRF_QUICK_RULES,    // processQuickRules()
+    PRF_SET_OUTPUT,     // setPCFOutput()
+    PRF_SWITCH_MATRIX,  // readSwitchMatrix()
+    PRF_FILL_PIONG,     // fillPiongBuffer() from within spiISR()
+    PRF_I2C_SCAN_0,     // trigger_i2c_cycle() until I2C channel 0 is done
+    PRF_I2C_SCAN_1,     // ... channel 1
+    PRF_I2C_SCAN_2,     // ... channel 2
+    PRF_I2C_SCAN_3,     // ... channel 3
+    PRF_CMD_PARSE,      // cmdParse(), one USB command incl. its handler
+    PRF_RULE_I2C,       // PCF scan of the triggering sample until a quick rule
+                        //   output has been written to its PCF
+    PRF_RULE_PWM,       // ... until a quick rule has set its HW. PWM output
+    PRF_IO_WAKEUP,      // last I2C ISR of a scan done until task_pcf_io() runs process_IO()
+    N_PRF
+} t_prfId;
+
+// Event counters, reported as total and as rate per second
+typedef enum {
+    PRF_CNT_CMDS,       // Commands parsed
+    PRF_CNT_RX_BYTES,   // Bytes read from the USB receive buffer
+    PRF_CNT_TOGGLES,    // Debounced switch state changes (counted per tick)
+    PRF_CNT_SE_LOST,    // Switch event reports cut short (text) or events dropped (binary)
+    PRF_CNT_OVERRUN,    // task_pcf_io() iterations which took longer than 1 tick
+    PRF_CNT_USB_DROP,   // Replies dropped as they did not fit into the USB send buffer
+    N_PRF_CNT
+} t_prfCntId;
+
+typedef struct {
+    uint32_t n;         // number of measurements
+    uint32_t min;       // [cycles]
+    uint32_t max;       // [cycles]
+    uint64_t sum;       // [cycles]
+} t_prfCounter;
+
+typedef struct {
+    uint32_t n;         // sum of all counts
+    uint32_t max;       // largest count added at once
+} t_prfEvent;
+
+//--------------
+// Functions
+//--------------
+#ifdef PRF_ENABLE
+// Enable the cycle counter and clear all statistics
+void prfInit();
+// Clear all statistics
+void prfReset();
+// Add the cycles ellapsed since t0 = PRF_CYCLES() to the statistics of id
+void prfStop(t_prfId id, uint32_t t0);
+// Add n to the event counter id and keep track of the largest n
+void prfCount(t_prfCntId id, uint32_t n);
+// Print table of all statistics to UART
+void prfPrint();
+#else
+#define prfInit()
+#define prfReset()
+#define prfStop(id, t0)     ((void)sizeof(t0))
+#define prfCount(id, n)     ((void)sizeof(n))
+#define prfPrint()
+#endif
+
+#endif /* PROFILER_H_ */
@@ -7,6 +7,7 @@
 #include "my_uartstdio.h"
 #include "io_manager.h"
 #include "quick_rules.h"
+#include "profiler.h"
 
 // to keep track of quick-fire rules configurations
 static t_quickRule g_QuickRuleList[MAX_QUICK_RULES];
@@ -14,6 +15,24 @@ static t_quickRule g_QuickRuleList[MAX_QUICK_RULES];
 // Naughty but convenient way of addressing a single flag-bit
 #define TF(f) HWREGBITB(&currentRule->triggerFlags, f)
 
+#ifdef PRF_ENABLE
+static void stampQuickRule(t_hw_index *out) {
+    // Measure the latency from sampling the trigger input until the output
+    // is on the wire. The inputs have been sampled during the last PCF scan
+    // (the switch matrix is read in parallel to it).
+    uint32_t t0 = get_i2c_cycle_start();
+    t_pcf_state *pcf;
+    if (out->channel == C_FAST_PWM) {
+        // setPwm() has been called already
+        prfStop(PRF_RULE_PWM, t0);
+    } else if ((pcf = get_pcf(out))) {
+        // The next PCF scan will write it, see i2c_isr()
+        pcf->rule_stamp = t0;
+        pcf->flags |= FPCF_RULE_PEND;
+    }
+}
+#endif
+
 void processQuickRules() {
 //    Trigger HoldOFF time (when is the trigger counted as not active?
 //    OFF after release after holdoff
@@ -55,6 +74,9 @@ void processQuickRules() {
                         setPCFOutput( &(currentRule->outputDriverId),
                                       currentRule->tPulse, currentRule->pwmHigh,
                                       currentRule->pwmLow );
+#ifdef PRF_ENABLE
+                        stampQuickRule( &(currentRule->outputDriverId) );
+#endif
                     }
                 }
             }
@@ -85,4 +85,5 @@ void readSwitchMatrix() {
         g_SwitchStateSampled.switchState.matrixData[nRow] = getSMrow();
         advanceSMrow();
     }
+    g_switchSampleTime[C_SWITCH_MATRIX] = US_TIMESTAMP();
 }